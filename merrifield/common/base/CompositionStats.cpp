@@ -0,0 +1,157 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <HwcTrace.h>
+#include <CompositionStats.h>
+
+namespace android {
+namespace intel {
+
+const char *CompositionStats::sOutcomeNames[OUTCOME_COUNT] = {
+    "overlay",
+    "sprite",
+    "primary",
+    "cursor",
+    "gles",
+};
+
+const char *CompositionStats::sReasonNames[REASON_COUNT] = {
+    "forced_fb",
+    "transform",
+    "format",
+    "size",
+    "blending",
+    "scaling",
+    "alignment",
+    "overlay_disallowed",
+    "zorder",
+    "hw_workaround",
+    "no_plane",
+    "update_failed",
+    "protected",
+};
+
+CompositionStats::CompositionStats()
+{
+    memset(mStats, 0, sizeof(mStats));
+}
+
+CompositionStats::~CompositionStats()
+{
+}
+
+void CompositionStats::rollWindow(DisplayStats& stats, nsecs_t now)
+{
+    if (stats.windowStart == 0) {
+        stats.windowStart = now;
+        return;
+    }
+
+    if (now - stats.windowStart < milliseconds(WINDOW_DURATION)) {
+        return;
+    }
+
+    stats.lastWindow = stats.window;
+    memset(&stats.window, 0, sizeof(stats.window));
+    stats.windowStart = now;
+}
+
+void CompositionStats::recordFrame(int disp, const uint32_t *outcomes, const uint32_t *reasons)
+{
+    if (disp < 0 || disp >= IDisplayDevice::DEVICE_COUNT || !outcomes || !reasons) {
+        return;
+    }
+
+    Mutex::Autolock _l(mLock);
+    DisplayStats& stats = mStats[disp];
+    rollWindow(stats, systemTime(SYSTEM_TIME_MONOTONIC));
+    stats.total.frames++;
+    stats.window.frames++;
+    for (int i = 0; i < OUTCOME_COUNT; i++) {
+        stats.total.outcomes[i] += outcomes[i];
+        stats.window.outcomes[i] += outcomes[i];
+    }
+    for (int i = 0; i < REASON_COUNT; i++) {
+        stats.total.reasons[i] += reasons[i];
+        stats.window.reasons[i] += reasons[i];
+    }
+}
+
+void CompositionStats::dumpCounters(Dump& d, const char *name, const Counters& c)
+{
+    uint32_t layers = 0;
+    for (int i = 0; i < OUTCOME_COUNT; i++) {
+        layers += c.outcomes[i];
+    }
+    uint32_t gles = c.outcomes[OUTCOME_GLES];
+
+    d.append("  %-6s: frames %u, layers %u, GLES fallback %u.%u%%\n",
+             name, c.frames, layers,
+             layers ? gles * 100 / layers : 0,
+             layers ? (gles * 1000 / layers) % 10 : 0);
+    d.append("          ");
+    for (int i = 0; i < OUTCOME_COUNT; i++) {
+        d.append("%s %u%s", sOutcomeNames[i], c.outcomes[i],
+                 i == OUTCOME_COUNT - 1 ? "\n" : ", ");
+    }
+    d.append("          rejected:");
+    for (int i = 0; i < REASON_COUNT; i++) {
+        if (c.reasons[i]) {
+            d.append(" %s %u", sReasonNames[i], c.reasons[i]);
+        }
+    }
+    d.append("\n");
+}
+
+void CompositionStats::dumpCountersRaw(Dump& d, int disp, const char *scope, const Counters& c)
+{
+    d.append("compstats disp=%d scope=%s frames=%u", disp, scope, c.frames);
+    for (int i = 0; i < OUTCOME_COUNT; i++) {
+        d.append(" %s=%u", sOutcomeNames[i], c.outcomes[i]);
+    }
+    for (int i = 0; i < REASON_COUNT; i++) {
+        d.append(" reject_%s=%u", sReasonNames[i], c.reasons[i]);
+    }
+    d.append("\n");
+}
+
+void CompositionStats::dump(Dump& d)
+{
+    Mutex::Autolock _l(mLock);
+
+    d.append("Composition statistics (window %dms):\n", WINDOW_DURATION);
+    for (int i = 0; i < IDisplayDevice::DEVICE_COUNT; i++) {
+        const DisplayStats& stats = mStats[i];
+        if (stats.total.frames == 0) {
+            continue;
+        }
+        d.append(" display %d\n", i);
+        dumpCounters(d, "total", stats.total);
+        dumpCounters(d, "window", stats.lastWindow);
+    }
+
+    // one line per display and scope, for tools parsing dumpsys output
+    for (int i = 0; i < IDisplayDevice::DEVICE_COUNT; i++) {
+        const DisplayStats& stats = mStats[i];
+        if (stats.total.frames == 0) {
+            continue;
+        }
+        dumpCountersRaw(d, i, "total", stats.total);
+        dumpCountersRaw(d, i, "window", stats.lastWindow);
+    }
+}
+
+} // namespace intel
+} // namespace android
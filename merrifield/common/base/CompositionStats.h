@@ -0,0 +1,105 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef COMPOSITION_STATS_H
+#define COMPOSITION_STATS_H
+
+#include <utils/threads.h>
+#include <utils/Timers.h>
+#include <IDisplayDevice.h>
+#include <Dump.h>
+
+
+namespace android {
+namespace intel {
+
+// per display counters of how layers end up being composed and why
+// layers fall back to GLES, kept since boot and for the last window.
+// Each layer is counted once per frame, a GLES layer with its final reason
+class CompositionStats {
+public:
+    // final composition of a layer in a frame
+    enum {
+        OUTCOME_OVERLAY = 0,
+        OUTCOME_SPRITE,
+        OUTCOME_PRIMARY,
+        OUTCOME_CURSOR,
+        OUTCOME_GLES,
+        OUTCOME_COUNT,
+    };
+
+    // reason a layer was not put on a plane
+    enum {
+        REASON_FORCED_FB = 0,       // forced to GLES, skip flag or not a composer buffer
+        REASON_TRANSFORM,
+        REASON_FORMAT,
+        REASON_SIZE,
+        REASON_BLENDING,
+        REASON_SCALING,
+        REASON_ALIGNMENT,           // overlay source offset not 64 bytes aligned
+        REASON_OVERLAY_DISALLOWED,  // overlay not allowed by display analyzer
+        REASON_ZORDER,              // candidate left to GLES after a z order was rejected
+        REASON_HW_WORKAROUND,       // same, rejected by the overlay HW workaround
+        REASON_NO_PLANE,            // candidate left to GLES after plane allocation
+        REASON_UPDATE_FAILED,       // plane failed to take the buffer
+        REASON_PROTECTED,           // protected layer composed by GLES, whatever the cause
+        REASON_COUNT,
+    };
+
+public:
+    CompositionStats();
+    virtual ~CompositionStats();
+
+public:
+    // outcomes holds the number of layers per OUTCOME_* in one frame,
+    // reasons the number of GLES layers per REASON_*
+    void recordFrame(int disp, const uint32_t *outcomes, const uint32_t *reasons);
+    void dump(Dump& d);
+
+private:
+    struct Counters {
+        uint32_t frames;
+        uint32_t outcomes[OUTCOME_COUNT];
+        uint32_t reasons[REASON_COUNT];
+    };
+
+    struct DisplayStats {
+        Counters total;
+        // window being accumulated and the last completed one
+        Counters window;
+        Counters lastWindow;
+        nsecs_t windowStart;
+    };
+
+    void rollWindow(DisplayStats& stats, nsecs_t now);
+    void dumpCounters(Dump& d, const char *name, const Counters& c);
+    void dumpCountersRaw(Dump& d, int disp, const char *scope, const Counters& c);
+
+private:
+    enum {
+        WINDOW_DURATION = 5000, // 5s
+    };
+
+    static const char *sOutcomeNames[OUTCOME_COUNT];
+    static const char *sReasonNames[REASON_COUNT];
+
+    Mutex mLock;
+    DisplayStats mStats[IDisplayDevice::DEVICE_COUNT];
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* COMPOSITION_STATS_H */
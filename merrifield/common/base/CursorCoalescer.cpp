@@ -0,0 +1,211 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <HwcTrace.h>
+#include <cutils/properties.h>
+#include <CursorCoalescer.h>
+
+namespace android {
+namespace intel {
+
+CursorCoalescer::CursorCoalescer(IDisplayContext& context)
+    : mDisplayContext(context),
+      mLatencyBudget(0),
+      mExitThread(false),
+      mInitialized(false)
+{
+    memset(mCursors, 0, sizeof(mCursors));
+}
+
+CursorCoalescer::~CursorCoalescer()
+{
+    WARN_IF_NOT_DEINIT();
+}
+
+bool CursorCoalescer::initialize()
+{
+    char prop[PROPERTY_VALUE_MAX];
+    int budget = DEFAULT_LATENCY_BUDGET;
+    if (property_get("hwc.cursor.latency_us", prop, NULL) > 0) {
+        budget = atoi(prop);
+    }
+    mLatencyBudget = microseconds(budget);
+
+    memset(mCursors, 0, sizeof(mCursors));
+    for (int i = 0; i < IDisplayDevice::DEVICE_COUNT; i++) {
+        mCursors[i].vsyncPeriod = DEFAULT_VSYNC_PERIOD;
+    }
+
+    mExitThread = false;
+    mThread = new CursorFlushThread(this);
+    if (!mThread.get()) {
+        DEINIT_AND_RETURN_FALSE("failed to create cursor flush thread");
+    }
+    mThread->run("CursorFlush", PRIORITY_URGENT_DISPLAY);
+    mInitialized = true;
+    return true;
+}
+
+void CursorCoalescer::deinitialize()
+{
+    if (mThread.get()) {
+        {
+            Mutex::Autolock _l(mLock);
+            mExitThread = true;
+            mCondition.signal();
+        }
+        mThread->requestExitAndWait();
+        mThread = NULL;
+    }
+    mInitialized = false;
+}
+
+bool CursorCoalescer::setPosition(int disp, int x, int y)
+{
+    if (disp < 0 || disp >= IDisplayDevice::DEVICE_COUNT) {
+        ETRACE("invalid disp %d", disp);
+        return false;
+    }
+
+    Mutex::Autolock _l(mLock);
+    CursorState& state = mCursors[disp];
+    state.updates++;
+    state.x = x;
+    state.y = y;
+    if (state.pending) {
+        // previous position is replaced before it reached the hardware
+        state.collapsed++;
+        return true;
+    }
+    state.pending = true;
+    mCondition.signal();
+    return true;
+}
+
+void CursorCoalescer::onVsync(int disp, nsecs_t timestamp)
+{
+    if (disp < 0 || disp >= IDisplayDevice::DEVICE_COUNT) {
+        return;
+    }
+
+    Mutex::Autolock _l(mLock);
+    CursorState& state = mCursors[disp];
+    nsecs_t delta = timestamp - state.lastVsync;
+    if (state.lastVsync && delta > state.vsyncPeriod / 2 &&
+        delta < state.vsyncPeriod * 3 / 2) {
+        // smooth out timestamp jitter, missed vsyncs are not sampled
+        state.vsyncPeriod += (delta - state.vsyncPeriod) / 8;
+    }
+    state.lastVsync = timestamp;
+}
+
+nsecs_t CursorCoalescer::getFlushTime(const CursorState& state, nsecs_t now)
+{
+    nsecs_t period = state.vsyncPeriod;
+
+    if (!state.lastVsync || now - state.lastVsync > period * VSYNC_STALE_PERIODS) {
+        // vsync is off, still write at most once per frame
+        nsecs_t flushTime = state.lastFlush + period;
+        return flushTime > now ? flushTime : now;
+    }
+
+    // first predicted vsync after now that has not been written for yet
+    nsecs_t next = state.lastVsync + ((now - state.lastVsync) / period + 1) * period;
+    if (next - mLatencyBudget <= state.lastFlush) {
+        next += period;
+    }
+    nsecs_t flushTime = next - mLatencyBudget;
+    return flushTime > now ? flushTime : now;
+}
+
+bool CursorCoalescer::threadLoop()
+{
+    int x[IDisplayDevice::DEVICE_COUNT];
+    int y[IDisplayDevice::DEVICE_COUNT];
+    bool flush[IDisplayDevice::DEVICE_COUNT];
+    bool flushing = false;
+
+    { // scope for lock
+        Mutex::Autolock _l(mLock);
+        if (mExitThread) {
+            ITRACE("exiting thread loop");
+            return false;
+        }
+
+        nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+        nsecs_t timeout = -1;
+        for (int i = 0; i < IDisplayDevice::DEVICE_COUNT; i++) {
+            CursorState& state = mCursors[i];
+            flush[i] = false;
+            if (!state.pending) {
+                continue;
+            }
+
+            nsecs_t flushTime = getFlushTime(state, now);
+            if (flushTime > now) {
+                if (timeout < 0 || flushTime - now < timeout) {
+                    timeout = flushTime - now;
+                }
+                continue;
+            }
+
+            x[i] = state.x;
+            y[i] = state.y;
+            flush[i] = true;
+            flushing = true;
+            state.pending = false;
+            state.lastFlush = now;
+            state.flushes++;
+        }
+
+        if (!flushing) {
+            if (timeout < 0) {
+                mCondition.wait(mLock);
+            } else {
+                mCondition.waitRelative(mLock, timeout);
+            }
+            return true;
+        }
+    }
+
+    // write outside of the lock so new positions can still be latched
+    for (int i = 0; i < IDisplayDevice::DEVICE_COUNT; i++) {
+        if (flush[i] && !mDisplayContext.setCursorPosition(i, x[i], y[i])) {
+            WTRACE("failed to set cursor position on disp %d", i);
+        }
+    }
+    return true;
+}
+
+void CursorCoalescer::dump(Dump& d)
+{
+    Mutex::Autolock _l(mLock);
+
+    d.append("Cursor updates (latency budget %lldus):\n",
+             (long long)(mLatencyBudget / 1000));
+    for (int i = 0; i < IDisplayDevice::DEVICE_COUNT; i++) {
+        const CursorState& state = mCursors[i];
+        if (state.updates == 0) {
+            continue;
+        }
+        d.append("  disp %d: updates %u, written %u, collapsed %u (%u%%), vsync period %lldus\n",
+                 i, state.updates, state.flushes, state.collapsed,
+                 state.collapsed * 100 / state.updates,
+                 (long long)(state.vsyncPeriod / 1000));
+    }
+}
+
+} // namespace intel
+} // namespace android
@@ -0,0 +1,83 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef CURSOR_COALESCER_H
+#define CURSOR_COALESCER_H
+
+#include <utils/threads.h>
+#include <utils/Timers.h>
+#include <SimpleThread.h>
+#include <IDisplayDevice.h>
+#include <IDisplayContext.h>
+#include <Dump.h>
+
+
+namespace android {
+namespace intel {
+
+// latches cursor positions per display and writes only the latest one,
+// once per vsync and a latency budget ahead of the predicted vsync
+class CursorCoalescer {
+public:
+    CursorCoalescer(IDisplayContext& context);
+    virtual ~CursorCoalescer();
+
+public:
+    bool initialize();
+    void deinitialize();
+    bool setPosition(int disp, int x, int y);
+    void onVsync(int disp, nsecs_t timestamp);
+    void dump(Dump& d);
+
+private:
+    struct CursorState {
+        int x;
+        int y;
+        bool pending;
+        nsecs_t lastFlush;
+        // vsync model, last timestamp and estimated period
+        nsecs_t lastVsync;
+        nsecs_t vsyncPeriod;
+        uint32_t updates;
+        uint32_t collapsed;
+        uint32_t flushes;
+    };
+
+    nsecs_t getFlushTime(const CursorState& state, nsecs_t now);
+
+private:
+    enum {
+        DEFAULT_LATENCY_BUDGET = 2000, // 2ms before vsync
+        DEFAULT_VSYNC_PERIOD = 16666667, // 60Hz
+        // vsync model is stale after this many periods without vsync
+        VSYNC_STALE_PERIODS = 4,
+    };
+
+    IDisplayContext& mDisplayContext;
+    Mutex mLock;
+    Condition mCondition;
+    CursorState mCursors[IDisplayDevice::DEVICE_COUNT];
+    nsecs_t mLatencyBudget;
+    bool mExitThread;
+    bool mInitialized;
+
+private:
+    DECLARE_THREAD(CursorFlushThread, CursorCoalescer);
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* CURSOR_COALESCER_H */
@@ -22,7 +22,9 @@
 #include <Hwcomposer.h>
 #include <DisplayAnalyzer.h>
 #include <cutils/properties.h>
+#include <cutils/atomic.h>
 #include <GraphicBuffer.h>
+#include <PrimaryDevice.h>
 #include <ExternalDevice.h>
 #include <VirtualDevice.h>
 
@@ -39,12 +41,22 @@ DisplayAnalyzer::DisplayAnalyzer()
       mActiveInputState(true),
       mIgnoreVideoSkipFlag(false),
       mProtectedVideoSession(false),
+      mVideoExtModeDirty(true),
+      mPrimaryVideoLayer(-1),
+      mSecondaryVideoDevice(-1),
+      mSecondaryVideoLayer(-1),
       mCachedNumDisplays(0),
       mCachedDisplays(0),
+      mEventQueueHead(0),
+      mEventLock(),
+      mEventQueueTail(0),
       mPendingEvents(),
-      mEventMutex(),
-      mEventHandledCondition()
+      mPostedEvents(0),
+      mDroppedEvents(0),
+      mCoalescedEvents(0),
+      mMaxEventQueueDepth(0)
 {
+    resetEventQueue();
 }
 
 DisplayAnalyzer::~DisplayAnalyzer()
@@ -65,9 +77,13 @@ bool DisplayAnalyzer::initialize()
     mActiveInputState = true;
     mIgnoreVideoSkipFlag = false;
     mProtectedVideoSession = false;
+    mVideoExtModeDirty = true;
+    mPrimaryVideoLayer = -1;
+    mSecondaryVideoDevice = -1;
+    mSecondaryVideoLayer = -1;
     mCachedNumDisplays = 0;
     mCachedDisplays = 0;
-    mPendingEvents.clear();
+    resetEventQueue();
     mVideoStateMap.clear();
     mInitialized = true;
 
@@ -76,7 +92,7 @@ bool DisplayAnalyzer::initialize()
 
 void DisplayAnalyzer::deinitialize()
 {
-    mPendingEvents.clear();
+    resetEventQueue();
     mVideoStateMap.clear();
     mInitialized = false;
 }
@@ -128,6 +144,7 @@ void DisplayAnalyzer::checkVideoExtMode()
 {
     if (mVideoStateMap.size() != 1) {
         mVideoExtModeEligible = false;
+        mVideoExtModeDirty = true;
         return;
     }
 
@@ -138,6 +155,7 @@ void DisplayAnalyzer::checkVideoExtMode()
 
     if ((!eDev || !eDev->isConnected()) && (!vDev || !vDev->isFrameServerActive())) {
         mVideoExtModeEligible = false;
+        mVideoExtModeDirty = true;
         return;
     }
 
@@ -158,19 +176,62 @@ void DisplayAnalyzer::checkVideoExtMode()
 
     if (activeDisplays <= 1) {
         mVideoExtModeEligible = false;
+        mVideoExtModeDirty = true;
         return;
     }
 
-    // video state update event may come later than geometry change event.
-    // in that case, video extended mode is not detected properly.
-#if 0
-    if (geometryChanged == false) {
+    // video state update event may come later than geometry change event,
+    // video events and hotplug mark the previous analysis dirty. Otherwise
+    // layers are only scanned again on geometry change or if the video
+    // layer no longer shows up where it was found.
+    if (!geometryChanged && !mVideoExtModeDirty && isVideoLayerCacheValid()) {
         // use previous analysis result
         return;
     }
-#endif
+
+    mVideoExtModeDirty = false;
+    detectVideoExtMode();
+}
+
+bool DisplayAnalyzer::isVideoLayerCacheValid()
+{
+    if (mPrimaryVideoLayer < 0) {
+        // video layer can only appear with geometry change
+        return true;
+    }
+
+    hwc_display_contents_1_t *primary = mCachedDisplays[0];
+    if (!primary || mPrimaryVideoLayer >= (int)primary->numHwLayers - 1) {
+        return false;
+    }
+
+    if (mSecondaryVideoDevice < 0) {
+        return true;
+    }
+
+    if (mSecondaryVideoDevice >= (int)mCachedNumDisplays) {
+        return false;
+    }
+
+    hwc_display_contents_1_t *content = mCachedDisplays[mSecondaryVideoDevice];
+    if (!content || mSecondaryVideoLayer >= (int)content->numHwLayers - 1) {
+        return false;
+    }
+
+    // both devices flip the same video buffer
+    return content->hwLayers[mSecondaryVideoLayer].handle ==
+           primary->hwLayers[mPrimaryVideoLayer].handle;
+}
+
+void DisplayAnalyzer::detectVideoExtMode()
+{
+    hwc_display_contents_1_t *content = NULL;
+
     // reset eligibility of video extended mode
     mVideoExtModeEligible = false;
+    mPrimaryVideoLayer = -1;
+    mSecondaryVideoDevice = -1;
+    mSecondaryVideoLayer = -1;
 
     // check if there is video layer in the primary device
     content = mCachedDisplays[0];
@@ -192,6 +253,7 @@ void DisplayAnalyzer::checkVideoExtMode()
             }
             videoHandle = content->hwLayers[j].handle;
             videoFullScreenOnPrimary = isVideoFullScreen(0, content->hwLayers[j]);
+            mPrimaryVideoLayer = j;
             break;
         }
     }
@@ -215,6 +277,8 @@ void DisplayAnalyzer::checkVideoExtMode()
             if (content->hwLayers[j].handle == videoHandle) {
                 isVideoLayerSkipped |= (content->hwLayers[j].flags & HWC_SKIP_LAYER);
                 VTRACE("video layer exists in device %d", i);
+                mSecondaryVideoDevice = i;
+                mSecondaryVideoLayer = j;
                 if (isVideoLayerSkipped || videoFullScreenOnPrimary){
                     VTRACE("Video ext mode eligible, %d, %d",
                             isVideoLayerSkipped, videoFullScreenOnPrimary);
@@ -376,15 +440,61 @@ void DisplayAnalyzer::postIdleEntryEvent(void)
     postEvent(e);
 }
 
+void DisplayAnalyzer::postExtModeReloadEvent()
+{
+    Event e;
+    e.type = EXTMODE_RELOAD_EVENT;
+    e.nValue = 0;
+    postEvent(e);
+}
+
+void DisplayAnalyzer::getState(State& state)
+{
+    state.overlayAllowed = isOverlayAllowed();
+    state.ignoreVideoSkipFlag = ignoreVideoSkipFlag();
+    state.videoInstances = getVideoInstances();
+    state.firstVideoSessionID = getFirstVideoInstanceSessionID();
+}
+
 void DisplayAnalyzer::postEvent(Event& e)
 {
-    Mutex::Autolock lock(mEventMutex);
-    mPendingEvents.add(e);
+    // claim a slot by advancing the head, never blocks
+    int32_t pos = android_atomic_acquire_load(&mEventQueueHead);
+    EventSlot *slot;
+    for (;;) {
+        slot = &mEventQueue[pos & (EVENT_QUEUE_SIZE - 1)];
+        int32_t diff = android_atomic_acquire_load(&slot->sequence) - pos;
+        if (diff == 0) {
+            if (android_atomic_cmpxchg(pos, pos + 1, &mEventQueueHead) == 0)
+                break;
+        } else if (diff < 0) {
+            // consumer is a full ring behind, should never happen
+            android_atomic_inc(&mDroppedEvents);
+            WTRACE("event queue is full, event %d dropped", e.type);
+            return;
+        }
+        pos = android_atomic_acquire_load(&mEventQueueHead);
+    }
+
+    slot->event = e;
+    android_atomic_release_store(pos + 1, &slot->sequence);
+    android_atomic_inc(&mPostedEvents);
 }
 
 bool DisplayAnalyzer::getEvent(Event& e)
 {
-    Mutex::Autolock lock(mEventMutex);
+    Mutex::Autolock _l(mEventLock);
+    // move all published events to pending list
+    for (;;) {
+        EventSlot *slot = &mEventQueue[mEventQueueTail & (EVENT_QUEUE_SIZE - 1)];
+        if (android_atomic_acquire_load(&slot->sequence) != mEventQueueTail + 1)
+            break;
+        queueEvent(slot->event);
+        android_atomic_release_store(mEventQueueTail + EVENT_QUEUE_SIZE,
+                                     &slot->sequence);
+        mEventQueueTail++;
+    }
+
     if (mPendingEvents.size() == 0) {
         return false;
     }
@@ -393,6 +503,67 @@ bool DisplayAnalyzer::getEvent(Event& e)
     return true;
 }
 
+void DisplayAnalyzer::queueEvent(const Event& e)
+{
+    // coalesce back-to-back events that carry no value and whose handling
+    // only depends on current state, and blank or input events repeating
+    // the value before them. transitions are handled one by one, each of
+    // them has side effects
+    size_t size = mPendingEvents.size();
+    if (size > 0 && mPendingEvents[size - 1].type == e.type) {
+        switch (e.type) {
+        case TIMING_EVENT:
+        case VIDEO_CHECK_EVENT:
+            mPendingEvents.editItemAt(size - 1) = e;
+            mCoalescedEvents++;
+            return;
+        case BLANK_EVENT:
+        case INPUT_EVENT:
+            if (mPendingEvents[size - 1].bValue == e.bValue) {
+                mCoalescedEvents++;
+                return;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    mPendingEvents.add(e);
+    if ((int)mPendingEvents.size() > mMaxEventQueueDepth) {
+        mMaxEventQueueDepth = mPendingEvents.size();
+    }
+}
+
+void DisplayAnalyzer::resetEventQueue()
+{
+    Mutex::Autolock _l(mEventLock);
+    // only called when no event can be posted
+    for (int i = 0; i < EVENT_QUEUE_SIZE; i++) {
+        mEventQueue[i].sequence = i;
+    }
+    mEventQueueHead = 0;
+    mEventQueueTail = 0;
+    mPendingEvents.clear();
+}
+
+void DisplayAnalyzer::dump(Dump& d)
+{
+    d.append("Display Analyzer state:\n");
+    d.append("  video ext mode: enabled %d, eligible %d, active %d\n",
+             mVideoExtModeEnabled, mVideoExtModeEligible, mVideoExtModeActive);
+
+    Mutex::Autolock _l(mEventLock);
+    d.append("  events: pending %d, queued %d, max depth %d, posted %d, "
+             "coalesced %d, dropped %d\n",
+             mPendingEvents.size(),
+             android_atomic_acquire_load(&mEventQueueHead) - mEventQueueTail,
+             mMaxEventQueueDepth,
+             android_atomic_acquire_load(&mPostedEvents),
+             mCoalescedEvents,
+             android_atomic_acquire_load(&mDroppedEvents));
+}
+
 void DisplayAnalyzer::handlePendingEvents()
 {
     // handle one event per analysis to avoid blocking surface flinger
@@ -430,12 +601,16 @@ void DisplayAnalyzer::handlePendingEvents()
     case VIDEO_CHECK_EVENT:
         handleVideoCheckEvent();
         break;
+    case EXTMODE_RELOAD_EVENT:
+        handleExtModeReloadEvent();
+        break;
     }
 }
 
 void DisplayAnalyzer::handleHotplugEvent(bool connected)
 {
     Hwcomposer *hwc = &Hwcomposer::getInstance();
+    mVideoExtModeDirty = true;
     if (connected) {
         if (mVideoStateMap.size() == 1) {
             // Some video apps wouldn't update video state again when plugin HDMI
@@ -524,6 +699,7 @@ void DisplayAnalyzer::handleTimingEvent()
 
 void DisplayAnalyzer::handleVideoEvent(int instanceID, int state)
 {
+    mVideoExtModeDirty = true;
     mVideoStateMap.removeItem(instanceID);
     if (state != VIDEO_PLAYBACK_STOPPED) {
         mVideoStateMap.add(instanceID, state);
@@ -690,7 +866,15 @@ void DisplayAnalyzer::handleIdleEntryEvent(int count)
 
     setCompositionType(0, HWC_FORCE_FRAMEBUFFER, true);
 
-    // next prepare/set will exit idle state.
+    PrimaryDevice *pDev = static_cast<PrimaryDevice *>(
+        Hwcomposer::getInstance().getDisplayDevice(IDisplayDevice::DEVICE_PRIMARY));
+    if (pDev) {
+        pDev->onIdleEntry();
+    }
+
+    // next prepare/set will exit idle state. input event invalidates, so
+    // idle is exited and planes are assigned again ahead of the next
+    // frame of the application.
     Event e;
     e.type = IDLE_EXIT_EVENT;
     postEvent(e);
@@ -701,6 +885,12 @@ void DisplayAnalyzer::handleIdleExitEvent()
     DTRACE("handling idle exit event");
 
     setCompositionType(0, HWC_FRAMEBUFFER, true);
+
+    PrimaryDevice *pDev = static_cast<PrimaryDevice *>(
+        Hwcomposer::getInstance().getDisplayDevice(IDisplayDevice::DEVICE_PRIMARY));
+    if (pDev) {
+        pDev->onIdleExit();
+    }
 }
 
 void DisplayAnalyzer::handleVideoCheckEvent()
@@ -748,6 +938,12 @@ void DisplayAnalyzer::handleVideoCheckEvent()
     postEvent(e);
 }
 
+void DisplayAnalyzer::handleExtModeReloadEvent()
+{
+    // reloads the property, changes are picked up by the next analysis
+    isVideoExtModeEnabled();
+}
+
 void DisplayAnalyzer::enterVideoExtMode()
 {
     if (mVideoExtModeActive) {
@@ -18,6 +18,7 @@
 
 #include <utils/threads.h>
 #include <utils/Vector.h>
+#include <Dump.h>
 
 
 namespace android {
@@ -25,6 +26,16 @@ namespace intel {
 
 
 class DisplayAnalyzer {
+public:
+    // analysis results read by a device prepared on another thread,
+    // copied on the prepare thread once analyzeContents is done
+    struct State {
+        bool overlayAllowed;
+        bool ignoreVideoSkipFlag;
+        int videoInstances;
+        int firstVideoSessionID;
+    };
+
 public:
     DisplayAnalyzer();
     virtual ~DisplayAnalyzer();
@@ -45,10 +56,13 @@ public:
     void postVideoEvent(int instances, int instanceID, bool preparing, bool playing);
     void postBlankEvent(bool blank);
     void postIdleEntryEvent();
+    void postExtModeReloadEvent();
+    void getState(State& state);
     bool isPresentationLayer(hwc_layer_1_t &layer);
     bool isProtectedLayer(hwc_layer_1_t &layer);
     bool ignoreVideoSkipFlag();
     int  getFirstVideoInstanceSessionID();
+    void dump(Dump& d);
 
 private:
     enum DisplayEventType {
@@ -61,6 +75,7 @@ private:
         IDLE_ENTRY_EVENT,
         IDLE_EXIT_EVENT,
         VIDEO_CHECK_EVENT,
+        EXTMODE_RELOAD_EVENT,
     };
 
     struct Event {
@@ -79,6 +94,8 @@ private:
     };
     inline void postEvent(Event& e);
     inline bool getEvent(Event& e);
+    void queueEvent(const Event& e);
+    void resetEventQueue();
     void handlePendingEvents();
     void handleHotplugEvent(bool connected);
     void handleBlankEvent(bool blank);
@@ -89,10 +106,13 @@ private:
     void handleIdleEntryEvent(int count);
     void handleIdleExitEvent();
     void handleVideoCheckEvent();
+    void handleExtModeReloadEvent();
 
     void blankSecondaryDevice();
     void handleVideoExtMode();
     void checkVideoExtMode();
+    void detectVideoExtMode();
+    bool isVideoLayerCacheValid();
     void enterVideoExtMode();
     void exitVideoExtMode();
     bool hasProtectedLayer();
@@ -116,6 +136,18 @@ private:
         DELAY_BEFORE_DPMS_OFF = 0,
     };
 
+    enum
+    {
+        // size of event ring, must be power of 2
+        EVENT_QUEUE_SIZE = 64,
+    };
+
+    struct EventSlot {
+        // position of the slot, one ahead of it once the event is written
+        volatile int32_t sequence;
+        Event event;
+    };
+
 private:
     bool mInitialized;
     bool mVideoExtModeEnabled;
@@ -130,11 +162,29 @@ private:
     bool mProtectedVideoSession;
     // map video instance ID to video state
     KeyedVector<int, int> mVideoStateMap;
+    // video extended mode must be detected again on next analysis
+    bool mVideoExtModeDirty;
+    // video layer index on primary device, -1 if there is none
+    int mPrimaryVideoLayer;
+    // secondary device and layer showing the primary video layer
+    int mSecondaryVideoDevice;
+    int mSecondaryVideoLayer;
     int mCachedNumDisplays;
     hwc_display_contents_1_t** mCachedDisplays;
+    // bounded ring written by any thread without locking, drained only
+    // by the prepare thread
+    EventSlot mEventQueue[EVENT_QUEUE_SIZE];
+    volatile int32_t mEventQueueHead;
+    // guards the consumer side below, drained by the prepare thread and
+    // read by dump
+    Mutex mEventLock;
+    int32_t mEventQueueTail;
+    // events drained from ring
     Vector<Event> mPendingEvents;
-    Mutex mEventMutex;
-    Condition mEventHandledCondition;
+    volatile int32_t mPostedEvents;
+    volatile int32_t mDroppedEvents;
+    int mCoalescedEvents;
+    int mMaxEventQueueDepth;
 };
 
 } // namespace intel
@@ -31,13 +31,23 @@ HwcLayerList::HwcLayerList(hwc_display_contents_1_t *list, int disp)
       mLayers(),
       mFBLayers(),
       mStaticLayersIndex(),
+      mFallbackReasons(),
+      mZOrderRejected(false),
+      mWorkaroundRejected(false),
       mSpriteCandidates(),
       mOverlayCandidates(),
       mZOrderConfig(),
       mFrameBufferTarget(NULL),
       mDisplayIndex(disp),
-      mLayerSize(0)
+      mLayerSize(0),
+      mPlaneBindings()
 {
+    memset(mBoundPlanes, 0, sizeof(mBoundPlanes));
+    mBoundLayers = 0;
+    mCapabilityCacheCount = 0;
+    mCapabilityCacheNext = 0;
+    mCapabilityHits = 0;
+    mCapabilityMisses = 0;
     initialize();
 }
 
@@ -46,11 +56,22 @@ HwcLayerList::~HwcLayerList()
     deinitialize();
 }
 
-bool HwcLayerList::checkSupported(int planeType, HwcLayer *hwcLayer)
+bool HwcLayerList::checkSupported(int planeType, HwcLayer *hwcLayer, int& reason)
 {
-    bool valid = false;
+    // composition statistics reason of each PlaneCapabilities::REJECT_*
+    static const int rejectReasons[PlaneCapabilities::REJECT_REASON_COUNT] = {
+        CompositionStats::REASON_COUNT,
+        CompositionStats::REASON_TRANSFORM,
+        CompositionStats::REASON_FORMAT,
+        CompositionStats::REASON_SIZE,
+        CompositionStats::REASON_BLENDING,
+        CompositionStats::REASON_SCALING,
+        CompositionStats::REASON_ALIGNMENT,
+    };
     hwc_layer_1_t& layer = *(hwcLayer->getLayer());
 
+    reason = CompositionStats::REASON_FORCED_FB;
+
     // if layer was forced to use FB
     if (hwcLayer->getType() == HwcLayer::LAYER_FORCE_FB) {
         VTRACE("layer was forced to use HWC_FRAMEBUFFER");
@@ -74,43 +95,77 @@ bool HwcLayerList::checkSupported(int planeType, HwcLayer *hwcLayer)
         return false;
     }
 
-    // check layer transform
-    valid = PlaneCapabilities::isTransformSupported(planeType, hwcLayer);
-    if (!valid) {
-        VTRACE("plane type %d: (bad transform)", planeType);
+    int reject = checkCapabilities(planeType, hwcLayer);
+    if (reject != PlaneCapabilities::REJECT_NONE) {
+        VTRACE("plane type %d: rejected, reason %d", planeType, reject);
+        reason = rejectReasons[reject];
         return false;
     }
 
-    // check buffer format
-    valid = PlaneCapabilities::isFormatSupported(planeType, hwcLayer);
-    if (!valid) {
-        VTRACE("plane type %d: (bad buffer format)", planeType);
-        return false;
-    }
-
-    // check buffer size
-    valid = PlaneCapabilities::isSizeSupported(planeType, hwcLayer);
-    if (!valid) {
-        VTRACE("plane type %d: (bad buffer size)", planeType);
-        return false;
-    }
+    // TODO: check visible region?
+    return true;
+}
 
-    // check layer blending
-    valid = PlaneCapabilities::isBlendingSupported(planeType, hwcLayer);
-    if (!valid) {
-        VTRACE("plane type %d: (bad blending)", planeType);
-        return false;
+int HwcLayerList::checkCapabilities(int planeType, HwcLayer *hwcLayer)
+{
+    hwc_layer_1_t& layer = *(hwcLayer->getLayer());
+    CapabilityKey key;
+
+    // zero padding so that keys can be compared bytewise
+    memset(&key, 0, sizeof(key));
+    key.planeType = planeType;
+    key.format = hwcLayer->getFormat();
+    key.transform = layer.transform;
+    key.blending = layer.blending;
+    key.planeAlpha = layer.planeAlpha;
+    key.isProtected = hwcLayer->isProtected();
+    key.stride = hwcLayer->getBufferStride();
+    key.sourceCrop = layer.sourceCropf;
+    key.dstWidth = layer.displayFrame.right - layer.displayFrame.left;
+    key.dstHeight = layer.displayFrame.bottom - layer.displayFrame.top;
+
+    // FNV-1a
+    uint32_t hash = 2166136261U;
+    const uint8_t *bytes = (const uint8_t *)&key;
+    for (size_t i = 0; i < sizeof(key); i++) {
+        hash = (hash ^ bytes[i]) * 16777619U;
+    }
+
+    for (uint32_t i = 0; i < mCapabilityCacheCount; i++) {
+        const CapabilityEntry& entry = mCapabilityCache[i];
+        if (entry.hash == hash && !memcmp(&entry.key, &key, sizeof(key))) {
+            mCapabilityHits++;
+            return entry.reason;
+        }
     }
-
-    // check layer scaling
-    valid = PlaneCapabilities::isScalingSupported(planeType, hwcLayer);
-    if (!valid) {
-        VTRACE("plane type %d: (bad scaling)", planeType);
-        return false;
+    mCapabilityMisses++;
+
+    int reason = PlaneCapabilities::REJECT_NONE;
+    if (!PlaneCapabilities::isTransformSupported(planeType, hwcLayer)) {
+        reason = PlaneCapabilities::REJECT_TRANSFORM;
+    } else if (!PlaneCapabilities::isFormatSupported(planeType, hwcLayer)) {
+        reason = PlaneCapabilities::REJECT_FORMAT;
+    } else if (!PlaneCapabilities::isSizeSupported(planeType, hwcLayer)) {
+        reason = PlaneCapabilities::REJECT_SIZE;
+    } else if (!PlaneCapabilities::isBlendingSupported(planeType, hwcLayer)) {
+        reason = PlaneCapabilities::REJECT_BLENDING;
+    } else if (!PlaneCapabilities::isScalingSupported(planeType, hwcLayer)) {
+        reason = PlaneCapabilities::REJECT_SCALING;
+    } else if (!PlaneCapabilities::isOffsetSupported(planeType, hwcLayer)) {
+        reason = PlaneCapabilities::REJECT_ALIGNMENT;
+    }
+
+    uint32_t slot;
+    if (mCapabilityCacheCount < CAPABILITY_CACHE_SIZE) {
+        slot = mCapabilityCacheCount++;
+    } else {
+        slot = mCapabilityCacheNext;
+        mCapabilityCacheNext = (mCapabilityCacheNext + 1) % CAPABILITY_CACHE_SIZE;
     }
-
-    // TODO: check visible region?
-    return true;
+    mCapabilityCache[slot].key = key;
+    mCapabilityCache[slot].hash = hash;
+    mCapabilityCache[slot].reason = reason;
+    return reason;
 }
 
 bool HwcLayerList::checkCursorSupported(HwcLayer *hwcLayer)
@@ -214,6 +269,10 @@ bool HwcLayerList::initialize()
     mOverlayCandidates.setCapacity(mLayerCount);
     mCursorCandidates.setCapacity(mLayerCount);
     mZOrderConfig.setCapacity(mLayerCount);
+    mFallbackReasons.clear();
+    mFallbackReasons.insertAt(CompositionStats::REASON_COUNT, 0, mLayerCount);
+    mZOrderRejected = false;
+    mWorkaroundRejected = false;
     Hwcomposer& hwc = Hwcomposer::getInstance();
 
     for (int i = 0; i < mLayerCount; i++) {
@@ -238,19 +297,28 @@ bool HwcLayerList::initialize()
             hwcLayer->setType(HwcLayer::LAYER_FORCE_FB);
             // add layer to FB layer list for zorder check during plane assignment
             mFBLayers.add(hwcLayer);
+            mFallbackReasons.editItemAt(i) = CompositionStats::REASON_FORCED_FB;
         } else  if (layer->compositionType == HWC_FRAMEBUFFER) {
             // by default use GPU composition
             hwcLayer->setType(HwcLayer::LAYER_FB);
             mFBLayers.add(hwcLayer);
+            // a noncandidate layer is blamed on the plane type meant for
+            // its format, overlay for video and sprite for the rest
+            bool video = DisplayQuery::isVideoFormat(hwcLayer->getFormat());
+            int spriteReason, overlayReason;
             if (checkCursorSupported(hwcLayer)) {
                 mCursorCandidates.add(hwcLayer);
-            } else if (checkSupported(DisplayPlane::PLANE_SPRITE, hwcLayer)) {
+            } else if (checkSupported(DisplayPlane::PLANE_SPRITE, hwcLayer, spriteReason)) {
                 mSpriteCandidates.add(hwcLayer);
-            } else if (hwc.getDisplayAnalyzer()->isOverlayAllowed() &&
-                checkSupported(DisplayPlane::PLANE_OVERLAY, hwcLayer)) {
+            } else if (spriteReason == CompositionStats::REASON_FORCED_FB) {
+                mFallbackReasons.editItemAt(i) = spriteReason;
+            } else if (!hwc.getDisplayAnalyzer()->isOverlayAllowed()) {
+                mFallbackReasons.editItemAt(i) =
+                    video ? CompositionStats::REASON_OVERLAY_DISALLOWED : spriteReason;
+            } else if (checkSupported(DisplayPlane::PLANE_OVERLAY, hwcLayer, overlayReason)) {
                 mOverlayCandidates.add(hwcLayer);
             } else {
-                // noncandidate layer
+                mFallbackReasons.editItemAt(i) = video ? overlayReason : spriteReason;
             }
         } else if (layer->compositionType == HWC_SIDEBAND){
             hwcLayer->setType(HwcLayer::LAYER_SIDEBAND);
@@ -273,10 +341,21 @@ bool HwcLayerList::initialize()
     // released if new buffers' flip is skipped).
     if ((mFBLayers.size() == 0) && (mLayers.size() > 1)) {
         VTRACE("no FB layers, skip plane allocation");
+        mPlaneBindings.clear();
         return true;
     }
 
-    allocatePlanes();
+    // keep planes of layers that are unchanged since the previous plan and
+    // only re-solve the rest of the stack, fall back to a full search
+    if (!assignBoundPlanes()) {
+        allocatePlanes();
+    }
+
+    mPlaneBindings.clear();
+    memset(mBoundPlanes, 0, sizeof(mBoundPlanes));
+    mBoundLayers = 0;
+
+    resolveFallbackReasons();
 
     //dump();
     return true;
@@ -306,10 +385,165 @@ void HwcLayerList::deinitialize()
     mSpriteCandidates.clear();
     mCursorCandidates.clear();
     mZOrderConfig.clear();
+    mFallbackReasons.clear();
     mFrameBufferTarget = NULL;
     mLayerCount = 0;
 }
 
+void HwcLayerList::onGeometryChanged()
+{
+    if (mLayerCount == 0) {
+        return;
+    }
+
+    // planes are reclaimed (not disabled) here, so a plane can be handed
+    // back to the same content during re-planning without re-programming
+    savePlaneBindings();
+    deinitialize();
+}
+
+bool HwcLayerList::replan(hwc_display_contents_1_t *list)
+{
+    if (mLayerCount) {
+        deinitialize();
+    }
+
+    mList = list;
+    return initialize();
+}
+
+void HwcLayerList::savePlaneBindings()
+{
+    mPlaneBindings.clear();
+
+    for (int i = 0; i < mLayerCount; i++) {
+        HwcLayer *hwcLayer = mLayers.itemAt(i);
+        DisplayPlane *plane = hwcLayer->getPlane();
+        if (!plane || hwcLayer == mFrameBufferTarget) {
+            continue;
+        }
+
+        PlaneBinding binding;
+        switch (hwcLayer->getType()) {
+        case HwcLayer::LAYER_CURSOR_OVERLAY:
+            binding.candidateType = DisplayPlane::PLANE_CURSOR;
+            break;
+        case HwcLayer::LAYER_OVERLAY:
+            if (plane->getType() == DisplayPlane::PLANE_OVERLAY) {
+                binding.candidateType = DisplayPlane::PLANE_OVERLAY;
+            } else {
+                // sprite candidate, might be placed on primary plane
+                binding.candidateType = DisplayPlane::PLANE_SPRITE;
+            }
+            break;
+        default:
+            continue;
+        }
+
+        binding.handle = hwcLayer->getHandle();
+        binding.format = hwcLayer->getFormat();
+        binding.width = hwcLayer->getBufferWidth();
+        binding.height = hwcLayer->getBufferHeight();
+        binding.transform = hwcLayer->getTransform();
+        binding.plane = plane;
+        mPlaneBindings.push_back(binding);
+    }
+
+    VTRACE("saved %d plane bindings", mPlaneBindings.size());
+}
+
+bool HwcLayerList::matchBinding(const PlaneBinding& binding, HwcLayer *hwcLayer)
+{
+    if (hwcLayer->getTransform() != binding.transform ||
+        hwcLayer->getFormat() != binding.format) {
+        return false;
+    }
+
+    if (hwcLayer->getHandle() == binding.handle) {
+        return true;
+    }
+
+    // video layer gets a new buffer every frame, identify the stream
+    // by its buffer size instead
+    return DisplayQuery::isVideoFormat(hwcLayer->getFormat()) &&
+           hwcLayer->getBufferWidth() == binding.width &&
+           hwcLayer->getBufferHeight() == binding.height;
+}
+
+HwcLayerList::PriorityVector* HwcLayerList::getCandidates(int type)
+{
+    switch (type) {
+    case DisplayPlane::PLANE_CURSOR:
+        return &mCursorCandidates;
+    case DisplayPlane::PLANE_OVERLAY:
+        return &mOverlayCandidates;
+    case DisplayPlane::PLANE_SPRITE:
+        return &mSpriteCandidates;
+    default:
+        return NULL;
+    }
+}
+
+bool HwcLayerList::assignBoundPlanes()
+{
+    if (mPlaneBindings.size() == 0) {
+        return false;
+    }
+
+    // walk new layers and previous bindings both in z order, so the
+    // relative z order of the kept planes is unchanged. A layer keeps its
+    // plane if it shows the same content and is still a candidate of the
+    // same plane type.
+    size_t next = 0;
+    for (int i = 0; i < mLayerCount && next < mPlaneBindings.size(); i++) {
+        HwcLayer *hwcLayer = mLayers.itemAt(i);
+        if (hwcLayer->getType() != HwcLayer::LAYER_FB) {
+            continue;
+        }
+
+        for (size_t j = next; j < mPlaneBindings.size(); j++) {
+            const PlaneBinding& binding = mPlaneBindings.itemAt(j);
+            if (!matchBinding(binding, hwcLayer)) {
+                continue;
+            }
+
+            PriorityVector *candidates = getCandidates(binding.candidateType);
+            if (candidates && candidates->indexOf(hwcLayer) >= 0) {
+                ZOrderLayer *zlayer = addZOrderLayer(binding.candidateType, hwcLayer);
+                zlayer->preferredPlane = binding.plane;
+                candidates->remove(hwcLayer);
+                mBoundPlanes[binding.plane->getType()]++;
+                mBoundLayers++;
+            }
+            next = j + 1;
+            break;
+        }
+    }
+
+    if (mBoundLayers == 0) {
+        return false;
+    }
+
+    // re-solve the changed part of the stack around the kept planes
+    if (allocatePlanes()) {
+        DTRACE("disp %d: %d layers kept their planes", mDisplayIndex, mBoundLayers);
+        return true;
+    }
+
+    VTRACE("previous plane bindings are infeasible, re-planning all layers");
+    while (mZOrderConfig.size()) {
+        ZOrderLayer *zlayer = mZOrderConfig.itemAt(0);
+        PriorityVector *candidates = getCandidates(zlayer->planeType);
+        if (candidates) {
+            candidates->add(zlayer->hwcLayer);
+        }
+        removeZOrderLayer(zlayer);
+    }
+    memset(mBoundPlanes, 0, sizeof(mBoundPlanes));
+    mBoundLayers = 0;
+    return false;
+}
+
 
 bool HwcLayerList::allocatePlanes()
 {
@@ -325,7 +559,9 @@ bool HwcLayerList::assignCursorPlanes()
 
     DisplayPlaneManager *planeManager = Hwcomposer::getInstance().getPlaneManager();
     int planeNumber = planeManager->getFreePlanes(mDisplayIndex, DisplayPlane::PLANE_CURSOR);
-    if (planeNumber == 0) {
+    // exclude planes kept by bound layers
+    planeNumber -= mBoundPlanes[DisplayPlane::PLANE_CURSOR];
+    if (planeNumber <= 0) {
         DTRACE("no cursor plane available. candidates %d", cursorCandidates);
         return assignOverlayPlanes();
     }
@@ -341,7 +577,7 @@ bool HwcLayerList::assignCursorPlanes()
         if (assignCursorPlanes(0, i)) {
             return true;
         }
-        if (mZOrderConfig.size() != 0) {
+        if ((int)mZOrderConfig.size() != mBoundLayers) {
             ETRACE("ZOrder config is not cleaned up!");
         }
     }
@@ -375,7 +611,8 @@ bool HwcLayerList::assignOverlayPlanes()
 
     DisplayPlaneManager *planeManager = Hwcomposer::getInstance().getPlaneManager();
     int planeNumber = planeManager->getFreePlanes(mDisplayIndex, DisplayPlane::PLANE_OVERLAY);
-    if (planeNumber == 0) {
+    planeNumber -= mBoundPlanes[DisplayPlane::PLANE_OVERLAY];
+    if (planeNumber <= 0) {
         DTRACE("no overlay plane available. candidates %d", overlayCandidates);
         return assignSpritePlanes();
     }
@@ -391,7 +628,7 @@ bool HwcLayerList::assignOverlayPlanes()
         if (assignOverlayPlanes(0, i)) {
             return true;
         }
-        if (mZOrderConfig.size() != 0) {
+        if ((int)mZOrderConfig.size() != mBoundLayers) {
             ETRACE("ZOrder config is not cleaned up!");
         }
     }
@@ -427,7 +664,8 @@ bool HwcLayerList::assignSpritePlanes()
     //  number does not include primary plane
     DisplayPlaneManager *planeManager = Hwcomposer::getInstance().getPlaneManager();
     int planeNumber = planeManager->getFreePlanes(mDisplayIndex, DisplayPlane::PLANE_SPRITE);
-    if (planeNumber == 0) {
+    planeNumber -= mBoundPlanes[DisplayPlane::PLANE_SPRITE];
+    if (planeNumber <= 0) {
         VTRACE("no sprite plane available, candidates %d", spriteCandidates);
         return assignPrimaryPlane();
     }
@@ -444,7 +682,7 @@ bool HwcLayerList::assignSpritePlanes()
             return true;
         }
 
-        if (mOverlayCandidates.size() == 0 && mZOrderConfig.size() != 0) {
+        if (mOverlayCandidates.size() == 0 && (int)mZOrderConfig.size() != mBoundLayers) {
             ETRACE("ZOrder config is not cleaned up!");
         }
     }
@@ -538,8 +776,15 @@ bool HwcLayerList::assignPrimaryPlaneHelper(HwcLayer *hwcLayer, int zorder)
 bool HwcLayerList::attachPlanes()
 {
     DisplayPlaneManager *planeManager = Hwcomposer::getInstance().getPlaneManager();
+    mZOrderConfig.workaroundRejected = false;
     if (!planeManager->isValidZOrder(mDisplayIndex, mZOrderConfig)) {
         VTRACE("invalid z order, size of config %d", mZOrderConfig.size());
+        // probes are retried, the reason goes to the layers left on GLES
+        if (mZOrderConfig.workaroundRejected) {
+            mWorkaroundRejected = true;
+        } else {
+            mZOrderRejected = true;
+        }
         return false;
     }
 
@@ -863,6 +1108,7 @@ bool HwcLayerList::update(hwc_display_contents_1_t *list)
     mList = list;
 
     bool ok = true;
+    Vector<int> failedLayers;
     // update all layers, call each layer's update()
     for (int i = 0; i < mLayerCount; i++) {
         HwcLayer *hwcLayer = mLayers.itemAt(i);
@@ -874,6 +1120,7 @@ bool HwcLayerList::update(hwc_display_contents_1_t *list)
         if (!hwcLayer->update(&list->hwLayers[i])) {
             ok = false;
             hwcLayer->setCompositionType(HWC_FORCE_FRAMEBUFFER);
+            failedLayers.push_back(i);
         }
     }
 
@@ -892,6 +1139,14 @@ bool HwcLayerList::update(hwc_display_contents_1_t *list)
         mList = list;
         initialize();
 
+        // forced to GLES by the failed update rather than by the client
+        for (size_t i = 0; i < failedLayers.size(); i++) {
+            if (failedLayers[i] < (int)mFallbackReasons.size()) {
+                mFallbackReasons.editItemAt(failedLayers[i]) =
+                    CompositionStats::REASON_UPDATE_FAILED;
+            }
+        }
+
         // update all layers again after plane re-allocation
         for (int i = 0; i < mLayerCount; i++) {
             HwcLayer *hwcLayer = mLayers.itemAt(i);
@@ -907,6 +1162,7 @@ bool HwcLayerList::update(hwc_display_contents_1_t *list)
     }
 
     setupSmartComposition();
+    recordOutcomes();
     return true;
 }
 
@@ -942,11 +1198,97 @@ bool HwcLayerList::update(hwc_display_contents_1_t *list)
     }
 
     setupSmartComposition();
+    recordOutcomes();
     return true;
 }
 
 #endif
 
+void HwcLayerList::resolveFallbackReasons()
+{
+    for (int i = 0; i < mLayerCount; i++) {
+        HwcLayer *hwcLayer = mLayers.itemAt(i);
+        if (hwcLayer->getType() != HwcLayer::LAYER_FB &&
+            hwcLayer->getType() != HwcLayer::LAYER_FORCE_FB) {
+            continue;
+        }
+
+        int& reason = mFallbackReasons.editItemAt(i);
+        // protected content on GLES is reported as such, whatever kept it
+        // off a plane
+        if (hwcLayer->isProtected()) {
+            reason = CompositionStats::REASON_PROTECTED;
+            continue;
+        }
+
+        // candidates that did not get a plane
+        if (reason == CompositionStats::REASON_COUNT &&
+            (mCursorCandidates.indexOf(hwcLayer) >= 0 ||
+             mSpriteCandidates.indexOf(hwcLayer) >= 0 ||
+             mOverlayCandidates.indexOf(hwcLayer) >= 0)) {
+            if (mWorkaroundRejected) {
+                reason = CompositionStats::REASON_HW_WORKAROUND;
+            } else if (mZOrderRejected) {
+                reason = CompositionStats::REASON_ZORDER;
+            } else {
+                reason = CompositionStats::REASON_NO_PLANE;
+            }
+        }
+    }
+}
+
+void HwcLayerList::recordOutcomes()
+{
+    CompositionStats *stats = Hwcomposer::getInstance().getCompositionStats();
+    if (!stats) {
+        return;
+    }
+
+    uint32_t outcomes[CompositionStats::OUTCOME_COUNT];
+    uint32_t reasons[CompositionStats::REASON_COUNT];
+    memset(outcomes, 0, sizeof(outcomes));
+    memset(reasons, 0, sizeof(reasons));
+
+    for (int i = 0; i < mLayerCount; i++) {
+        HwcLayer *hwcLayer = mLayers.itemAt(i);
+        if (!hwcLayer || hwcLayer == mFrameBufferTarget ||
+            hwcLayer->getType() == HwcLayer::LAYER_SKIPPED ||
+            hwcLayer->getType() == HwcLayer::LAYER_SIDEBAND) {
+            continue;
+        }
+
+        DisplayPlane *plane = hwcLayer->getPlane();
+        int32_t type = hwcLayer->getCompositionType();
+        if (!plane || (type != HWC_OVERLAY && type != HWC_CURSOR_OVERLAY)) {
+            outcomes[CompositionStats::OUTCOME_GLES]++;
+            if (i < (int)mFallbackReasons.size() &&
+                mFallbackReasons[i] != CompositionStats::REASON_COUNT) {
+                reasons[mFallbackReasons[i]]++;
+            }
+            continue;
+        }
+
+        switch (plane->getType()) {
+        case DisplayPlane::PLANE_OVERLAY:
+            outcomes[CompositionStats::OUTCOME_OVERLAY]++;
+            break;
+        case DisplayPlane::PLANE_SPRITE:
+            outcomes[CompositionStats::OUTCOME_SPRITE]++;
+            break;
+        case DisplayPlane::PLANE_PRIMARY:
+            outcomes[CompositionStats::OUTCOME_PRIMARY]++;
+            break;
+        case DisplayPlane::PLANE_CURSOR:
+            outcomes[CompositionStats::OUTCOME_CURSOR]++;
+            break;
+        default:
+            break;
+        }
+    }
+
+    stats->recordFrame(mDisplayIndex, outcomes, reasons);
+}
+
 DisplayPlane* HwcLayerList::getPlane(uint32_t index) const
 {
     HwcLayer *hwcLayer;
@@ -1041,6 +1383,9 @@ void HwcLayerList::dump(Dump& d)
                      i, type, planeType, planeIndex, zorder);
         }
     }
+
+    d.append("Plane capability checks: hits %d, misses %d\n",
+             mCapabilityHits, mCapabilityMisses);
 }
 
 
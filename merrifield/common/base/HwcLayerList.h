@@ -23,6 +23,7 @@
 #include <DisplayPlane.h>
 #include <DisplayPlaneManager.h>
 #include <HwcLayer.h>
+#include <PlaneCapabilities.h>
 
 namespace android {
 namespace intel {
@@ -40,13 +41,19 @@ public:
     virtual bool update(hwc_display_contents_1_t *list);
     virtual DisplayPlane* getPlane(uint32_t index) const;
 
+    // geometry change handling: release planes but remember which layer
+    // was bound to which plane, then re-plan against the new layer list.
+    void onGeometryChanged();
+    bool replan(hwc_display_contents_1_t *list);
+
     void postFlip();
 
     // dump interface
     virtual void dump(Dump& d);
 
 private:
-    bool checkSupported(int planeType, HwcLayer *hwcLayer);
+    bool checkSupported(int planeType, HwcLayer *hwcLayer, int& reason);
+    int checkCapabilities(int planeType, HwcLayer *hwcLayer);
     bool checkCursorSupported(HwcLayer *hwcLayer);
     bool allocatePlanes();
     bool assignCursorPlanes();
@@ -66,6 +73,10 @@ private:
     void removeZOrderLayer(ZOrderLayer *layer);
     void setupSmartComposition();
     bool setupSmartComposition2();
+    void savePlaneBindings();
+    bool assignBoundPlanes();
+    void resolveFallbackReasons();
+    void recordOutcomes();
     void dump();
 
 private:
@@ -96,6 +107,12 @@ private:
     HwcLayerVector mLayers;
     HwcLayerVector mFBLayers;
     Vector<int> mStaticLayersIndex;
+    // CompositionStats::REASON_* of each layer left to GLES, by layer
+    // index, REASON_COUNT if there is none
+    Vector<int> mFallbackReasons;
+    // a z order probe was rejected during plane allocation
+    bool mZOrderRejected;
+    bool mWorkaroundRejected;
     PriorityVector mSpriteCandidates;
     PriorityVector mOverlayCandidates;
     PriorityVector mCursorCandidates;
@@ -103,6 +120,53 @@ private:
     HwcLayer *mFrameBufferTarget;
     int mDisplayIndex;
     int mLayerSize;
+
+    // plane binding of a layer in the previous plan
+    struct PlaneBinding {
+        buffer_handle_t handle;
+        uint32_t format;
+        uint32_t width;
+        uint32_t height;
+        uint32_t transform;
+        int candidateType;
+        DisplayPlane *plane;
+    };
+    Vector<PlaneBinding> mPlaneBindings;
+    // number of planes per type kept by layers bound from previous plan
+    int mBoundPlanes[DisplayPlane::PLANE_MAX];
+    int mBoundLayers;
+
+    bool matchBinding(const PlaneBinding& binding, HwcLayer *hwcLayer);
+    PriorityVector* getCandidates(int type);
+
+    // memoized PlaneCapabilities verdicts, kept across re-plans. The key
+    // holds every layer property the capability checks read
+    struct CapabilityKey {
+        int planeType;
+        uint32_t format;
+        uint32_t transform;
+        uint32_t blending;
+        uint32_t planeAlpha;
+        uint32_t isProtected;
+        stride_t stride;
+        hwc_frect_t sourceCrop;
+        int dstWidth;
+        int dstHeight;
+    };
+    struct CapabilityEntry {
+        CapabilityKey key;
+        uint32_t hash;
+        int reason;
+    };
+    enum {
+        CAPABILITY_CACHE_SIZE = 32,
+    };
+    CapabilityEntry mCapabilityCache[CAPABILITY_CACHE_SIZE];
+    uint32_t mCapabilityCacheCount;
+    // next entry to replace once the cache is full
+    uint32_t mCapabilityCacheNext;
+    uint32_t mCapabilityHits;
+    uint32_t mCapabilityMisses;
 };
 
 } // namespace intel
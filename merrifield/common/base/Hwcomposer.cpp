@@ -29,12 +29,19 @@ Hwcomposer::Hwcomposer(IPlatFactory *factory)
       mPlatFactory(factory),
       mVsyncManager(0),
       mDisplayAnalyzer(0),
+      mCompositionStats(0),
       mMultiDisplayObserver(0),
       mUeventObserver(0),
       mPlaneManager(0),
       mBufferManager(0),
       mDisplayContext(0),
-      mInitialized(false)
+      mCursorCoalescer(0),
+      mInitialized(false),
+      mPrepareDevice(0),
+      mPrepareDisplay(0),
+      mPreparePending(false),
+      mPrepareResult(true),
+      mPrepareExit(false)
 {
     CTRACE();
 
@@ -67,6 +74,7 @@ bool Hwcomposer::prepare(size_t numDisplays,
     }
 
     mDisplayAnalyzer->analyzeContents(numDisplays, displays);
+    mDisplayAnalyzer->getState(mAnalyzerState);
 
     // disable reclaimed planes
     mPlaneManager->disableReclaimedPlanes();
@@ -85,6 +93,11 @@ bool Hwcomposer::prepare(size_t numDisplays,
         device->prePrepare(displays[i]);
     }
 
+    // physical devices share the plane manager and are prepared in turn on
+    // this thread. virtual device does not use display planes and reads
+    // the analyzer state copied above instead of the analyzer, so it is
+    // prepared on the worker thread at the same time.
+    bool pending = false;
     for (size_t i = 0; i < numDisplays; i++) {
         IDisplayDevice *device = mDisplayDevices.itemAt(i);
         if (!device) {
@@ -92,6 +105,13 @@ bool Hwcomposer::prepare(size_t numDisplays,
             continue;
         }
 
+        if (mThread != NULL && displays[i] &&
+            device->getType() == IDisplayDevice::DEVICE_VIRTUAL) {
+            queuePrepare(device, displays[i]);
+            pending = true;
+            continue;
+        }
+
         ret = device->prepare(displays[i]);
         if (ret == false) {
             ETRACE("failed to do prepare for device %d", i);
@@ -99,9 +119,63 @@ bool Hwcomposer::prepare(size_t numDisplays,
         }
     }
 
+    // all displays must be prepared before returning to SurfaceFlinger
+    if (pending && !waitPrepare()) {
+        ETRACE("failed to do prepare for virtual device");
+        ret = false;
+    }
+
     return ret;
 }
 
+void Hwcomposer::queuePrepare(IDisplayDevice *device,
+                              hwc_display_contents_1_t *display)
+{
+    Mutex::Autolock _l(mPrepareLock);
+    mPrepareDevice = device;
+    mPrepareDisplay = display;
+    mPreparePending = true;
+    mPrepareCond.broadcast();
+}
+
+bool Hwcomposer::waitPrepare()
+{
+    Mutex::Autolock _l(mPrepareLock);
+    while (mPreparePending) {
+        mPrepareCond.wait(mPrepareLock);
+    }
+    return mPrepareResult;
+}
+
+bool Hwcomposer::threadLoop()
+{
+    IDisplayDevice *device;
+    hwc_display_contents_1_t *display;
+    {
+        Mutex::Autolock _l(mPrepareLock);
+        while (!mPrepareDevice && !mPrepareExit) {
+            mPrepareCond.wait(mPrepareLock);
+        }
+        if (mPrepareExit) {
+            return false;
+        }
+        device = mPrepareDevice;
+        display = mPrepareDisplay;
+    }
+
+    bool ret = device->prepare(display);
+
+    {
+        Mutex::Autolock _l(mPrepareLock);
+        mPrepareDevice = NULL;
+        mPrepareDisplay = NULL;
+        mPrepareResult = ret;
+        mPreparePending = false;
+        mPrepareCond.broadcast();
+    }
+    return true;
+}
+
 bool Hwcomposer::commit(size_t numDisplays,
                          hwc_display_contents_1_t **displays)
 {
@@ -212,7 +286,7 @@ bool Hwcomposer::setCursorPositionAsync(int disp, int x, int y)
         return false;
     }
 
-    return mDisplayContext->setCursorPosition(disp, x, y);
+    return mCursorCoalescer->setPosition(disp, x, y);
 }
 
 bool Hwcomposer::vsyncControl(int disp, int enabled)
@@ -327,6 +401,8 @@ void Hwcomposer::vsync(int disp, int64_t timestamp)
         // Display will freeze if vsync is from external display.
         mProcs->vsync(const_cast<hwc_procs_t*>(mProcs), IDisplayDevice::DEVICE_PRIMARY, timestamp);
     }
+
+    mCursorCoalescer->onVsync(disp, timestamp);
 }
 
 void Hwcomposer::hotplug(int disp, bool connected)
@@ -382,6 +458,18 @@ bool Hwcomposer::dump(char *buff, int buff_len, int *cur_len)
     if (mPlaneManager)
         mPlaneManager->dump(d);
 
+    // dump display analyzer status
+    if (mDisplayAnalyzer)
+        mDisplayAnalyzer->dump(d);
+
+    // dump composition statistics
+    if (mCompositionStats)
+        mCompositionStats->dump(d);
+
+    // dump cursor update status
+    if (mCursorCoalescer)
+        mCursorCoalescer->dump(d);
+
     // dump buffer manager status
     if (mBufferManager)
         mBufferManager->dump(d);
@@ -430,6 +518,11 @@ bool Hwcomposer::initialize()
         DEINIT_AND_RETURN_FALSE("failed to create display context");
     }
 
+    mCursorCoalescer = new CursorCoalescer(*mDisplayContext);
+    if (!mCursorCoalescer || !mCursorCoalescer->initialize()) {
+        DEINIT_AND_RETURN_FALSE("failed to initialize cursor coalescer");
+    }
+
     mUeventObserver = new UeventObserver();
     if (!mUeventObserver || !mUeventObserver->initialize()) {
         DEINIT_AND_RETURN_FALSE("failed to initialize uevent observer");
@@ -458,11 +551,25 @@ bool Hwcomposer::initialize()
         DEINIT_AND_RETURN_FALSE("failed to initialize display analyzer");
     }
 
+    mCompositionStats = new CompositionStats();
+    if (!mCompositionStats) {
+        DEINIT_AND_RETURN_FALSE("failed to create composition statistics");
+    }
+
     mMultiDisplayObserver = new MultiDisplayObserver();
     if (!mMultiDisplayObserver || !mMultiDisplayObserver->initialize()) {
         DEINIT_AND_RETURN_FALSE("failed to initialize display observer");
     }
 
+    mPrepareExit = false;
+    mThread = new PrepareThread(this);
+    if (!mThread.get() ||
+        mThread->run("HwcPrepare", PRIORITY_URGENT_DISPLAY) != NO_ERROR) {
+        // virtual device will be prepared on the caller thread
+        WTRACE("failed to start prepare thread");
+        mThread = NULL;
+    }
+
     // all initialized, starting uevent observer
     mUeventObserver->start();
 
@@ -472,8 +579,22 @@ bool Hwcomposer::initialize()
 
 void Hwcomposer::deinitialize()
 {
+    if (mThread.get()) {
+        {
+            Mutex::Autolock _l(mPrepareLock);
+            mPrepareExit = true;
+            mPrepareCond.broadcast();
+        }
+        mThread->requestExitAndWait();
+        mThread = NULL;
+    }
+
     DEINIT_AND_DELETE_OBJ(mMultiDisplayObserver);
     DEINIT_AND_DELETE_OBJ(mDisplayAnalyzer);
+    if (mCompositionStats) {
+        delete mCompositionStats;
+        mCompositionStats = 0;
+    }
     // delete mVsyncManager first as it holds reference to display devices.
     DEINIT_AND_DELETE_OBJ(mVsyncManager);
 
@@ -490,6 +611,7 @@ void Hwcomposer::deinitialize()
         mPlatFactory = 0;
     }
 
+    DEINIT_AND_DELETE_OBJ(mCursorCoalescer);
     DEINIT_AND_DELETE_OBJ(mDisplayContext);
     DEINIT_AND_DELETE_OBJ(mPlaneManager);
     DEINIT_AND_DELETE_OBJ(mBufferManager);
@@ -522,6 +644,11 @@ DisplayAnalyzer* Hwcomposer::getDisplayAnalyzer()
     return mDisplayAnalyzer;
 }
 
+CompositionStats* Hwcomposer::getCompositionStats()
+{
+    return mCompositionStats;
+}
+
 MultiDisplayObserver* Hwcomposer::getMultiDisplayObserver()
 {
     return mMultiDisplayObserver;
@@ -0,0 +1,125 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <SoftComposeKernels.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace android {
+namespace intel {
+
+enum {
+    LUMA_R = 66,
+    LUMA_G = 129,
+    LUMA_B = 25,
+};
+
+// x / 255 for x up to 255 * 255, exact for multiples of 255
+static inline uint32_t div255(uint32_t x)
+{
+    return (x + 1 + (x >> 8)) >> 8;
+}
+
+static inline uint8_t clamp255(int x)
+{
+    return x < 0 ? 0 : (x > 255 ? 255 : x);
+}
+
+void SoftComposeKernels::blendLumaRow(uint8_t *luma, const uint8_t *rgb, uint32_t width, bool bgra)
+{
+    uint32_t x = 0;
+
+#ifdef __SSE2__
+    // eight pixels per step in 16 bit lanes, every intermediate stays
+    // below 65536 so the results match the scalar loop exactly
+    const __m128i mask = _mm_set1_epi32(0xff);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi16(1);
+    const __m128i round = _mm_set1_epi16(128);
+    const __m128i opaque = _mm_set1_epi16(255);
+    const __m128i c0 = _mm_set1_epi16(bgra ? LUMA_B : LUMA_R);
+    const __m128i c1 = _mm_set1_epi16(LUMA_G);
+    const __m128i c2 = _mm_set1_epi16(bgra ? LUMA_R : LUMA_B);
+    for (; x + 8 <= width; x += 8) {
+        __m128i p0 = _mm_loadu_si128((const __m128i *)(rgb + x * 4));
+        __m128i p1 = _mm_loadu_si128((const __m128i *)(rgb + x * 4 + 16));
+        __m128i v0 = _mm_packs_epi32(_mm_and_si128(p0, mask),
+                                     _mm_and_si128(p1, mask));
+        __m128i v1 = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 8), mask),
+                                     _mm_and_si128(_mm_srli_epi32(p1, 8), mask));
+        __m128i v2 = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 16), mask),
+                                     _mm_and_si128(_mm_srli_epi32(p1, 16), mask));
+        __m128i a = _mm_packs_epi32(_mm_srli_epi32(p0, 24), _mm_srli_epi32(p1, 24));
+
+        __m128i fg = _mm_add_epi16(_mm_mullo_epi16(v0, c0), _mm_mullo_epi16(v1, c1));
+        fg = _mm_add_epi16(fg, _mm_add_epi16(_mm_mullo_epi16(v2, c2), round));
+        fg = _mm_srli_epi16(fg, 8);
+
+        __m128i bg = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(luma + x)), zero);
+        bg = _mm_add_epi16(_mm_slli_epi16(a, 4),
+                           _mm_mullo_epi16(_mm_sub_epi16(opaque, a), bg));
+        bg = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(bg, one), _mm_srli_epi16(bg, 8)), 8);
+
+        __m128i y = _mm_add_epi16(fg, bg);
+        _mm_storel_epi64((__m128i *)(luma + x), _mm_packus_epi16(y, y));
+    }
+#endif
+
+    blendLumaRowScalar(luma + x, rgb + x * 4, width - x, bgra);
+}
+
+void SoftComposeKernels::blendLumaRowScalar(uint8_t *luma, const uint8_t *rgb, uint32_t width,
+                                            bool bgra)
+{
+    const uint32_t k0 = bgra ? LUMA_B : LUMA_R;
+    const uint32_t k2 = bgra ? LUMA_R : LUMA_B;
+    for (uint32_t x = 0; x < width; x++) {
+        const uint8_t *p = rgb + x * 4;
+        uint32_t a = p[3];
+        uint32_t fg = (k0 * p[0] + LUMA_G * p[1] + k2 * p[2] + 128) >> 8;
+        uint32_t bg = div255(LUMA_BLACK * a + (255 - a) * luma[x]);
+        luma[x] = clamp255(fg + bg);
+    }
+}
+
+void SoftComposeKernels::blendChromaRow(uint8_t *chroma, const uint8_t *rgb0,
+                                        const uint8_t *rgb1, uint32_t width, bool bgra)
+{
+    uint32_t chromaWidth = (width + 1) / 2;
+    for (uint32_t cx = 0; cx < chromaWidth; cx++) {
+        uint32_t left = cx * 2 * 4;
+        uint32_t right = (cx * 2 + 1 < width ? cx * 2 + 1 : cx * 2) * 4;
+        int c[4];
+        for (int i = 0; i < 4; i++) {
+            c[i] = (rgb0[left + i] + rgb0[right + i] +
+                    rgb1[left + i] + rgb1[right + i] + 2) >> 2;
+        }
+        int r = bgra ? c[2] : c[0];
+        int g = c[1];
+        int b = bgra ? c[0] : c[2];
+        uint32_t a = c[3];
+
+        // biased by 128 << 8 so that only positive values are shifted
+        int u = (-38 * r - 74 * g + 112 * b + 128 + (CHROMA_ZERO << 8)) >> 8;
+        int v = (112 * r - 94 * g - 18 * b + 128 + (CHROMA_ZERO << 8)) >> 8;
+        uint8_t *p = chroma + cx * 2;
+        p[0] = clamp255(u - CHROMA_ZERO + div255(CHROMA_ZERO * a + (255 - a) * p[0]));
+        p[1] = clamp255(v - CHROMA_ZERO + div255(CHROMA_ZERO * a + (255 - a) * p[1]));
+    }
+}
+
+} // namespace intel
+} // namespace android
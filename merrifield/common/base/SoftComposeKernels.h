@@ -0,0 +1,49 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef SOFT_COMPOSE_KERNELS_H
+#define SOFT_COMPOSE_KERNELS_H
+
+#include <stdint.h>
+
+namespace android {
+namespace intel {
+
+// Row kernels of SoftCompositor. They depend on nothing but the C library
+// so they can be checked on the host. RGB rows hold premultiplied 32 bit
+// pixels in RGBA or BGRA byte order, output rows are NV12.
+class SoftComposeKernels {
+public:
+    // BT.601 limited range, the same conversion VSP applies to the RGB layer
+    enum {
+        LUMA_BLACK = 16,
+        CHROMA_ZERO = 128,
+    };
+
+    // blends a row of RGB pixels over a row of luma, with SSE2 when the
+    // build has it
+    static void blendLumaRow(uint8_t *luma, const uint8_t *rgb, uint32_t width, bool bgra);
+    // blendLumaRow without SIMD, the SSE2 path matches it exactly
+    static void blendLumaRowScalar(uint8_t *luma, const uint8_t *rgb, uint32_t width, bool bgra);
+    // blends two rows of RGB pixels over a row of CbCr, each chroma sample
+    // covers the average of a 2x2 block
+    static void blendChromaRow(uint8_t *chroma, const uint8_t *rgb0, const uint8_t *rgb1,
+                               uint32_t width, bool bgra);
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* SOFT_COMPOSE_KERNELS_H */
@@ -0,0 +1,287 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <HwcTrace.h>
+#include <SoftCompositor.h>
+#include <SoftComposeKernels.h>
+
+namespace android {
+namespace intel {
+
+enum {
+    LUMA_BLACK = SoftComposeKernels::LUMA_BLACK,
+    CHROMA_ZERO = SoftComposeKernels::CHROMA_ZERO,
+};
+
+// nearest neighbour step from dstCount to srcCount samples, 16.16 fixed
+// point, sample i is taken at (i * step + step / 2) >> 16
+static inline uint32_t sampleStep(uint32_t srcCount, uint32_t dstCount)
+{
+    return (srcCount << 16) / dstCount;
+}
+
+SoftCompositor::SoftCompositor()
+    : mExitThreads(false),
+      mInitialized(false),
+      mHasVideo(false),
+      mHasRgb(false),
+      mBandRows(0),
+      mBandCount(0),
+      mNextBand(0),
+      mFinishedBands(0),
+      mFrames(0),
+      mLastTime(0),
+      mMaxTime(0),
+      mTotalTime(0)
+{
+    memset(&mVideo, 0, sizeof(mVideo));
+    memset(&mRgb, 0, sizeof(mRgb));
+    memset(&mOut, 0, sizeof(mOut));
+    memset(&mSrc, 0, sizeof(mSrc));
+    memset(&mDst, 0, sizeof(mDst));
+}
+
+SoftCompositor::~SoftCompositor()
+{
+    WARN_IF_NOT_DEINIT();
+}
+
+bool SoftCompositor::initialize(uint32_t threads)
+{
+    if (mInitialized)
+        return true;
+
+    mExitThreads = false;
+    for (uint32_t i = 1; i < threads; i++) {
+        sp<Worker> worker = new Worker(this);
+        // bulk pixel work, kept below the threads serving vsync and
+        // composition so a slow frame can't starve the primary display
+        if (worker->run("SoftCompose", PRIORITY_DISPLAY) != NO_ERROR) {
+            WTRACE("failed to start worker %u", i);
+            break;
+        }
+        mWorkers.push_back(worker);
+    }
+    ITRACE("composing on %u threads", (uint32_t)mWorkers.size() + 1);
+    mInitialized = true;
+    return true;
+}
+
+void SoftCompositor::deinitialize()
+{
+    {
+        Mutex::Autolock _l(mLock);
+        mExitThreads = true;
+        mBandsReady.broadcast();
+    }
+    for (size_t i = 0; i < mWorkers.size(); i++)
+        mWorkers[i]->requestExitAndWait();
+    mWorkers.clear();
+    mInitialized = false;
+}
+
+void SoftCompositor::compose(const Image *video, const crop_t& src, const crop_t& dst,
+                             const Image *rgb, const Image& out)
+{
+    if (out.format != FORMAT_NV12 || out.luma == NULL || out.chroma == NULL ||
+        out.width == 0 || out.height == 0) {
+        ETRACE("invalid output %ux%u, format %u", out.width, out.height, out.format);
+        return;
+    }
+
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    Mutex::Autolock _l(mLock);
+
+    mOut = out;
+    mHasVideo = false;
+    if (video != NULL) {
+        if (video->format != FORMAT_NV12 ||
+            src.x < 0 || src.y < 0 || src.w <= 0 || src.h <= 0 ||
+            src.x + src.w > static_cast<int>(video->width) ||
+            src.y + src.h > static_cast<int>(video->height) ||
+            dst.x < 0 || dst.y < 0 || dst.w <= 0 || dst.h <= 0 ||
+            dst.x + dst.w > static_cast<int>(out.width) ||
+            dst.y + dst.h > static_cast<int>(out.height)) {
+            WTRACE("invalid video region (%d,%d) %dx%d of %ux%u to (%d,%d) %dx%d",
+                   src.x, src.y, src.w, src.h, video->width, video->height,
+                   dst.x, dst.y, dst.w, dst.h);
+        } else {
+            mVideo = *video;
+            mSrc = src;
+            mDst = dst;
+            mHasVideo = true;
+        }
+    }
+
+    mHasRgb = false;
+    if (rgb != NULL) {
+        if ((rgb->format != FORMAT_RGBA && rgb->format != FORMAT_BGRA) ||
+            rgb->width < out.width || rgb->height < out.height) {
+            WTRACE("invalid RGB layer %ux%u, format %u", rgb->width, rgb->height, rgb->format);
+        } else {
+            mRgb = *rgb;
+            mHasRgb = true;
+        }
+    }
+
+    // bands start on even rows, so each one owns the chroma rows it covers
+    uint32_t bands = out.height / BAND_MIN_ROWS;
+    if (bands > mWorkers.size() + 1)
+        bands = mWorkers.size() + 1;
+    if (bands == 0)
+        bands = 1;
+    mBandRows = align_to((out.height + bands - 1) / bands, 2);
+    mBandCount = (out.height + mBandRows - 1) / mBandRows;
+    mNextBand = 0;
+    mFinishedBands = 0;
+    mBandsReady.broadcast();
+    runBands();
+    while (mFinishedBands < mBandCount)
+        mBandsDone.wait(mLock);
+
+    nsecs_t elapsed = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+    mFrames++;
+    mLastTime = elapsed;
+    mTotalTime += elapsed;
+    if (elapsed > mMaxTime)
+        mMaxTime = elapsed;
+}
+
+// called with mLock held, returns once every band has been started
+void SoftCompositor::runBands()
+{
+    while (mNextBand < mBandCount) {
+        uint32_t top = mNextBand++ * mBandRows;
+        uint32_t bottom = top + mBandRows < mOut.height ? top + mBandRows : mOut.height;
+        mLock.unlock();
+        composeRows(top, bottom);
+        mLock.lock();
+        if (++mFinishedBands == mBandCount)
+            mBandsDone.signal();
+    }
+}
+
+bool SoftCompositor::threadLoop()
+{
+    Mutex::Autolock _l(mLock);
+    while (!mExitThreads && mNextBand >= mBandCount)
+        mBandsReady.wait(mLock);
+    if (mExitThreads)
+        return false;
+    runBands();
+    return true;
+}
+
+void SoftCompositor::composeRows(uint32_t top, uint32_t bottom)
+{
+    bool bgra = mRgb.format == FORMAT_BGRA;
+    for (uint32_t y = top; y < bottom; y++) {
+        uint8_t *luma = mOut.luma + y * mOut.stride;
+        fillLuma(y, luma);
+        if (mHasRgb)
+            SoftComposeKernels::blendLumaRow(luma, mRgb.luma + y * mRgb.stride,
+                                             mOut.width, bgra);
+
+        if (y & 1)
+            continue;
+        uint8_t *chroma = mOut.chroma + (y / 2) * mOut.stride;
+        fillChroma(y / 2, chroma);
+        if (mHasRgb) {
+            uint32_t next = y + 1 < mOut.height ? y + 1 : y;
+            SoftComposeKernels::blendChromaRow(chroma, mRgb.luma + y * mRgb.stride,
+                                               mRgb.luma + next * mRgb.stride,
+                                               mOut.width, bgra);
+        }
+    }
+}
+
+void SoftCompositor::fillLuma(uint32_t y, uint8_t *row)
+{
+    uint32_t top = mDst.y;
+    uint32_t bottom = mDst.y + mDst.h;
+    if (!mHasVideo || y < top || y >= bottom) {
+        memset(row, LUMA_BLACK, mOut.width);
+        return;
+    }
+
+    uint32_t left = mDst.x;
+    uint32_t right = mDst.x + mDst.w;
+    memset(row, LUMA_BLACK, left);
+    memset(row + right, LUMA_BLACK, mOut.width - right);
+
+    uint32_t stepY = sampleStep(mSrc.h, mDst.h);
+    uint32_t sy = mSrc.y + (((uint64_t)(y - top) * stepY + stepY / 2) >> 16);
+    const uint8_t *src = mVideo.luma + sy * mVideo.stride + mSrc.x;
+    if (mSrc.w == mDst.w) {
+        memcpy(row + left, src, mDst.w);
+        return;
+    }
+    uint32_t step = sampleStep(mSrc.w, mDst.w);
+    uint32_t pos = step / 2;
+    for (uint32_t x = left; x < right; x++) {
+        row[x] = src[pos >> 16];
+        pos += step;
+    }
+}
+
+void SoftCompositor::fillChroma(uint32_t y, uint8_t *row)
+{
+    // chroma regions cover every chroma sample touched by the luma ones
+    uint32_t top = mDst.y / 2;
+    uint32_t bottom = (mDst.y + mDst.h + 1) / 2;
+    uint32_t width = (mOut.width + 1) / 2;
+    if (!mHasVideo || y < top || y >= bottom) {
+        memset(row, CHROMA_ZERO, width * 2);
+        return;
+    }
+
+    uint32_t left = mDst.x / 2;
+    uint32_t right = (mDst.x + mDst.w + 1) / 2;
+    memset(row, CHROMA_ZERO, left * 2);
+    memset(row + right * 2, CHROMA_ZERO, (width - right) * 2);
+
+    uint32_t srcX = mSrc.x / 2;
+    uint32_t srcY = mSrc.y / 2;
+    uint32_t srcWidth = (mSrc.x + mSrc.w + 1) / 2 - srcX;
+    uint32_t srcHeight = (mSrc.y + mSrc.h + 1) / 2 - srcY;
+    uint32_t stepY = sampleStep(srcHeight, bottom - top);
+    uint32_t sy = srcY + (((uint64_t)(y - top) * stepY + stepY / 2) >> 16);
+    const uint8_t *src = mVideo.chroma + sy * mVideo.stride + srcX * 2;
+    if (srcWidth == right - left) {
+        memcpy(row + left * 2, src, srcWidth * 2);
+        return;
+    }
+    uint32_t step = sampleStep(srcWidth, right - left);
+    uint32_t pos = step / 2;
+    for (uint32_t x = left; x < right; x++) {
+        const uint8_t *p = src + (pos >> 16) * 2;
+        row[x * 2] = p[0];
+        row[x * 2 + 1] = p[1];
+        pos += step;
+    }
+}
+
+void SoftCompositor::dump(Dump& d)
+{
+    Mutex::Autolock _l(mLock);
+    d.append("Soft compositor: %u threads, %u frames, last %lldus, avg %lldus, max %lldus\n",
+             (uint32_t)mWorkers.size() + 1, mFrames,
+             (long long)(mLastTime / 1000),
+             (long long)(mFrames ? mTotalTime / mFrames / 1000 : 0),
+             (long long)(mMaxTime / 1000));
+}
+
+} // namespace intel
+} // namespace android
@@ -0,0 +1,122 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef SOFT_COMPOSITOR_H
+#define SOFT_COMPOSITOR_H
+
+#include <utils/threads.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+#include <DataBuffer.h>
+#include <Dump.h>
+
+namespace android {
+namespace intel {
+
+// CPU fallback for the VSP composition done for virtual displays. NV12
+// video is scaled into the output and a premultiplied RGB layer is
+// blended on top, with row bands of the output spread over a few worker
+// threads. Video is scaled by nearest neighbour sampling, so it only
+// approximates VSP's filtered scaling and looks blockier; it keeps the
+// display going while VSP is unavailable, it is not a match for it.
+class SoftCompositor {
+public:
+    enum {
+        FORMAT_NV12 = 0,
+        FORMAT_RGBA,    // byte order R, G, B, A
+        FORMAT_BGRA,    // byte order B, G, R, A
+    };
+
+    struct Image {
+        // luma plane, or the pixels of an RGB image
+        uint8_t *luma;
+        // interleaved CbCr plane, NV12 only
+        uint8_t *chroma;
+        // bytes per row, shared by both NV12 planes, which need at least
+        // the width rounded up to even
+        uint32_t stride;
+        uint32_t width;
+        uint32_t height;
+        uint32_t format;
+    };
+
+public:
+    SoftCompositor();
+    virtual ~SoftCompositor();
+
+public:
+    // threads includes the caller of compose()
+    bool initialize(uint32_t threads);
+    void deinitialize();
+    // scales the src region of video into the dst region of out and blends
+    // rgb over the whole output. The rest of the output is black, as is the
+    // video when it is NULL; rgb may be NULL as well.
+    void compose(const Image *video, const crop_t& src, const crop_t& dst,
+                 const Image *rgb, const Image& out);
+    void dump(Dump& d);
+
+private:
+    void composeRows(uint32_t top, uint32_t bottom);
+    void fillLuma(uint32_t y, uint8_t *row);
+    void fillChroma(uint32_t y, uint8_t *row);
+    void runBands();
+
+private:
+    enum {
+        // smallest band worth handing to another thread, in rows
+        BAND_MIN_ROWS = 32,
+    };
+
+    class Worker : public Thread {
+    public:
+        Worker(SoftCompositor *owner) : mOwner(owner) {}
+    private:
+        virtual bool threadLoop() { return mOwner->threadLoop(); }
+    private:
+        SoftCompositor *mOwner;
+    };
+    friend class Worker;
+    bool threadLoop();
+
+    Mutex mLock;
+    Condition mBandsReady;
+    Condition mBandsDone;
+    Vector< sp<Worker> > mWorkers;
+    bool mExitThreads;
+    bool mInitialized;
+
+    // current job, fixed while bands are outstanding
+    Image mVideo;
+    Image mRgb;
+    Image mOut;
+    crop_t mSrc;
+    crop_t mDst;
+    bool mHasVideo;
+    bool mHasRgb;
+    uint32_t mBandRows;
+    uint32_t mBandCount;
+    uint32_t mNextBand;
+    uint32_t mFinishedBands;
+
+    uint32_t mFrames;
+    nsecs_t mLastTime;
+    nsecs_t mMaxTime;
+    nsecs_t mTotalTime;
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* SOFT_COMPOSITOR_H */
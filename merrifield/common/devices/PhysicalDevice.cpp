@@ -64,10 +64,10 @@ void PhysicalDevice::onGeometryChanged(hwc_display_contents_1_t *list)
 
     ATRACE("disp = %d, layer number = %d", mType, list->numHwLayers);
 
-    // NOTE: should NOT be here
+    // re-plan the existing list, layers that are unchanged keep their planes
     if (mLayerList) {
-        WTRACE("mLayerList exists");
-        DEINIT_AND_DELETE_OBJ(mLayerList);
+        mLayerList->replan(list);
+        return;
     }
 
     // create a new layer list
@@ -90,9 +90,9 @@ bool PhysicalDevice::prePrepare(hwc_display_contents_1_t *display)
         return true;
     }
 
-    // check if geometry is changed, if changed delete list
+    // check if geometry is changed, if changed release planes of the list
     if ((display->flags & HWC_GEOMETRY_CHANGED) && mLayerList) {
-        DEINIT_AND_DELETE_OBJ(mLayerList);
+        mLayerList->onGeometryChanged();
     }
     return true;
 }
@@ -13,6 +13,7 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 */
+#include <cutils/properties.h>
 #include <HwcTrace.h>
 #include <Drm.h>
 #include <Hwcomposer.h>
@@ -23,9 +24,26 @@ namespace android {
 namespace intel {
 
 PrimaryDevice::PrimaryDevice(Hwcomposer& hwc, DeviceControlFactory* controlFactory)
-    : PhysicalDevice(DEVICE_PRIMARY, hwc, controlFactory)
+    : PhysicalDevice(DEVICE_PRIMARY, hwc, controlFactory),
+      mIdleLock(),
+      mIdleMinDuration(0),
+      mWorkload(0),
+      mLayerCount(0),
+      mIdle(false),
+      mIdleEntryTime(0),
+      mIdleSkipTime(0),
+      mIdleDeferredTime(0),
+      mIdleStartTime(0),
+      mIdleThreadExit(false),
+      mIdleCondition(),
+      mIdleExitTime(0),
+      mIdleEntries(0),
+      mIdleSkips(0),
+      mLastExitLatency(0),
+      mMaxExitLatency(0)
 {
     CTRACE();
+    memset(mIdleHistory, 0, sizeof(mIdleHistory));
 }
 
 PrimaryDevice::~PrimaryDevice()
@@ -49,11 +67,34 @@ bool PrimaryDevice::initialize()
         ETRACE("Uevent observer is NULL");
     }
 
+    char prop[PROPERTY_VALUE_MAX];
+    int minDuration = 500;
+    if (property_get("hwc.idle.min_duration_ms", prop, NULL) > 0) {
+        minDuration = atoi(prop);
+    }
+    mIdleMinDuration = milliseconds(minDuration);
+
+    mIdleThreadExit = false;
+    mThread = new IdleTimerThread(this);
+    if (!mThread.get()) {
+        DEINIT_AND_RETURN_FALSE("failed to create idle timer thread");
+    }
+    mThread->run("IdleTimer", PRIORITY_DISPLAY);
+
     return true;
 }
 
 void PrimaryDevice::deinitialize()
 {
+    if (mThread.get()) {
+        {
+            Mutex::Autolock _l(mIdleLock);
+            mIdleThreadExit = true;
+            mIdleCondition.signal();
+        }
+        mThread->requestExitAndWait();
+        mThread = NULL;
+    }
     PhysicalDevice::deinitialize();
 }
 
@@ -67,11 +108,217 @@ void PrimaryDevice::repeatedFrameEventListener(void *data)
 }
 
 void PrimaryDevice::repeatedFrameListener()
+{
+    if (!shouldEnterIdle(systemTime())) {
+        // keep planes and static layers of a workload that only pauses
+        // briefly, entering idle would recompose all layers twice
+        return;
+    }
+
+    enterIdle();
+}
+
+void PrimaryDevice::enterIdle()
 {
     Hwcomposer::getInstance().getDisplayAnalyzer()->postIdleEntryEvent();
     Hwcomposer::getInstance().invalidate();
 }
 
+bool PrimaryDevice::threadLoop()
+{
+    {
+        Mutex::Autolock _l(mIdleLock);
+        if (mIdleThreadExit) {
+            return false;
+        }
+        if (mIdleDeferredTime == 0) {
+            mIdleCondition.wait(mIdleLock);
+            return true;
+        }
+        nsecs_t now = systemTime();
+        if (now < mIdleDeferredTime) {
+            mIdleCondition.waitRelative(mIdleLock, mIdleDeferredTime - now);
+            return true;
+        }
+
+        // the pause outlasted the learned average, it is a real idle.
+        // It is learned from its start once it ends
+        VTRACE("deferred idle entry after %lld ms", ns2ms(now - mIdleSkipTime));
+        mIdleDeferredTime = 0;
+        mIdleStartTime = mIdleSkipTime;
+        mIdleSkipTime = 0;
+    }
+
+    // the kernel sends no further repeated frame event for this pause
+    enterIdle();
+    return true;
+}
+
+bool PrimaryDevice::shouldEnterIdle(nsecs_t now)
+{
+    Mutex::Autolock _l(mIdleLock);
+
+    if (mIdle || mIdleSkipTime) {
+        return false;
+    }
+
+    for (int i = 0; i < IDLE_HISTORY_SLOTS; i++) {
+        IdleHistory& history = mIdleHistory[i];
+        if (history.samples == 0 || history.workload != mWorkload)
+            continue;
+        if (history.samples >= IDLE_LEARNING_SAMPLES &&
+            history.avgDuration < mIdleMinDuration) {
+            VTRACE("skip idle entry, average idle %lld ms",
+                   ns2ms(history.avgDuration));
+            mIdleSkipTime = now;
+            mIdleSkips++;
+            mIdleDeferredTime = now + mIdleMinDuration;
+            mIdleCondition.signal();
+            return false;
+        }
+        break;
+    }
+    return true;
+}
+
+void PrimaryDevice::learnIdleDuration(nsecs_t duration)
+{
+    // called with mIdleLock held
+    IdleHistory *slot = NULL;
+    for (int i = 0; i < IDLE_HISTORY_SLOTS; i++) {
+        IdleHistory& history = mIdleHistory[i];
+        if (history.samples && history.workload == mWorkload) {
+            slot = &history;
+            break;
+        }
+        // replace the least recently used workload
+        if (!slot || history.lastUsed < slot->lastUsed) {
+            slot = &history;
+        }
+    }
+
+    if (slot->samples == 0 || slot->workload != mWorkload) {
+        slot->workload = mWorkload;
+        slot->layerCount = mLayerCount;
+        slot->samples = 0;
+        slot->avgDuration = duration;
+    } else {
+        // moving average, weight of new sample is 1/4
+        slot->avgDuration += (duration - slot->avgDuration) / 4;
+    }
+    slot->samples++;
+    slot->lastUsed = systemTime();
+}
+
+void PrimaryDevice::onIdleEntry()
+{
+    Mutex::Autolock _l(mIdleLock);
+    mIdle = true;
+    mIdleEntryTime = mIdleStartTime ? mIdleStartTime : systemTime();
+    mIdleStartTime = 0;
+    mIdleExitTime = 0;
+    mIdleEntries++;
+}
+
+void PrimaryDevice::onIdleExit()
+{
+    Mutex::Autolock _l(mIdleLock);
+    if (!mIdle) {
+        return;
+    }
+    mIdle = false;
+    mIdleExitTime = systemTime();
+    learnIdleDuration(mIdleExitTime - mIdleEntryTime);
+}
+
+uint32_t PrimaryDevice::getWorkload(hwc_display_contents_1_t *display)
+{
+    // FNV-1a over what stays the same while an app shows one screen
+    uint32_t hash = 2166136261U;
+    uint32_t values[4];
+    values[0] = display->numHwLayers;
+    values[1] = mHwc.getAnalyzerState().videoInstances > 0;
+    hash = (hash ^ values[0]) * 16777619U;
+    hash = (hash ^ values[1]) * 16777619U;
+    for (size_t i = 0; i + 1 < display->numHwLayers; i++) {
+        const hwc_layer_1_t& layer = display->hwLayers[i];
+        values[0] = layer.displayFrame.right - layer.displayFrame.left;
+        values[1] = layer.displayFrame.bottom - layer.displayFrame.top;
+        values[2] = layer.blending;
+        values[3] = layer.transform;
+        for (int j = 0; j < 4; j++) {
+            hash = (hash ^ values[j]) * 16777619U;
+        }
+    }
+    return hash;
+}
+
+bool PrimaryDevice::prepare(hwc_display_contents_1_t *display)
+{
+    bool ret = PhysicalDevice::prepare(display);
+    if (!display) {
+        return ret;
+    }
+
+    bool overlay = false;
+    for (size_t i = 0; i + 1 < display->numHwLayers; i++) {
+        if (display->hwLayers[i].compositionType == HWC_OVERLAY) {
+            overlay = true;
+            break;
+        }
+    }
+
+    Mutex::Autolock _l(mIdleLock);
+    nsecs_t now = systemTime();
+    if (!mIdle) {
+        mLayerCount = display->numHwLayers;
+        mWorkload = getWorkload(display);
+    }
+
+    // the screen changed before a deferred idle entry was due
+    mIdleDeferredTime = 0;
+    if (!mIdle) {
+        mIdleStartTime = 0;
+    }
+
+    // new frame after a skipped idle entry, learn how long it would be
+    if (mIdleSkipTime) {
+        learnIdleDuration(now - mIdleSkipTime);
+        mIdleSkipTime = 0;
+    }
+
+    if (mIdleExitTime && overlay) {
+        mLastExitLatency = now - mIdleExitTime;
+        if (mLastExitLatency > mMaxExitLatency) {
+            mMaxExitLatency = mLastExitLatency;
+        }
+        mIdleExitTime = 0;
+        DTRACE("first overlay frame %lld us after idle exit",
+               ns2us(mLastExitLatency));
+    }
+    return ret;
+}
+
+void PrimaryDevice::dump(Dump& d)
+{
+    PhysicalDevice::dump(d);
+
+    Mutex::Autolock _l(mIdleLock);
+    d.append("Idle: %s, entries %d, skipped %d, min duration %lld ms\n",
+             mIdle ? "yes" : "no", mIdleEntries, mIdleSkips,
+             ns2ms(mIdleMinDuration));
+    d.append("Idle exit to overlay frame: last %lld us, max %lld us\n",
+             ns2us(mLastExitLatency), ns2us(mMaxExitLatency));
+    for (int i = 0; i < IDLE_HISTORY_SLOTS; i++) {
+        if (!mIdleHistory[i].samples)
+            continue;
+        d.append("  workload %08x, %d layers: average idle %lld ms (%d samples)\n",
+                 mIdleHistory[i].workload, mIdleHistory[i].layerCount,
+                 ns2ms(mIdleHistory[i].avgDuration),
+                 mIdleHistory[i].samples);
+    }
+}
+
 bool PrimaryDevice::blank(bool blank)
 {
     if (!mConnected)
@@ -32,17 +32,25 @@
 #include <va/va_tpi.h>
 
 #include <cutils/properties.h>
+#include <cutils/atomic.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <unistd.h>
 
 #define NUM_CSC_BUFFERS 6
 #define NUM_SCALING_BUFFERS 3
+// idle bytes kept outside the active size class of each list
+#define CSC_BUFFERS_BUDGET (16 * 1024 * 1024)
+#define SCALING_BUFFERS_BUDGET (16 * 1024 * 1024)
 
 #define QCIF_WIDTH 176
 #define QCIF_HEIGHT 144
 
+// length of a WiDi cost adaptation window
+#define ADAPT_WINDOW ms2ns(1000)
+
 namespace android {
 namespace intel {
 
@@ -56,6 +64,9 @@ static inline uint32_t align_height(uint32_t val)
     return align_to(val, 16);
 }
 
+// WiDi cost adaptation steps, one frame in every rateDivider is composed
+static const uint32_t sAdaptRateDividers[] = { 1, 2, 3 };
+
 static void my_close_fence(const char* func, const char* fenceName, int& fenceFd)
 {
     if (fenceFd != -1) {
@@ -272,7 +283,8 @@ VirtualDevice::CachedBuffer::CachedBuffer(BufferManager *mgr, buffer_handle_t ha
     : manager(mgr),
       mapper(NULL),
       vaMappedHandle(NULL),
-      cachedKhandle(0)
+      cachedKhandle(0),
+      payloadManager(NULL)
 {
     DataBuffer *buffer = manager->lockDataBuffer((buffer_handle_t)handle);
     mapper = manager->map(*buffer);
@@ -283,6 +295,8 @@ VirtualDevice::CachedBuffer::~CachedBuffer()
 {
     if (vaMappedHandle != NULL)
         delete vaMappedHandle;
+    if (payloadManager != NULL)
+        payloadManager->removeMapper(mapper);
     manager->unmap(mapper);
 }
 
@@ -304,13 +318,70 @@ VirtualDevice::HeldDecoderBuffer::~HeldDecoderBuffer()
 
 struct VirtualDevice::Task : public RefBase {
     virtual void run(VirtualDevice& vd) = 0;
+    // pipelined tasks may still be in flight on the VSP when run() returns
+    virtual bool pipelined() const { return false; }
     virtual ~Task() {}
 };
 
 struct VirtualDevice::RenderTask : public VirtualDevice::Task {
-    RenderTask() : successful(false) { }
+    RenderTask()
+        : successful(false),
+          aborted(false),
+          admission(NULL),
+          queuedTime(0) { }
+    virtual ~RenderTask() { retire(); }
     virtual void run(VirtualDevice& vd) = 0;
+    // waits for the hardware and completes a pipelined frame, called in
+    // order on the completion thread
+    virtual void finish(VirtualDevice& vd) {}
+    // frame is done, successfully or not, as far as admission goes
+    void retire() {
+        if (admission != NULL) {
+            admission->frameRetired(queuedTime);
+            admission = NULL;
+        }
+    }
     bool successful;
+    // given up on in prepare after its release fences were handed out,
+    // only retired in order
+    bool aborted;
+    VirtualDevice *admission;
+    nsecs_t queuedTime;
+};
+
+struct VirtualDevice::OnFrameReadyTask : public VirtualDevice::Task {
+    virtual void run(VirtualDevice& vd) {
+        if (renderTask != NULL && !renderTask->successful)
+            return;
+
+        {
+            Mutex::Autolock _l(vd.mHeldBuffersLock);
+            //Add the heldbuffer to the vector before calling onFrameReady, so that the buffer will be removed
+            //from the vector properly even if the notifyBufferReturned call acquires mHeldBuffersLock first.
+            vd.mHeldBuffers.add(handle, heldBuffer);
+        }
+#ifdef INTEL_WIDI
+        // FIXME: we could remove this casting once onFrameReady receives
+        // a buffer_handle_t handle
+        status_t result = frameListener->onFrameReady((uint32_t)handle, handleType, renderTimestamp, mediaTimestamp);
+        if (result != OK) {
+            Mutex::Autolock _l(vd.mHeldBuffersLock);
+            vd.mHeldBuffers.removeItem(handle);
+        }
+#else
+        Mutex::Autolock _l(vd.mHeldBuffersLock);
+        vd.mHeldBuffers.removeItem(handle);
+#endif
+    }
+    sp<RenderTask> renderTask;
+    sp<RefBase> heldBuffer;
+    buffer_handle_t handle;
+#ifdef INTEL_WIDI
+    sp<IFrameListener> frameListener;
+    HWCBufferHandleType handleType;
+#endif
+    int64_t renderTimestamp;
+    int64_t mediaTimestamp;
 };
 
 struct VirtualDevice::ComposeTask : public VirtualDevice::RenderTask {
@@ -318,7 +389,13 @@ struct VirtualDevice::ComposeTask : public VirtualDevice::RenderTask {
         : videoKhandle(0),
           rgbHandle(NULL),
           mappedRgbIn(NULL),
+          localMappedRgbIn(NULL),
           outputHandle(NULL),
+          outputStride(0),
+          outputBufHeight(0),
+          mappedVideoOut(NULL),
+          dumpOutput(false),
+          submitted(false),
           yuvAcquireFenceFd(-1),
           rgbAcquireFenceFd(-1),
           outbufAcquireFenceFd(-1),
@@ -333,9 +410,22 @@ struct VirtualDevice::ComposeTask : public VirtualDevice::RenderTask {
         CLOSE_FENCE(rgbAcquireFenceFd);
         CLOSE_FENCE(outbufAcquireFenceFd);
         TIMELINE_INC(syncTimelineFd);
+        delete localMappedRgbIn;
+        delete mappedVideoOut;
     }
 
+    virtual bool pipelined() const { return true; }
+
     virtual void run(VirtualDevice& vd) {
+        if (!aborted)
+            submitted = vd.mSoftCompose ? composeSoft(vd) : submit(vd);
+        // failed frames complete in order too, their release fences are
+        // on the same timeline as frames still in VSP
+        vd.vspQueueCompletion(this);
+    }
+    // the frame is finished on the VSP completion thread, in order,
+    // while the next one is submitted from here
+    bool submit(VirtualDevice& vd) {
         bool dump = false;
         if (vd.mDebugVspDump && ++vd.mDebugCounter > 200) {
             dump = true;
@@ -359,39 +449,143 @@ struct VirtualDevice::ComposeTask : public VirtualDevice::RenderTask {
 
         if (videoInSurface == 0) {
             ETRACE("Couldn't map video");
-            return;
+            return false;
         }
         SYNC_WAIT_AND_CLOSE(rgbAcquireFenceFd);
         SYNC_WAIT_AND_CLOSE(outbufAcquireFenceFd);
 
-        VAMappedHandle mappedVideoOut(vd.va_dpy, outputHandle, align_width(outWidth), align_height(outHeight), (unsigned int)VA_FOURCC_NV12);
-        if (mappedVideoOut.surface == 0) {
+        if (outputStride == 0 || outputBufHeight == 0) {
+            outputStride = align_width(outWidth);
+            outputBufHeight = align_height(outHeight);
+        }
+
+        // output stays mapped until the frame completes
+        mappedVideoOut = new VAMappedHandle(vd.va_dpy, outputHandle, outputStride, outputBufHeight, (unsigned int)VA_FOURCC_NV12);
+        if (mappedVideoOut->surface == 0) {
             ETRACE("Unable to map outbuf");
-            return;
+            return false;
         }
 
         if (dump)
             dumpSurface(vd.va_dpy, "/data/misc/vsp_in.yuv", videoInSurface, videoStride*videoBufHeight*3/2);
 
+        VASurfaceID rgbInSurface;
         if (mappedRgbIn != NULL) {
             if (dump)
                 dumpSurface(vd.va_dpy, "/data/misc/vsp_in.rgb", mappedRgbIn->surface, align_width(outWidth)*align_height(outHeight)*4);
-            vd.vspCompose(videoInSurface, mappedRgbIn->surface, mappedVideoOut.surface, &surface_region, &output_region);
+            rgbInSurface = mappedRgbIn->surface;
         }
         else if (rgbHandle != NULL) {
-            VAMappedHandle localMappedRgbIn(vd.va_dpy, rgbHandle, align_width(outWidth), align_height(outHeight), (unsigned int)VA_FOURCC_BGRA);
-            vd.vspCompose(videoInSurface, localMappedRgbIn.surface, mappedVideoOut.surface, &surface_region, &output_region);
+            localMappedRgbIn = new VAMappedHandle(vd.va_dpy, rgbHandle, align_width(outWidth), align_height(outHeight), (unsigned int)VA_FOURCC_BGRA);
+            rgbInSurface = localMappedRgbIn->surface;
         }
         else {
             // No RGBA, so compose with 100% transparent RGBA frame.
             if (dump)
                 dumpSurface(vd.va_dpy, "/data/misc/vsp_in.rgb", vd.va_blank_rgb_in, align_width(outWidth)*align_height(outHeight)*4);
-            vd.vspCompose(videoInSurface, vd.va_blank_rgb_in, mappedVideoOut.surface, &surface_region, &output_region);
+            rgbInSurface = vd.va_blank_rgb_in;
+        }
+        dumpOutput = dump;
+
+        return vd.vspSubmit(videoInSurface, rgbInSurface, mappedVideoOut->surface, &surface_region, &output_region);
+    }
+    // composes on the CPU, the frame still completes in order with the
+    // ones VSP or the GPU may be finishing
+    bool composeSoft(VirtualDevice& vd) {
+        SYNC_WAIT_AND_CLOSE(yuvAcquireFenceFd);
+        SYNC_WAIT_AND_CLOSE(rgbAcquireFenceFd);
+        SYNC_WAIT_AND_CLOSE(outbufAcquireFenceFd);
+
+        if (outputStride == 0 || outputBufHeight == 0) {
+            outputStride = align_width(outWidth);
+            outputBufHeight = align_height(outHeight);
+        }
+
+        uint8_t *outPtr = NULL;
+        if (outputCachedBuffer != NULL && outputCachedBuffer->mapper != NULL)
+            outPtr = static_cast<uint8_t*>(outputCachedBuffer->mapper->getCpuAddress(0));
+        if (outPtr == NULL) {
+            ETRACE("Unable to map outbuf");
+            return false;
+        }
+        SoftCompositor::Image out;
+        out.luma = outPtr;
+        out.chroma = outPtr + outputStride * outputBufHeight;
+        out.stride = outputStride;
+        out.width = outWidth;
+        out.height = outHeight;
+        out.format = SoftCompositor::FORMAT_NV12;
+
+        // only the decoder's own linear buffer is visible to the CPU,
+        // scaled, rotated and tiled frames are left black
+        SoftCompositor::Image video;
+        SoftCompositor::Image *videoIn = NULL;
+        BufferMapper *videoMapper = videoKhandle != 0 ? videoCachedBuffer->mapper : NULL;
+        if (videoMapper != NULL && !videoTiled && videoMapper->getKHandle(0) == videoKhandle) {
+            video.luma = static_cast<uint8_t*>(videoMapper->getCpuAddress(0));
+            video.chroma = video.luma + videoStride * videoBufHeight;
+            video.stride = videoStride;
+            video.width = videoStride;
+            video.height = videoBufHeight;
+            video.format = SoftCompositor::FORMAT_NV12;
+            if (video.luma != NULL)
+                videoIn = &video;
+        }
+        if (videoKhandle != 0 && videoIn == NULL) {
+            // once is enough for the log, the dump keeps the count
+            if (android_atomic_inc(&vd.mSoftBlackVideo) == 0)
+                WTRACE("Video buffer %p not CPU visible (tiled, protected, rotated or "
+                       "scaled), composing black video", videoKhandle);
+        }
+
+        SoftCompositor::Image rgb;
+        SoftCompositor::Image *rgbIn = NULL;
+        if (rgbHandle != NULL) {
+            BufferMapper *rgbMapper = rgbCachedBuffer != NULL ? rgbCachedBuffer->mapper : NULL;
+            if (rgbMapper != NULL && rgbMapper->getCpuAddress(0) != NULL) {
+                rgb.luma = static_cast<uint8_t*>(rgbMapper->getCpuAddress(0));
+                rgb.chroma = NULL;
+                rgb.stride = rgbMapper->getStride().rgb.stride;
+                rgb.width = rgbMapper->getWidth();
+                rgb.height = rgbMapper->getHeight();
+                rgb.format = rgbMapper->getFormat() == HAL_PIXEL_FORMAT_RGBA_8888 ?
+                             SoftCompositor::FORMAT_RGBA : SoftCompositor::FORMAT_BGRA;
+                rgbIn = &rgb;
+            } else {
+                ETRACE("Unable to map RGB buffer");
+            }
+        }
+
+        crop_t src;
+        src.x = surface_region.x;
+        src.y = surface_region.y;
+        src.w = surface_region.width;
+        src.h = surface_region.height;
+        crop_t dst;
+        dst.x = output_region.x;
+        dst.y = output_region.y;
+        dst.w = output_region.width;
+        dst.h = output_region.height;
+        vd.mSoftCompositor.compose(videoIn, src, dst, rgbIn, out);
+        return true;
+    }
+    virtual void finish(VirtualDevice& vd) {
+        // frames composed on the CPU are done already
+        if (submitted && mappedVideoOut != NULL) {
+            vd.vspSyncSurface(mappedVideoOut->surface);
+            if (dumpOutput) {
+                Mutex::Autolock _l(vd.mVspContextLock);
+                dumpSurface(vd.va_dpy, "/data/misc/vsp_out.yuv", mappedVideoOut->surface, outputStride*outputBufHeight*3/2);
+            }
         }
-        if (dump)
-            dumpSurface(vd.va_dpy, "/data/misc/vsp_out.yuv", mappedVideoOut.surface, align_width(outWidth)*align_height(outHeight)*3/2);
         TIMELINE_INC(syncTimelineFd);
-        successful = true;
+        successful = submitted;
+        retire();
+        if (frameReadyTask != NULL) {
+            if (successful)
+                frameReadyTask->run(vd);
+            frameReadyTask = NULL;
+        }
     }
     void dumpSurface(VADisplay va_dpy, const char* filename, VASurfaceID surf, int size) {
         MappedSurface dumpSurface(va_dpy, surf);
@@ -415,12 +609,26 @@ struct VirtualDevice::ComposeTask : public VirtualDevice::RenderTask {
     buffer_handle_t rgbHandle;
     sp<RefBase> heldRgbHandle;
     sp<VAMappedHandleObject> mappedRgbIn;
+    VAMappedHandle *localMappedRgbIn;
     buffer_handle_t outputHandle;
+    // size of the output buffer, may exceed the aligned output size
+    // when a larger pooled buffer is reused, 0 to derive from outWidth
+    uint32_t outputStride;
+    uint32_t outputBufHeight;
+    VAMappedHandle *mappedVideoOut;
+    bool dumpOutput;
+    bool submitted;
+    // delivered to the frame listener once the frame completes
+    sp<OnFrameReadyTask> frameReadyTask;
     VARectangle surface_region;
     VARectangle output_region;
     uint32_t outWidth;
     uint32_t outHeight;
     sp<CachedBuffer> videoCachedBuffer;
+    // CPU mappings of the output and RGB buffers, only set when composing
+    // on the CPU
+    sp<CachedBuffer> outputCachedBuffer;
+    sp<CachedBuffer> rgbCachedBuffer;
     sp<RefBase> heldVideoBuffer;
     int yuvAcquireFenceFd;
     int rgbAcquireFenceFd;
@@ -430,10 +638,13 @@ struct VirtualDevice::ComposeTask : public VirtualDevice::RenderTask {
 
 struct VirtualDevice::EnableVspTask : public VirtualDevice::Task {
     virtual void run(VirtualDevice& vd) {
-        vd.vspEnable(width, height);
+        vd.vspEnable(width, height, capacityWidth, capacityHeight);
     }
     uint32_t width;
     uint32_t height;
+    // size the blank video input is allocated for
+    uint32_t capacityWidth;
+    uint32_t capacityHeight;
 };
 
 struct VirtualDevice::DisableVspTask : public VirtualDevice::Task {
@@ -446,6 +657,8 @@ struct VirtualDevice::BlitTask : public VirtualDevice::RenderTask {
     BlitTask()
         : srcAcquireFenceFd(-1),
           destAcquireFenceFd(-1),
+          blitted(false),
+          blitFenceFd(-1),
           syncTimelineFd(-1) { }
 
     virtual ~BlitTask()
@@ -456,26 +669,64 @@ struct VirtualDevice::BlitTask : public VirtualDevice::RenderTask {
         // and any release fences get signaled.
         CLOSE_FENCE(srcAcquireFenceFd);
         CLOSE_FENCE(destAcquireFenceFd);
+        CLOSE_FENCE(blitFenceFd);
         TIMELINE_INC(syncTimelineFd);
     }
 
+    virtual bool pipelined() const { return true; }
+
     virtual void run(VirtualDevice& vd) {
-        SYNC_WAIT_AND_CLOSE(srcAcquireFenceFd);
-        SYNC_WAIT_AND_CLOSE(destAcquireFenceFd);
+        if (aborted) {
+            CLOSE_FENCE(srcAcquireFenceFd);
+            CLOSE_FENCE(destAcquireFenceFd);
+            vd.vspQueueCompletion(this);
+            return;
+        }
+        // the GPU waits for both buffers, this thread moves on at once
+        int mergedFenceFd = -1;
+        if (srcAcquireFenceFd != -1 && destAcquireFenceFd != -1) {
+            mergedFenceFd = sync_merge("widi_blit_acquire", srcAcquireFenceFd, destAcquireFenceFd);
+            if (mergedFenceFd < 0) {
+                WTRACE("Unable to merge blit acquire fences, waiting for the output buffer");
+                mergedFenceFd = -1;
+                SYNC_WAIT_AND_CLOSE(destAcquireFenceFd);
+            }
+        }
+        int acquireFenceFd = mergedFenceFd != -1 ? mergedFenceFd :
+                             srcAcquireFenceFd != -1 ? srcAcquireFenceFd : destAcquireFenceFd;
         BufferManager* mgr = vd.mHwc.getBufferManager();
-        if (!(mgr->blit(srcHandle, destHandle, destRect, false))) {
+        blitted = mgr->blitAsync(srcHandle, destHandle, destRect, acquireFenceFd, &blitFenceFd);
+        // blitAsync leaves the acquire fences to the caller
+        CLOSE_FENCE(mergedFenceFd);
+        CLOSE_FENCE(srcAcquireFenceFd);
+        CLOSE_FENCE(destAcquireFenceFd);
+        if (!blitted)
             ETRACE("color space conversion from RGB to NV12 failed");
-        }
-        else
-            successful = true;
+        // the GPU finishes on its own while the next task starts, release
+        // fences are still signaled in frame order
+        vd.vspQueueCompletion(this);
+    }
+    virtual void finish(VirtualDevice& vd) {
+        SYNC_WAIT_AND_CLOSE(blitFenceFd);
+        successful = blitted;
         TIMELINE_INC(syncTimelineFd);
+        retire();
+        if (frameReadyTask != NULL) {
+            if (successful)
+                frameReadyTask->run(vd);
+            frameReadyTask = NULL;
+        }
     }
     buffer_handle_t srcHandle;
     buffer_handle_t destHandle;
     int srcAcquireFenceFd;
     int destAcquireFenceFd;
+    bool blitted;
+    int blitFenceFd;
     int syncTimelineFd;
     crop_t destRect;
+    // run on the completion thread, so delivery needs no pipeline drain
+    sp<OnFrameReadyTask> frameReadyTask;
 };
 
 struct VirtualDevice::FrameTypeChangedTask : public VirtualDevice::Task {
@@ -510,139 +761,244 @@ struct VirtualDevice::BufferInfoChangedTask : public VirtualDevice::Task {
 #endif
 };
 
-struct VirtualDevice::OnFrameReadyTask : public VirtualDevice::Task {
-    virtual void run(VirtualDevice& vd) {
-        if (renderTask != NULL && !renderTask->successful)
-            return;
-
-        {
-            Mutex::Autolock _l(vd.mHeldBuffersLock);
-            //Add the heldbuffer to the vector before calling onFrameReady, so that the buffer will be removed
-            //from the vector properly even if the notifyBufferReturned call acquires mHeldBuffersLock first.
-            vd.mHeldBuffers.add(handle, heldBuffer);
-        }
-#ifdef INTEL_WIDI
-        // FIXME: we could remove this casting once onFrameReady receives
-        // a buffer_handle_t handle
-        status_t result = frameListener->onFrameReady((uint32_t)handle, handleType, renderTimestamp, mediaTimestamp);
-        if (result != OK) {
-            Mutex::Autolock _l(vd.mHeldBuffersLock);
-            vd.mHeldBuffers.removeItem(handle);
-        }
-#else
-        Mutex::Autolock _l(vd.mHeldBuffersLock);
-        vd.mHeldBuffers.removeItem(handle);
-#endif
-    }
-    sp<RenderTask> renderTask;
-    sp<RefBase> heldBuffer;
-    buffer_handle_t handle;
-#ifdef INTEL_WIDI
-    sp<IFrameListener> frameListener;
-    HWCBufferHandleType handleType;
-#endif
-    int64_t renderTimestamp;
-    int64_t mediaTimestamp;
-};
-
 struct VirtualDevice::BufferList::HeldBuffer : public RefBase {
-    HeldBuffer(BufferList& list, buffer_handle_t handle, uint32_t w, uint32_t h)
+    HeldBuffer(BufferList& list, buffer_handle_t handle)
         : mList(list),
-          mHandle(handle),
-          mWidth(w),
-          mHeight(h) { }
+          mHandle(handle) { }
     virtual ~HeldBuffer()
     {
         Mutex::Autolock _l(mList.mVd.mTaskLock);
-        if (mWidth == mList.mWidth && mHeight == mList.mHeight) {
-            VTRACE("Returning %s buffer %p (%ux%u) to list", mList.mName, mHandle, mWidth, mHeight);
-            mList.mAvailableBuffers.push_back(mHandle);
-        } else {
-            VTRACE("Deleting %s buffer %p (%ux%u)", mList.mName, mHandle, mWidth, mHeight);
-            BufferManager* mgr = mList.mVd.mHwc.getBufferManager();
-            mgr->freeGrallocBuffer((mHandle));
-            if (mList.mBuffersToCreate < mList.mLimit)
-                mList.mBuffersToCreate++;
-        }
+        mList.putBuffer(mHandle);
     }
 
     BufferList& mList;
     buffer_handle_t mHandle;
-    uint32_t mWidth;
-    uint32_t mHeight;
 };
 
 VirtualDevice::BufferList::BufferList(VirtualDevice& vd, const char* name,
-                                      uint32_t limit, uint32_t format, uint32_t usage)
+                                      uint32_t limit, uint32_t format, uint32_t usage,
+                                      uint32_t budget, bool crop)
     : mVd(vd),
       mName(name),
       mLimit(limit),
       mFormat(format),
       mUsage(usage),
-      mBuffersToCreate(0),
+      mBudget(budget),
+      mCrop(crop),
+      mClock(0),
+      mRequestWidth(0),
+      mRequestHeight(0),
       mWidth(0),
       mHeight(0)
 {
 }
 
-buffer_handle_t VirtualDevice::BufferList::get(uint32_t width, uint32_t height, sp<RefBase>* heldBuffer)
+uint32_t VirtualDevice::BufferList::getBufferBytes(uint32_t width, uint32_t height) const
+{
+    // NV12 variants are 12 bits per pixel, everything else here is 32
+    if (mFormat == HAL_PIXEL_FORMAT_BGRA_8888)
+        return width * height * 4;
+    return width * height * 3 / 2;
+}
+
+void VirtualDevice::BufferList::freeBuffer(size_t index)
+{
+    const PooledBuffer& buffer = mBuffers.itemAt(index);
+    VTRACE("Deleting %s buffer %p (%ux%u)", mName, buffer.handle, buffer.width, buffer.height);
+    mVd.mHwc.getBufferManager()->freeGrallocBuffer(buffer.handle);
+    mBuffers.removeAt(index);
+}
+
+void VirtualDevice::BufferList::selectClass(uint32_t width, uint32_t height)
+{
+    uint32_t classWidth = width;
+    uint32_t classHeight = height;
+
+    // serve the request with the smallest idle class that covers it, as
+    // long as the buffer is not more than twice the requested area. The
+    // consumer crops to the content size carried in the frame info.
+    if (mCrop) {
+        uint64_t bestArea = 0;
+        for (size_t i = 0; i < mBuffers.size(); i++) {
+            const PooledBuffer& buffer = mBuffers.itemAt(i);
+            if (!buffer.idle || buffer.discard)
+                continue;
+            if (buffer.width < width || buffer.height < height)
+                continue;
+            uint64_t area = (uint64_t)buffer.width * buffer.height;
+            if (area > (uint64_t)width * height * 2)
+                continue;
+            if (bestArea == 0 || area < bestArea) {
+                bestArea = area;
+                classWidth = buffer.width;
+                classHeight = buffer.height;
+            }
+        }
+    }
+
+    ITRACE("%s buffers changing from %ux%u to %ux%u (request %ux%u)",
+            mName, mWidth, mHeight, classWidth, classHeight, width, height);
+    mRequestWidth = width;
+    mRequestHeight = height;
+    mWidth = classWidth;
+    mHeight = classHeight;
+}
+
+buffer_handle_t VirtualDevice::BufferList::get(uint32_t width, uint32_t height, sp<RefBase>* heldBuffer,
+                                               uint32_t *bufWidth, uint32_t *bufHeight)
 {
     width = align_width(width);
     height = align_height(height);
-    if (mWidth != width || mHeight != height) {
-        ITRACE("%s buffers changing from %dx%d to %dx%d",
-                mName, mWidth, mHeight, width, height);
-        clear();
-        mWidth = width;
-        mHeight = height;
-        mBuffersToCreate = mLimit;
+    if (mRequestWidth != width || mRequestHeight != height) {
+        selectClass(width, height);
+        trim();
+    }
+
+    // all buffers handed out for one request size come from one class,
+    // so that the buffer size seen by the consumer stays stable
+    ssize_t index = -1;
+    uint32_t count = 0;
+    for (size_t i = 0; i < mBuffers.size(); i++) {
+        const PooledBuffer& buffer = mBuffers.itemAt(i);
+        if (buffer.width != mWidth || buffer.height != mHeight || buffer.discard)
+            continue;
+        count++;
+        if (buffer.idle && index < 0)
+            index = i;
     }
 
     buffer_handle_t handle;
-    if (mAvailableBuffers.empty()) {
-        if (mBuffersToCreate <= 0)
+    if (index < 0) {
+        if (count >= mLimit)
             return NULL;
         BufferManager* mgr = mVd.mHwc.getBufferManager();
         handle = reinterpret_cast<buffer_handle_t>(
-            mgr->allocGrallocBuffer(width, height, mFormat, mUsage));
+            mgr->allocGrallocBuffer(mWidth, mHeight, mFormat, mUsage));
         if (handle == NULL){
             ETRACE("failed to allocate %s buffer", mName);
             return NULL;
         }
-        mBuffersToCreate--;
+        PooledBuffer buffer;
+        buffer.handle = handle;
+        buffer.width = mWidth;
+        buffer.height = mHeight;
+        buffer.idle = false;
+        buffer.discard = false;
+        buffer.lastUsed = ++mClock;
+        mBuffers.push_back(buffer);
     }
     else {
-        handle = *mAvailableBuffers.begin();
-        mAvailableBuffers.erase(mAvailableBuffers.begin());
-    }
-    *heldBuffer = new HeldBuffer(*this, handle, width, height);
+        PooledBuffer& buffer = mBuffers.editItemAt(index);
+        buffer.idle = false;
+        buffer.lastUsed = ++mClock;
+        handle = buffer.handle;
+    }
+    *heldBuffer = new HeldBuffer(*this, handle);
+    if (bufWidth)
+        *bufWidth = mWidth;
+    if (bufHeight)
+        *bufHeight = mHeight;
     return handle;
 }
 
+void VirtualDevice::BufferList::putBuffer(buffer_handle_t handle)
+{
+    for (size_t i = 0; i < mBuffers.size(); i++) {
+        PooledBuffer& buffer = mBuffers.editItemAt(i);
+        if (buffer.handle != handle)
+            continue;
+        if (buffer.discard) {
+            freeBuffer(i);
+            return;
+        }
+        VTRACE("Returning %s buffer %p (%ux%u) to list", mName, handle, buffer.width, buffer.height);
+        buffer.idle = true;
+        buffer.lastUsed = ++mClock;
+        break;
+    }
+    trim();
+}
+
+void VirtualDevice::BufferList::trim()
+{
+    // idle buffers outside the active class are kept for a later switch
+    // back, least recently used are released first when over budget
+    while (true) {
+        uint32_t bytes = 0;
+        ssize_t oldest = -1;
+        for (size_t i = 0; i < mBuffers.size(); i++) {
+            const PooledBuffer& buffer = mBuffers.itemAt(i);
+            if (!buffer.idle)
+                continue;
+            if (buffer.width == mWidth && buffer.height == mHeight)
+                continue;
+            bytes += getBufferBytes(buffer.width, buffer.height);
+            if (oldest < 0 || buffer.lastUsed < mBuffers.itemAt(oldest).lastUsed)
+                oldest = i;
+        }
+        if (bytes <= mBudget || oldest < 0)
+            break;
+        freeBuffer(oldest);
+    }
+}
+
 void VirtualDevice::BufferList::clear()
 {
     if (mWidth != 0 || mHeight != 0)
         ITRACE("Releasing %s buffers (%ux%u)", mName, mWidth, mHeight);
-    if (!mAvailableBuffers.empty()) {
-        // iterate the list and call freeGraphicBuffer
-        for (List<buffer_handle_t>::iterator i = mAvailableBuffers.begin(); i != mAvailableBuffers.end(); ++i) {
-            VTRACE("Deleting the gralloc buffer associated with handle (%p)", (*i));
-            mVd.mHwc.getBufferManager()->freeGrallocBuffer((*i));
-        }
-        mAvailableBuffers.clear();
+    // idle buffers go now, the ones still in flight when they come back
+    for (size_t i = mBuffers.size(); i > 0; i--) {
+        if (mBuffers.itemAt(i - 1).idle)
+            freeBuffer(i - 1);
+        else
+            mBuffers.editItemAt(i - 1).discard = true;
     }
+    mRequestWidth = 0;
+    mRequestHeight = 0;
     mWidth = 0;
     mHeight = 0;
 }
 
+class VirtualDevice::PrepareLock {
+public:
+    PrepareLock(VirtualDevice& vd)
+        : mVd(vd)
+    {
+        mVd.mTaskLock.lock();
+        mStart = systemTime(SYSTEM_TIME_MONOTONIC);
+        mWaited = mVd.mPrepareLockWaited;
+    }
+    ~PrepareLock()
+    {
+        nsecs_t held = systemTime(SYSTEM_TIME_MONOTONIC) - mStart -
+                       (mVd.mPrepareLockWaited - mWaited);
+        mVd.mPrepareLockHolds++;
+        mVd.mPrepareLockHeldTotal += held;
+        if (held > mVd.mPrepareLockHeldMax)
+            mVd.mPrepareLockHeldMax = held;
+        mVd.mTaskLock.unlock();
+    }
+private:
+    VirtualDevice& mVd;
+    nsecs_t mStart;
+    nsecs_t mWaited;
+};
+
 VirtualDevice::VirtualDevice(Hwcomposer& hwc)
     : mProtectedMode(false),
+      mPrepareLockHolds(0),
+      mPrepareLockHeldTotal(0),
+      mPrepareLockHeldMax(0),
+      mPrepareLockWaited(0),
       mCscBuffers(*this, "CSC",
                   NUM_CSC_BUFFERS, DisplayQuery::queryNV12Format(),
-                  GRALLOC_USAGE_HW_VIDEO_ENCODER | GRALLOC_USAGE_HW_RENDER | GRALLOC_USAGE_PRIVATE_1),
+                  GRALLOC_USAGE_HW_VIDEO_ENCODER | GRALLOC_USAGE_HW_RENDER | GRALLOC_USAGE_PRIVATE_1,
+                  CSC_BUFFERS_BUDGET, true),
+      // VSP blends the RGB layer at the output size, so no cropping here
       mRgbUpscaleBuffers(*this, "RGB upscale",
                          NUM_SCALING_BUFFERS, HAL_PIXEL_FORMAT_BGRA_8888,
-                         GRALLOC_USAGE_HW_TEXTURE | GRALLOC_USAGE_HW_RENDER),
+                         GRALLOC_USAGE_HW_TEXTURE | GRALLOC_USAGE_HW_RENDER,
+                         SCALING_BUFFERS_BUDGET, false),
       mInitialized(false),
       mHwc(hwc),
       mPayloadManager(NULL),
@@ -675,6 +1031,7 @@ sp<VirtualDevice::CachedBuffer> VirtualDevice::getMappedBuffer(buffer_handle_t h
             mMappedBufferCache.clear();
 
         cachedBuffer = new CachedBuffer(mHwc.getBufferManager(), handle);
+        cachedBuffer->payloadManager = mPayloadManager;
         mMappedBufferCache.add(handle, cachedBuffer);
     } else {
         cachedBuffer = mMappedBufferCache[index];
@@ -686,18 +1043,43 @@ sp<VirtualDevice::CachedBuffer> VirtualDevice::getMappedBuffer(buffer_handle_t h
 bool VirtualDevice::threadLoop()
 {
     sp<Task> task;
+    bool releaseBlank = false;
     {
         Mutex::Autolock _l(mTaskLock);
         while (mTasks.empty()) {
-            mRequestQueued.wait(mTaskLock);
+            if (mThreadExit)
+                return false;
+            if (!mVspBlankIdle) {
+                mRequestQueued.wait(mTaskLock);
+                continue;
+            }
+            // nothing queued for a while after VSP was disabled
+            if (mRequestQueued.waitRelative(mTaskLock,
+                    milliseconds_to_nanoseconds(VSP_BLANK_RELEASE_DELAY)) == TIMED_OUT &&
+                mTasks.empty()) {
+                releaseBlank = true;
+                break;
+            }
+        }
+        if (!releaseBlank) {
+            task = *mTasks.begin();
+            mTasks.erase(mTasks.begin());
         }
-        task = *mTasks.begin();
-        mTasks.erase(mTasks.begin());
+    }
+    if (releaseBlank) {
+        vspReleaseBlank();
     }
     if (task != NULL) {
+        // frames in flight finish before anything that is not pipelined,
+        // keeping frame delivery ordered and VSP teardown safe
+        if (!task->pipelined())
+            vspWaitInFlight(0);
         task->run(*this);
         task = NULL;
     }
+    // prepare checks its wait conditions under mTaskLock, signal under it
+    // too so the wakeup can't fall between the check and the wait
+    Mutex::Autolock _l(mTaskLock);
     mRequestDequeued.signal();
 
     return true;
@@ -744,6 +1126,12 @@ status_t VirtualDevice::stop(bool isConnected)
         Mutex::Autolock _l(mTaskLock);
         mCscBuffers.clear();
     }
+    {
+        // the next session starts at full cost again
+        Mutex::Autolock _l(mAdmissionLock);
+        mAdaptLevel = 0;
+        mAdaptQuietWindows = 0;
+    }
     return NO_ERROR;
 }
 #endif
@@ -822,8 +1210,9 @@ bool VirtualDevice::prepare(hwc_display_contents_1_t *display)
 
     bool shouldBeConnected = (display != NULL);
     if (shouldBeConnected != mLastConnectionStatus) {
-        // calling this will reload the property 'hwc.video.extmode.enable'
-        Hwcomposer::getInstance().getDisplayAnalyzer()->isVideoExtModeEnabled();
+        // reload the property 'hwc.video.extmode.enable' on the prepare
+        // thread, which owns the analyzer
+        mHwc.getDisplayAnalyzer()->postExtModeReloadEvent();
         char propertyVal[PROPERTY_VALUE_MAX];
         if (property_get("widi.compose.rgb_upscale", propertyVal, NULL) > 0)
             mVspUpscale = atoi(propertyVal);
@@ -831,6 +1220,12 @@ bool VirtualDevice::prepare(hwc_display_contents_1_t *display)
             mDebugVspClear = atoi(propertyVal);
         if (property_get("widi.compose.dump", propertyVal, NULL) > 0)
             mDebugVspDump = atoi(propertyVal);
+        if (property_get("widi.compose.soft", propertyVal, NULL) > 0)
+            mForceSoftCompose = atoi(propertyVal);
+        if (property_get("widi.compose.adaptive", propertyVal, NULL) > 0) {
+            Mutex::Autolock _l(mAdmissionLock);
+            mAdaptEnabled = atoi(propertyVal);
+        }
 
         Hwcomposer::getInstance().getMultiDisplayObserver()->notifyWidiConnectionStatus(shouldBeConnected);
         mLastConnectionStatus = shouldBeConnected;
@@ -861,13 +1256,17 @@ bool VirtualDevice::prepare(hwc_display_contents_1_t *display)
     mRgbLayer = fbTarget;
     mYuvLayer = -1;
 
+    // may run concurrently with the physical displays, so analyzer state
+    // is read from the copy taken for this prepare. layer queries only
+    // look at the buffer
     DisplayAnalyzer *analyzer = mHwc.getDisplayAnalyzer();
+    const DisplayAnalyzer::State& analyzerState = mHwc.getAnalyzerState();
 
     mProtectedMode = false;
 #ifdef INTEL_WIDI
     if (mCurrentConfig.typeChangeListener != NULL &&
-        !analyzer->isOverlayAllowed() &&
-        analyzer->getVideoInstances() <= 1) {
+        !analyzerState.overlayAllowed &&
+        analyzerState.videoInstances <= 1) {
         if (mCurrentConfig.typeChangeListener->shutdownVideo() != OK) {
             ITRACE("Waiting for prior encoder session to shut down...");
         }
@@ -889,7 +1288,7 @@ bool VirtualDevice::prepare(hwc_display_contents_1_t *display)
         if (analyzer->isVideoLayer(layer) && (mCurrentConfig.extendedModeEnabled || mDebugVspClear || analyzer->isProtectedLayer(layer))) {
             if (mCurrentConfig.frameServerActive && mCurrentConfig.extendedModeEnabled) {
                 // If composed in surface flinger, then stream fbtarget.
-                if ((layer.flags & HWC_SKIP_LAYER) && !analyzer->ignoreVideoSkipFlag()) {
+                if ((layer.flags & HWC_SKIP_LAYER) && !analyzerState.ignoreVideoSkipFlag) {
                     continue;
                 }
 
@@ -1040,13 +1439,22 @@ bool VirtualDevice::queueCompose(hwc_display_contents_1_t *display)
         ETRACE("No outbuf");
         return true; // fallback would be pointless
     }
+#ifdef INTEL_WIDI
+    if (mCurrentConfig.frameServerActive && !admitFrame()) {
+        // WiDi is behind or paced down, skip this frame rather than
+        // stalling prepare. Its acquire fences are closed in commit.
+        mExpectAcquireFences = true;
+        return true;
+    }
+#endif
 
     sp<ComposeTask> composeTask = new ComposeTask();
 
     sp<RefBase> heldBuffer;
     sp<OnFrameReadyTask> frameReadyTask;
-    Mutex::Autolock _l(mTaskLock);
 
+    // the task is built without mTaskLock, which only covers the buffer
+    // lists, VSP setup and publishing the finished task to WidiBlit
     float upscale_x = 1.0;
     float upscale_y = 1.0;
     hwc_layer_1_t& fbTarget = display->hwLayers[display->numHwLayers-1];
@@ -1059,17 +1467,11 @@ bool VirtualDevice::queueCompose(hwc_display_contents_1_t *display)
         if (mVspUpscale) {
             composeTask->outWidth = mCurrentConfig.policy.scaledWidth;
             composeTask->outHeight = mCurrentConfig.policy.scaledHeight;
-            upscale_x = mCurrentConfig.policy.scaledWidth/(fbTarget.sourceCropf.right - fbTarget.sourceCropf.left);
-            upscale_y = mCurrentConfig.policy.scaledHeight/(fbTarget.sourceCropf.bottom - fbTarget.sourceCropf.top);
+            upscale_x = composeTask->outWidth/(fbTarget.sourceCropf.right - fbTarget.sourceCropf.left);
+            upscale_y = composeTask->outHeight/(fbTarget.sourceCropf.bottom - fbTarget.sourceCropf.top);
             scaleRgb = composeTask->outWidth != fbTarget.sourceCropf.right - fbTarget.sourceCropf.left ||
                        composeTask->outHeight != fbTarget.sourceCropf.bottom - fbTarget.sourceCropf.top;
         }
-
-        composeTask->outputHandle = mCscBuffers.get(composeTask->outWidth, composeTask->outHeight, &heldBuffer);
-        if (composeTask->outputHandle == NULL) {
-            WTRACE("Out of CSC buffers, dropping frame");
-            return true;
-        }
     } else {
         composeTask->outputHandle = display->outbuf;
     }
@@ -1077,7 +1479,22 @@ bool VirtualDevice::queueCompose(hwc_display_contents_1_t *display)
     composeTask->outputHandle = display->outbuf;
 #endif
 
-    vspPrepare(composeTask->outWidth, composeTask->outHeight);
+    {
+        PrepareLock _l(*this);
+#ifdef INTEL_WIDI
+        if (mCurrentConfig.frameServerActive) {
+            composeTask->outputHandle = mCscBuffers.get(composeTask->outWidth, composeTask->outHeight, &heldBuffer,
+                                                        &composeTask->outputStride, &composeTask->outputBufHeight);
+            if (composeTask->outputHandle == NULL) {
+                WTRACE("Out of CSC buffers, dropping frame");
+                frameDropped();
+                mExpectAcquireFences = true;
+                return true;
+            }
+        }
+#endif
+        vspPrepare(composeTask->outWidth, composeTask->outHeight);
+    }
 
     composeTask->videoCachedBuffer = getMappedBuffer(yuvLayer.handle);
     if (composeTask->videoCachedBuffer == NULL) {
@@ -1219,6 +1636,11 @@ bool VirtualDevice::queueCompose(hwc_display_contents_1_t *display)
         composeTask->videoTiled = false;
     }
 
+    if (mSoftCompose && mProtectedMode) {
+        // protected frames can't be read by the CPU
+        composeTask->videoKhandle = 0;
+    }
+
     composeTask->yuvAcquireFenceFd = yuvLayer.acquireFenceFd;
     yuvLayer.acquireFenceFd = -1;
 
@@ -1245,19 +1667,24 @@ bool VirtualDevice::queueCompose(hwc_display_contents_1_t *display)
         hwc_layer_1_t& rgbLayer = display->hwLayers[mRgbLayer];
         if (rgbLayer.handle == NULL) {
             ETRACE("No RGB handle");
+            queueAborted(composeTask);
             return false;
         }
 
         if (scaleRgb) {
             buffer_handle_t scalingBuffer;
             sp<RefBase> heldUpscaleBuffer;
-            while ((scalingBuffer = mRgbUpscaleBuffers.get(composeTask->outWidth, composeTask->outHeight, &heldUpscaleBuffer)) == NULL &&
-                   !mTasks.empty()) {
-                VTRACE("Waiting for free RGB upscale buffer...");
-                mRequestDequeued.wait(mTaskLock);
+            {
+                PrepareLock _l(*this);
+                while ((scalingBuffer = mRgbUpscaleBuffers.get(composeTask->outWidth, composeTask->outHeight, &heldUpscaleBuffer)) == NULL &&
+                       (!mTasks.empty() || vspFramesInFlight() > 0)) {
+                    VTRACE("Waiting for free RGB upscale buffer...");
+                    waitRequestDequeued();
+                }
             }
             if (scalingBuffer == NULL) {
                 ETRACE("Couldn't get scaling buffer");
+                queueAborted(composeTask);
                 return false;
             }
             BufferManager* mgr = mHwc.getBufferManager();
@@ -1266,17 +1693,29 @@ bool VirtualDevice::queueCompose(hwc_display_contents_1_t *display)
             destRect.y = 0;
             destRect.w = composeTask->outWidth;
             destRect.h = composeTask->outHeight;
-            if (!mgr->blit(rgbLayer.handle, scalingBuffer, destRect, true))
+            // the GPU waits for the layer to be rendered before it reads it
+            int blitFenceFd;
+            if (!mgr->blitAsync(rgbLayer.handle, scalingBuffer, destRect,
+                                composeTask->rgbAcquireFenceFd, &blitFenceFd)) {
+                queueAborted(composeTask);
                 return true;
+            }
+            // VSP reads the upscaled copy, so it waits for the blit instead
+            CLOSE_FENCE(composeTask->rgbAcquireFenceFd);
+            composeTask->rgbAcquireFenceFd = blitFenceFd;
             composeTask->rgbHandle = scalingBuffer;
             composeTask->heldRgbHandle = heldUpscaleBuffer;
         }
+        else if (mSoftCompose) {
+            // read straight from the layer by the CPU
+            composeTask->rgbHandle = rgbLayer.handle;
+        }
         else {
             unsigned int pixel_format = VA_FOURCC_BGRA;
             const IMG_native_handle_t* nativeHandle = reinterpret_cast<const IMG_native_handle_t*>(rgbLayer.handle);
             if (nativeHandle->iFormat == HAL_PIXEL_FORMAT_RGBA_8888)
                 pixel_format = VA_FOURCC_RGBA;
-            mRgbUpscaleBuffers.clear();
+            // upscale buffers stay pooled until VSP is disabled
             ssize_t index = mVaMapCache.indexOfKey(rgbLayer.handle);
             if (index == NAME_NOT_FOUND) {
                 composeTask->mappedRgbIn = new VAMappedHandleObject(va_dpy, rgbLayer.handle, composeTask->outWidth, composeTask->outHeight, pixel_format);
@@ -1286,6 +1725,7 @@ bool VirtualDevice::queueCompose(hwc_display_contents_1_t *display)
                 composeTask->mappedRgbIn = mVaMapCache[index];
             if (composeTask->mappedRgbIn->surface == 0) {
                 ETRACE("Unable to map RGB surface");
+                queueAborted(composeTask);
                 return false;
             }
         }
@@ -1293,12 +1733,19 @@ bool VirtualDevice::queueCompose(hwc_display_contents_1_t *display)
     else
         composeTask->mappedRgbIn = NULL;
 
-    mTasks.push_back(composeTask);
-    mRequestQueued.signal();
+    if (mSoftCompose) {
+        // kept mapped across frames like the video buffers
+        composeTask->outputCachedBuffer = getMappedBuffer(composeTask->outputHandle);
+        if (composeTask->rgbHandle != NULL)
+            composeTask->rgbCachedBuffer = getMappedBuffer(composeTask->rgbHandle);
+    }
+
 #ifdef INTEL_WIDI
+    FrameInfo inputFrameInfo;
+    FrameInfo outputFrameInfo;
+    // WiDi may not want frames right now, which isn't a failure
+    bool wantFrames = mCurrentConfig.policy.scaledWidth != 0 && mCurrentConfig.policy.scaledHeight != 0;
     if (mCurrentConfig.frameServerActive) {
-
-        FrameInfo inputFrameInfo;
         memset(&inputFrameInfo, 0, sizeof(inputFrameInfo));
         inputFrameInfo.isProtected = mProtectedMode;
         inputFrameInfo.frameType = HWC_FRAMETYPE_FRAME_BUFFER;
@@ -1319,7 +1766,7 @@ bool VirtualDevice::queueCompose(hwc_display_contents_1_t *display)
         }
         inputFrameInfo.contentFrameRateN = 0;
         inputFrameInfo.contentFrameRateD = 0;
-        FrameInfo outputFrameInfo = inputFrameInfo;
+        outputFrameInfo = inputFrameInfo;
 
         BufferManager* mgr = mHwc.getBufferManager();
         DataBuffer* dataBuf = mgr->lockDataBuffer(composeTask->outputHandle);
@@ -1332,21 +1779,16 @@ bool VirtualDevice::queueCompose(hwc_display_contents_1_t *display)
         outputFrameInfo.chromaVStride = dataBuf->getWidth();
         mgr->unlockDataBuffer(dataBuf);
 
-        queueFrameTypeInfo(inputFrameInfo);
-        if (mCurrentConfig.policy.scaledWidth == 0 || mCurrentConfig.policy.scaledHeight == 0)
-            return true; // This isn't a failure, WiDi just doesn't want frames right now.
-        queueBufferInfo(outputFrameInfo);
-
-        if (mCurrentConfig.frameListener != NULL) {
+        if (wantFrames && mCurrentConfig.frameListener != NULL) {
+            // run by the compose task once the VSP has finished the frame
             frameReadyTask = new OnFrameReadyTask();
-            frameReadyTask->renderTask = composeTask;
             frameReadyTask->heldBuffer = heldBuffer;
             frameReadyTask->frameListener = mCurrentConfig.frameListener;
             frameReadyTask->handle = composeTask->outputHandle;
             frameReadyTask->handleType = HWC_HANDLE_TYPE_GRALLOC;
             frameReadyTask->renderTimestamp = mRenderTimestamp;
             frameReadyTask->mediaTimestamp = -1;
-            mTasks.push_back(frameReadyTask);
+            composeTask->frameReadyTask = frameReadyTask;
         }
     }
     else {
@@ -1356,9 +1798,33 @@ bool VirtualDevice::queueCompose(hwc_display_contents_1_t *display)
     display->retireFenceFd = dup(retireFd);
 #endif
 
+    frameQueued(composeTask.get());
+    PrepareLock _l(*this);
+#ifdef INTEL_WIDI
+    // the frame is delivered from the completion thread, so the listener
+    // must hear about type and buffer changes before the frame is queued
+    if (mCurrentConfig.frameServerActive) {
+        queueFrameTypeInfo(inputFrameInfo);
+        if (wantFrames)
+            queueBufferInfo(outputFrameInfo);
+    }
+#endif
+    mTasks.push_back(composeTask);
+    mRequestQueued.signal();
+
     return true;
 }
 
+void VirtualDevice::queueAborted(const sp<RenderTask>& task)
+{
+    // its release fences are out already, so it has to retire behind the
+    // frames queued before it rather than when it goes out of scope
+    task->aborted = true;
+    PrepareLock _l(*this);
+    mTasks.push_back(task);
+    mRequestQueued.signal();
+}
+
 bool VirtualDevice::queueColorConvert(hwc_display_contents_1_t *display)
 {
     if (mRgbLayer == -1) {
@@ -1398,6 +1864,15 @@ bool VirtualDevice::queueColorConvert(hwc_display_contents_1_t *display)
         }
     }
 
+#ifdef INTEL_WIDI
+    if (mCurrentConfig.frameServerActive && !admitFrame()) {
+        // WiDi is behind or paced down, skip this frame rather than
+        // stalling prepare. Its acquire fences are closed in commit.
+        mExpectAcquireFences = true;
+        return true;
+    }
+#endif
+
     sp<BlitTask> blitTask = new BlitTask();
     sp<OnFrameReadyTask> frameReadyTask;
     blitTask->destRect.x = 0;
@@ -1407,7 +1882,6 @@ bool VirtualDevice::queueColorConvert(hwc_display_contents_1_t *display)
     blitTask->srcHandle = layer.handle;
 
     sp<RefBase> heldBuffer;
-    Mutex::Autolock _l(mTaskLock);
 
     blitTask->srcAcquireFenceFd = layer.acquireFenceFd;
     layer.acquireFenceFd = -1;
@@ -1418,7 +1892,10 @@ bool VirtualDevice::queueColorConvert(hwc_display_contents_1_t *display)
     mNextSyncPoint++;
 #ifdef INTEL_WIDI
     if (mCurrentConfig.frameServerActive) {
-        blitTask->destHandle = mCscBuffers.get(blitTask->destRect.w, blitTask->destRect.h, &heldBuffer);
+        {
+            PrepareLock _l(*this);
+            blitTask->destHandle = mCscBuffers.get(blitTask->destRect.w, blitTask->destRect.h, &heldBuffer);
+        }
         blitTask->destAcquireFenceFd = -1;
 
         // we do not use retire fence in frameServerActive path.
@@ -1443,17 +1920,19 @@ bool VirtualDevice::queueColorConvert(hwc_display_contents_1_t *display)
 #endif
     if (blitTask->destHandle == NULL) {
         WTRACE("Out of CSC buffers, dropping frame");
+        frameDropped();
+        queueAborted(blitTask);
         return false;
     }
 
-    mTasks.push_back(blitTask);
-    mRequestQueued.signal();
 #ifdef INTEL_WIDI
+    FrameInfo inputFrameInfo;
+    FrameInfo outputFrameInfo;
+    // WiDi may not want frames right now, which isn't a failure
+    bool wantFrames = mCurrentConfig.policy.scaledWidth != 0 && mCurrentConfig.policy.scaledHeight != 0;
     if (mCurrentConfig.frameServerActive) {
-        FrameInfo inputFrameInfo;
         memset(&inputFrameInfo, 0, sizeof(inputFrameInfo));
         inputFrameInfo.isProtected = mProtectedMode;
-        FrameInfo outputFrameInfo;
 
         inputFrameInfo.frameType = HWC_FRAMETYPE_FRAME_BUFFER;
         inputFrameInfo.contentWidth = blitTask->destRect.w;
@@ -1471,26 +1950,33 @@ bool VirtualDevice::queueColorConvert(hwc_display_contents_1_t *display)
         outputFrameInfo.chromaVStride = dataBuf->getWidth();
         mgr->unlockDataBuffer(dataBuf);
 
-        if (!mIsForceCloneMode)
-            queueFrameTypeInfo(inputFrameInfo);
-
-        if (mCurrentConfig.policy.scaledWidth == 0 || mCurrentConfig.policy.scaledHeight == 0)
-            return true; // This isn't a failure, WiDi just doesn't want frames right now.
-        queueBufferInfo(outputFrameInfo);
-
-        if (mCurrentConfig.frameListener != NULL) {
+        if (wantFrames && mCurrentConfig.frameListener != NULL) {
+            // run by the blit task once the GPU has finished the frame
             frameReadyTask = new OnFrameReadyTask();
-            frameReadyTask->renderTask = blitTask;
             frameReadyTask->heldBuffer = heldBuffer;
             frameReadyTask->frameListener = mCurrentConfig.frameListener;
             frameReadyTask->handle = blitTask->destHandle;
             frameReadyTask->handleType = HWC_HANDLE_TYPE_GRALLOC;
             frameReadyTask->renderTimestamp = mRenderTimestamp;
             frameReadyTask->mediaTimestamp = -1;
-            mTasks.push_back(frameReadyTask);
+            blitTask->frameReadyTask = frameReadyTask;
         }
     }
 #endif
+
+    frameQueued(blitTask.get());
+    PrepareLock _l(*this);
+#ifdef INTEL_WIDI
+    // the frame is delivered from the completion thread, see queueCompose()
+    if (mCurrentConfig.frameServerActive) {
+        if (!mIsForceCloneMode)
+            queueFrameTypeInfo(inputFrameInfo);
+        if (wantFrames)
+            queueBufferInfo(outputFrameInfo);
+    }
+#endif
+    mTasks.push_back(blitTask);
+    mRequestQueued.signal();
     return true;
 }
 #ifdef INTEL_WIDI
@@ -1526,11 +2012,10 @@ bool VirtualDevice::handleExtendedMode(hwc_display_contents_1_t *display)
         inputFrameInfo.contentWidth = metadata.normalBuffer.width;
         inputFrameInfo.contentHeight = metadata.normalBuffer.height;
     } else {
+        // 90 and 270 are served from the decoder rotation buffer, which
+        // already holds the frame in display orientation
         inputFrameInfo.contentWidth = metadata.normalBuffer.height;
         inputFrameInfo.contentHeight = metadata.normalBuffer.width;
-        // 90 and 270 have some issues that appear to be decoder bugs
-        ITRACE("Skipping extended mode due to rotation of 90 or 270");
-        return false;
     }
     // Use the crop size if something changed derive it again..
     // Only get video source info if frame rate has not been initialized.
@@ -1544,7 +2029,7 @@ bool VirtualDevice::handleExtendedMode(hwc_display_contents_1_t *display)
         mOrigContentHeight = metadata.normalBuffer.height;
 
         // For the first video session by default
-        int sessionID = Hwcomposer::getInstance().getDisplayAnalyzer()->getFirstVideoInstanceSessionID();
+        int sessionID = mHwc.getAnalyzerState().firstVideoSessionID;
         if (sessionID >= 0) {
             ITRACE("Session id = %d", sessionID);
             VideoSourceInfo videoInfo;
@@ -1565,7 +2050,7 @@ bool VirtualDevice::handleExtendedMode(hwc_display_contents_1_t *display)
 
     sp<ComposeTask> composeTask;
     sp<RefBase> heldBuffer;
-    Mutex::Autolock _l(mTaskLock);
+    PrepareLock _l(*this);
 
     if (mCurrentConfig.policy.scaledWidth == 0 || mCurrentConfig.policy.scaledHeight == 0) {
         queueFrameTypeInfo(inputFrameInfo);
@@ -1578,6 +2063,27 @@ bool VirtualDevice::handleExtendedMode(hwc_display_contents_1_t *display)
         return false;
     }
 
+    if (metadata.transform == HAL_TRANSFORM_ROT_90 || metadata.transform == HAL_TRANSFORM_ROT_270) {
+        // The rotation buffer is sometimes published before the decoder
+        // has rotated into it, with the unrotated geometry. The crop is
+        // always derived rotated from the video size, so check it against
+        // the rotated buffer size and stride the payload reports. Don't
+        // stream such frames, composition handles them until the buffer
+        // settles.
+        bool unrotated = info.width != info.height &&
+                         (info.bufWidth > info.bufHeight) != (info.width > info.height);
+        if (unrotated ||
+            info.offsetX + info.width > info.bufWidth ||
+            info.offsetY + info.height > info.bufHeight ||
+            info.lumaStride < info.offsetX + info.width) {
+            ITRACE("Rotation buffer %ux%u stride %u doesn't hold %ux%u+%u+%u crop of %ux%u video, not sending frame",
+                    info.bufWidth, info.bufHeight, info.lumaStride,
+                    info.width, info.height, info.offsetX, info.offsetY,
+                    metadata.normalBuffer.width, metadata.normalBuffer.height);
+            return false;
+        }
+    }
+
     queueFrameTypeInfo(inputFrameInfo);
 
     heldBuffer = new HeldDecoderBuffer(this, cachedBuffer);
@@ -1642,13 +2148,21 @@ bool VirtualDevice::handleExtendedMode(hwc_display_contents_1_t *display)
         // Cropping (or above workaround) needed, so use VSP to do it.
         mVspInUse = true;
         vspPrepare(info.width, info.height);
+        if (mSoftCompose) {
+            // only known once VSP was brought up. Rotated frames are
+            // normalized by VSP, and the CPU fallback can't read the
+            // rotation buffer, so send the clone with its UI instead
+            mExtLastKhandle = 0;
+            return false;
+        }
 
         composeTask = new ComposeTask();
         composeTask->heldVideoBuffer = heldBuffer;
         heldBuffer = NULL;
         composeTask->outWidth = info.width;
         composeTask->outHeight = info.height;
-        composeTask->outputHandle = mCscBuffers.get(composeTask->outWidth, composeTask->outHeight, &heldBuffer);
+        composeTask->outputHandle = mCscBuffers.get(composeTask->outWidth, composeTask->outHeight, &heldBuffer,
+                                                    &composeTask->outputStride, &composeTask->outputBufHeight);
         if (composeTask->outputHandle == NULL) {
             ITRACE("Out of CSC buffers, dropping frame");
             return true;
@@ -1766,6 +2280,172 @@ void VirtualDevice::colorSwap(buffer_handle_t src, buffer_handle_t dest, uint32_
     }
 }
 
+void VirtualDevice::waitRequestDequeued()
+{
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    mRequestDequeued.wait(mTaskLock);
+    mPrepareLockWaited += systemTime(SYSTEM_TIME_MONOTONIC) - start;
+}
+
+bool VirtualDevice::admitFrame()
+{
+    bool redraw = false;
+    {
+        Mutex::Autolock _l(mAdmissionLock);
+        if (admitPaced())
+            return admitLoaded();
+        // the skipped content is composed again with the next frame slot,
+        // right away when nothing is pending to retire and trigger it
+        mFramesPaced++;
+        if (mFramesPending > 0)
+            mRedrawPending = true;
+        else
+            redraw = true;
+    }
+    if (redraw)
+        mHwc.invalidate();
+    return false;
+}
+
+bool VirtualDevice::admitPaced()
+{
+    uint32_t divider = sAdaptRateDividers[mAdaptLevel];
+    if (divider == 1) {
+        mAdaptFrameCount = 0;
+        return true;
+    }
+    return mAdaptFrameCount++ % divider == 0;
+}
+
+bool VirtualDevice::admitLoaded()
+{
+#ifdef INTEL_WIDI
+    uint32_t refresh = mCurrentConfig.policy.refresh;
+#else
+    uint32_t refresh = 0;
+#endif
+    if (refresh == 0)
+        refresh = 60;
+    mFramePeriod = seconds_to_nanoseconds(1) / refresh;
+    if (mFramesPending == 0)
+        return true;
+
+    nsecs_t deadline = mFramePeriod * FRAME_DEADLINE_PERIODS;
+    // frames already pending are serviced before this one
+    nsecs_t expected = mFrameServiceTime * (mFramesPending + 1);
+    if (mFramesPending < MAX_FRAMES_PENDING && expected <= deadline)
+        return true;
+
+    VTRACE("Dropping frame, %u pending, expected in %lldus, deadline %lldus",
+            mFramesPending, (long long)(expected / 1000), (long long)(deadline / 1000));
+    mFramesDropped++;
+    mFramesDroppedBurst++;
+    mAdaptWindowDropped++;
+    mRedrawPending = true;
+    return false;
+}
+
+void VirtualDevice::frameDropped()
+{
+    Mutex::Autolock _l(mAdmissionLock);
+    mFramesDropped++;
+    mFramesDroppedBurst++;
+    mAdaptWindowDropped++;
+    mRedrawPending = true;
+}
+
+void VirtualDevice::frameQueued(RenderTask *task)
+{
+    Mutex::Autolock _l(mAdmissionLock);
+    task->admission = this;
+    task->queuedTime = systemTime(SYSTEM_TIME_MONOTONIC);
+    mFramesPending++;
+    mFramesQueued++;
+}
+
+void VirtualDevice::frameRetired(nsecs_t queuedTime)
+{
+    bool redraw = false;
+    {
+        Mutex::Autolock _l(mAdmissionLock);
+        nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+        // a frame keeps the pipeline busy from when it was queued or the
+        // previous one was done, whichever is later
+        nsecs_t start = queuedTime > mLastFrameRetired ? queuedTime : mLastFrameRetired;
+        nsecs_t service = now - start;
+        if (mFrameServiceTime == 0)
+            mFrameServiceTime = service;
+        else
+            mFrameServiceTime += (service - mFrameServiceTime) / 8;
+        mLastFrameRetired = now;
+        if (mAdaptWindowMaxPending < mFramesPending)
+            mAdaptWindowMaxPending = mFramesPending;
+        if (mFramesPending > 0)
+            mFramesPending--;
+        mAdaptWindowFrames++;
+        mAdaptWindowLatency += now - queuedTime;
+        adaptEvaluate(now);
+        if (mFramesPending == 0 && mRedrawPending) {
+            ITRACE("WiDi caught up after dropping %u frames", mFramesDroppedBurst);
+            mRedrawPending = false;
+            mFramesDroppedBurst = 0;
+            redraw = true;
+        }
+    }
+    // the newest content was dropped, have it composed again
+    if (redraw)
+        mHwc.invalidate();
+}
+
+void VirtualDevice::adaptEvaluate(nsecs_t now)
+{
+    if (mAdaptWindowStart == 0)
+        mAdaptWindowStart = now;
+    if (now - mAdaptWindowStart < ADAPT_WINDOW)
+        return;
+
+    nsecs_t latency = mAdaptWindowFrames ? mAdaptWindowLatency / mAdaptWindowFrames : 0;
+    mAdaptLatency = latency;
+    // thresholds are far apart so a level that just fits doesn't flap
+    bool overloaded = mAdaptWindowDropped > 0 ||
+                      latency > mFramePeriod * 3 / 2 ||
+                      mAdaptWindowMaxPending >= MAX_FRAMES_PENDING;
+    bool quiet = mAdaptWindowDropped == 0 &&
+                 latency < mFramePeriod / 2 &&
+                 mAdaptWindowMaxPending <= 1;
+
+    uint32_t level = mAdaptLevel;
+    if (!mAdaptEnabled) {
+        level = 0;
+        mAdaptQuietWindows = 0;
+    } else if (overloaded) {
+        mAdaptQuietWindows = 0;
+        if (level < ADAPT_LEVELS - 1)
+            level++;
+    } else if (quiet && level > 0) {
+        if (++mAdaptQuietWindows >= ADAPT_UP_WINDOWS) {
+            mAdaptQuietWindows = 0;
+            level--;
+        }
+    } else {
+        mAdaptQuietWindows = 0;
+    }
+
+    if (level != mAdaptLevel) {
+        ITRACE("WiDi cost level %u -> %u, latency %lldus, max pending %u, dropped %u",
+                mAdaptLevel, level, (long long)(latency / 1000),
+                mAdaptWindowMaxPending, mAdaptWindowDropped);
+        mAdaptLevel = level;
+        mAdaptSteps++;
+    }
+
+    mAdaptWindowStart = now;
+    mAdaptWindowFrames = 0;
+    mAdaptWindowLatency = 0;
+    mAdaptWindowMaxPending = 0;
+    mAdaptWindowDropped = 0;
+}
+
 void VirtualDevice::vspPrepare(uint32_t width, uint32_t height)
 {
     if (mVspEnabled && width == mVspWidth && height == mVspHeight)
@@ -1774,7 +2454,8 @@ void VirtualDevice::vspPrepare(uint32_t width, uint32_t height)
     if (mVspEnabled)
     {
         ITRACE("Going to switch VSP from %ux%u to %ux%u", mVspWidth, mVspHeight, width, height);
-        mMappedBufferCache.clear();
+        // VA display outlives the switch, so video mappings stay valid,
+        // RGB mappings are made at the output size
         mVaMapCache.clear();
         sp<DisableVspTask> disableVsp = new DisableVspTask();
         mTasks.push_back(disableVsp);
@@ -1782,31 +2463,45 @@ void VirtualDevice::vspPrepare(uint32_t width, uint32_t height)
     mVspWidth = width;
     mVspHeight = height;
 
+    // size the blank video input for the largest output seen or decoded,
+    // so switching back and forth does not reallocate it
+    if (width > mVspMaxWidth)
+        mVspMaxWidth = width;
+    if (height > mVspMaxHeight)
+        mVspMaxHeight = height;
+    if (mDecWidth > mVspMaxWidth)
+        mVspMaxWidth = mDecWidth;
+    if (mDecHeight > mVspMaxHeight)
+        mVspMaxHeight = mDecHeight;
+
     sp<EnableVspTask> enableTask = new EnableVspTask();
     enableTask->width = width;
     enableTask->height = height;
+    enableTask->capacityWidth = mVspMaxWidth;
+    enableTask->capacityHeight = mVspMaxHeight;
     mTasks.push_back(enableTask);
     mRequestQueued.signal();
     // to map a buffer from this thread, we need this task to complete on the other thread
     while (enableTask->getStrongCount() > 1) {
         VTRACE("Waiting for WidiBlit thread to enable VSP...");
-        mRequestDequeued.wait(mTaskLock);
+        waitRequestDequeued();
     }
     mVspEnabled = true;
 }
 
-void VirtualDevice::vspEnable(uint32_t width, uint32_t height)
+bool VirtualDevice::vspInitDisplay()
 {
-    width = align_width(width);
-    height = align_height(height);
-    ITRACE("Start VSP at %ux%u", width, height);
     VAStatus va_status;
 
     int display = 0;
     int major_ver, minor_ver;
     va_dpy = vaGetDisplay(&display);
     va_status = vaInitialize(va_dpy, &major_ver, &minor_ver);
-    if (va_status != VA_STATUS_SUCCESS) ETRACE("vaInitialize returns %08x", va_status);
+    if (va_status != VA_STATUS_SUCCESS) {
+        ETRACE("vaInitialize returns %08x", va_status);
+        va_dpy = NULL;
+        return false;
+    }
 
     VAConfigAttrib va_attr;
     va_attr.type = VAConfigAttribRTFormat;
@@ -1833,17 +2528,51 @@ void VirtualDevice::vspEnable(uint32_t width, uint32_t height)
     va_status = vaSetDisplayAttributes(va_dpy, &attr, 1);
     if (va_status != VA_STATUS_SUCCESS) ETRACE("vaSetDisplayAttributes returns %08x", va_status);
 
+    return true;
+}
 
-    va_status = vaCreateSurfaces(
-                va_dpy,
-                VA_RT_FORMAT_YUV420,
-                width,
-                height,
-                &va_blank_yuv_in,
-                1,
-                NULL,
-                0);
-    if (va_status != VA_STATUS_SUCCESS) ETRACE("vaCreateSurfaces (video in) returns %08x", va_status);
+void VirtualDevice::vspEnable(uint32_t width, uint32_t height,
+                              uint32_t capacityWidth, uint32_t capacityHeight)
+{
+    width = align_width(width);
+    height = align_height(height);
+    capacityWidth = align_width(capacityWidth > width ? capacityWidth : width);
+    capacityHeight = align_height(capacityHeight > height ? capacityHeight : height);
+    ITRACE("Start VSP at %ux%u", width, height);
+    VAStatus va_status;
+
+    mSoftCompose = false;
+    mVspBlankIdle = false;
+    // display and config are kept across sessions and resolution changes
+    if (mForceSoftCompose || (va_dpy == NULL && !vspInitDisplay())) {
+        softComposeEnable();
+        return;
+    }
+
+    if (va_blank_yuv_in != 0 &&
+        (width > mVspBlankWidth || height > mVspBlankHeight)) {
+        ITRACE("Blank video input %ux%u too small", mVspBlankWidth, mVspBlankHeight);
+        va_status = vaDestroySurfaces(va_dpy, &va_blank_yuv_in, 1);
+        if (va_status != VA_STATUS_SUCCESS) ETRACE("vaDestroySurfaces (video in) returns %08x", va_status);
+        va_blank_yuv_in = 0;
+    }
+
+    if (va_blank_yuv_in == 0) {
+        va_status = vaCreateSurfaces(
+                    va_dpy,
+                    VA_RT_FORMAT_YUV420,
+                    capacityWidth,
+                    capacityHeight,
+                    &va_blank_yuv_in,
+                    1,
+                    NULL,
+                    0);
+        if (va_status != VA_STATUS_SUCCESS) ETRACE("vaCreateSurfaces (video in) returns %08x", va_status);
+        mVspBlankWidth = capacityWidth;
+        mVspBlankHeight = capacityHeight;
+        mVspBlankFilledWidth = 0;
+        mVspBlankFilledHeight = 0;
+    }
 
     unsigned long buffer;
     VASurfaceAttribExternalBuffers buf;
@@ -1897,55 +2626,68 @@ void VirtualDevice::vspEnable(uint32_t width, uint32_t height)
                 &va_blank_yuv_in /* not used by VSP, but libva checks for it */,
                 1,
                 &va_context);
-    if (va_status != VA_STATUS_SUCCESS) ETRACE("vaCreateContext returns %08x", va_status);
+    if (va_status != VA_STATUS_SUCCESS) {
+        ETRACE("vaCreateContext returns %08x", va_status);
+        // vspDisable() only tears down a running context
+        va_context = 0;
+        va_status = vaDestroySurfaces(va_dpy, &va_blank_rgb_in, 1);
+        if (va_status != VA_STATUS_SUCCESS) ETRACE("vaDestroySurfaces (blank rgba in) returns %08x", va_status);
+        va_blank_rgb_in = 0;
+        softComposeEnable();
+        return;
+    }
 
-    VASurfaceID tmp_yuv;
-    va_status = vaCreateSurfaces(
-                va_dpy,
-                VA_RT_FORMAT_YUV420,
-                stride,
-                bufHeight,
-                &tmp_yuv,
-                1,
-                NULL,
-                0);
-    if (va_status != VA_STATUS_SUCCESS) ETRACE("vaCreateSurfaces (temp yuv) returns %08x", va_status);
-    {
-        MappedSurface mappedVideoIn(va_dpy, tmp_yuv);
-        if (mappedVideoIn.valid()) {
-            // Value doesn't matter, as RGBA will be opaque,
-            // but I don't want random data in here.
-            memset(mappedVideoIn.getPtr(), 0x0, width*height*3/2);
+    if (width > mVspBlankFilledWidth || height > mVspBlankFilledHeight) {
+        VASurfaceID tmp_yuv;
+        va_status = vaCreateSurfaces(
+                    va_dpy,
+                    VA_RT_FORMAT_YUV420,
+                    stride,
+                    bufHeight,
+                    &tmp_yuv,
+                    1,
+                    NULL,
+                    0);
+        if (va_status != VA_STATUS_SUCCESS) ETRACE("vaCreateSurfaces (temp yuv) returns %08x", va_status);
+        {
+            MappedSurface mappedVideoIn(va_dpy, tmp_yuv);
+            if (mappedVideoIn.valid()) {
+                // Value doesn't matter, as RGBA will be opaque,
+                // but I don't want random data in here.
+                memset(mappedVideoIn.getPtr(), 0x0, width*height*3/2);
+            }
+            else
+                ETRACE("Unable to map tmp black surface");
         }
-        else
-            ETRACE("Unable to map tmp black surface");
-    }
 
-    {
-        MappedSurface mappedBlankIn(va_dpy, va_blank_rgb_in);
-        if (mappedBlankIn.valid()) {
-            // Fill RGBA with opaque black temporarily, in order to generate an
-            // encrypted black buffer in va_blank_yuv_in to use in place of the
-            // real frame data during the short interval where we're waiting for
-            // downscaling to kick in.
-            uint32_t* pixels = reinterpret_cast<uint32_t*>(mappedBlankIn.getPtr());
-            for (size_t i = 0; i < stride*height; i++)
-                pixels[i] = 0xff000000;
+        {
+            MappedSurface mappedBlankIn(va_dpy, va_blank_rgb_in);
+            if (mappedBlankIn.valid()) {
+                // Fill RGBA with opaque black temporarily, in order to generate an
+                // encrypted black buffer in va_blank_yuv_in to use in place of the
+                // real frame data during the short interval where we're waiting for
+                // downscaling to kick in.
+                uint32_t* pixels = reinterpret_cast<uint32_t*>(mappedBlankIn.getPtr());
+                for (size_t i = 0; i < stride*height; i++)
+                    pixels[i] = 0xff000000;
+            }
+            else
+                ETRACE("Unable to map blank rgba in");
         }
-        else
-            ETRACE("Unable to map blank rgba in");
-    }
 
-    // Compose opaque black with temp yuv to produce encrypted black yuv.
-    VARectangle region;
-    region.x = 0;
-    region.y = 0;
-    region.width = width;
-    region.height = height;
-    vspCompose(tmp_yuv, va_blank_rgb_in, va_blank_yuv_in, &region, &region);
+        // Compose opaque black with temp yuv to produce encrypted black yuv.
+        VARectangle region;
+        region.x = 0;
+        region.y = 0;
+        region.width = width;
+        region.height = height;
+        vspCompose(tmp_yuv, va_blank_rgb_in, va_blank_yuv_in, &region, &region);
+        mVspBlankFilledWidth = width;
+        mVspBlankFilledHeight = height;
 
-    va_status = vaDestroySurfaces(va_dpy, &tmp_yuv, 1);
-    if (va_status != VA_STATUS_SUCCESS) ETRACE("vaDestroySurfaces (temp yuv) returns %08x", va_status);
+        va_status = vaDestroySurfaces(va_dpy, &tmp_yuv, 1);
+        if (va_status != VA_STATUS_SUCCESS) ETRACE("vaDestroySurfaces (temp yuv) returns %08x", va_status);
+    }
 
     {
         // Fill RGBA with transparent black now, to be used when there is no
@@ -1958,11 +2700,22 @@ void VirtualDevice::vspEnable(uint32_t width, uint32_t height)
     }
 }
 
+void VirtualDevice::softComposeEnable()
+{
+    WTRACE("VSP unavailable, composing on the CPU");
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t threads = SOFT_COMPOSE_THREADS;
+    if (cpus > 0 && cpus < SOFT_COMPOSE_THREADS)
+        threads = cpus;
+    mSoftCompositor.initialize(threads);
+    mSoftCompose = true;
+}
+
 void VirtualDevice::vspDisable()
 {
     ITRACE("Shut down VSP");
 
-    if (va_context == 0 && va_blank_yuv_in == 0) {
+    if (va_context == 0) {
         ITRACE("Already shut down");
         return;
     }
@@ -2002,49 +2755,101 @@ void VirtualDevice::vspDisable()
     va_status = vaEndPicture(va_dpy, va_context);
     if (va_status != VA_STATUS_SUCCESS) ETRACE("vaEndPicture returns %08x", va_status);
 
+    for (int i = 0; i < VSP_PIPELINE_DEPTH; i++) {
+        if (mVspParamBuffers[i] == VA_INVALID_ID)
+            continue;
+        va_status = vaDestroyBuffer(va_dpy, mVspParamBuffers[i]);
+        if (va_status != VA_STATUS_SUCCESS) ETRACE("vaDestroyBuffer returns %08x", va_status);
+        mVspParamBuffers[i] = VA_INVALID_ID;
+    }
+    mVspNextParamBuffer = 0;
+
     va_status = vaDestroyContext(va_dpy, va_context);
     if (va_status != VA_STATUS_SUCCESS) ETRACE("vaDestroyContext returns %08x", va_status);
     va_context = 0;
 
-    va_status = vaDestroySurfaces(va_dpy, &va_blank_yuv_in, 1);
+    va_status = vaDestroySurfaces(va_dpy, &va_blank_rgb_in, 1);
+    if (va_status != VA_STATUS_SUCCESS) ETRACE("vaDestroySurfaces (blank rgba in) returns %08x", va_status);
+    va_blank_rgb_in = 0;
+
+    // display, config and the blank video input stay warm for the next
+    // session or resolution, the blank input only for a while
+    mVspBlankIdle = (va_blank_yuv_in != 0);
+}
+
+void VirtualDevice::vspReleaseBlank()
+{
+    mVspBlankIdle = false;
+    if (va_blank_yuv_in == 0)
+        return;
+
+    ITRACE("Release %ux%u blank video input", mVspBlankWidth, mVspBlankHeight);
+    VAStatus va_status = vaDestroySurfaces(va_dpy, &va_blank_yuv_in, 1);
     if (va_status != VA_STATUS_SUCCESS) ETRACE("vaDestroySurfaces (video in) returns %08x", va_status);
     va_blank_yuv_in = 0;
+    mVspBlankWidth = 0;
+    mVspBlankHeight = 0;
+    mVspBlankFilledWidth = 0;
+    mVspBlankFilledHeight = 0;
+}
 
-    va_status = vaDestroySurfaces(va_dpy, &va_blank_rgb_in, 1);
-    if (va_status != VA_STATUS_SUCCESS) ETRACE("vaDestroySurfaces (blank rgba in) returns %08x", va_status);
+void VirtualDevice::vspTerminate()
+{
+    vspDisable();
+    vspReleaseBlank();
 
-    if (va_config) {
-        vaDestroyConfig(va_dpy, va_config);
-        va_config = 0;
-    }
-    if (va_dpy) {
-        vaTerminate(va_dpy);
-        va_dpy = NULL;
-    }
+    if (va_dpy == NULL)
+        return;
+
+    VAStatus va_status = vaDestroyConfig(va_dpy, va_config);
+    if (va_status != VA_STATUS_SUCCESS) ETRACE("vaDestroyConfig returns %08x", va_status);
+    va_config = 0;
+
+    va_status = vaTerminate(va_dpy);
+    if (va_status != VA_STATUS_SUCCESS) ETRACE("vaTerminate returns %08x", va_status);
+    va_dpy = NULL;
+    mVspEnabled = false;
 }
 
-void VirtualDevice::vspCompose(VASurfaceID videoIn, VASurfaceID rgbIn, VASurfaceID videoOut,
-                               const VARectangle* surface_region, const VARectangle* output_region)
+bool VirtualDevice::vspSubmit(VASurfaceID videoIn, VASurfaceID rgbIn, VASurfaceID videoOut,
+                              const VARectangle* surface_region, const VARectangle* output_region)
 {
     VAStatus va_status;
 
-    VABufferID pipeline_param_id;
-    va_status = vaCreateBuffer(va_dpy,
-                va_context,
-                VAProcPipelineParameterBufferType,
-                sizeof(VAProcPipelineParameterBuffer),
-                1,
-                NULL,
-                &pipeline_param_id);
-    if (va_status != VA_STATUS_SUCCESS) ETRACE("vaCreateBuffer returns %08x", va_status);
-
-    VABlendState blend_state;
+    // parameter buffers are reused round robin, so the frame that last
+    // used the next one must have completed
+    vspWaitInFlight(VSP_PIPELINE_DEPTH - 1);
+    int slot = mVspNextParamBuffer;
+    mVspNextParamBuffer = (mVspNextParamBuffer + 1) % VSP_PIPELINE_DEPTH;
+
+    VABufferID& pipeline_param_id = mVspParamBuffers[slot];
+    if (pipeline_param_id == VA_INVALID_ID) {
+        va_status = vaCreateBuffer(va_dpy,
+                    va_context,
+                    VAProcPipelineParameterBufferType,
+                    sizeof(VAProcPipelineParameterBuffer),
+                    1,
+                    NULL,
+                    &pipeline_param_id);
+        if (va_status != VA_STATUS_SUCCESS) {
+            ETRACE("vaCreateBuffer returns %08x", va_status);
+            pipeline_param_id = VA_INVALID_ID;
+            return false;
+        }
+    }
 
     VAProcPipelineParameterBuffer *pipeline_param;
     va_status = vaMapBuffer(va_dpy,
                 pipeline_param_id,
                 (void **)&pipeline_param);
-    if (va_status != VA_STATUS_SUCCESS) ETRACE("vaMapBuffer returns %08x", va_status);
+    if (va_status != VA_STATUS_SUCCESS) {
+        ETRACE("vaMapBuffer returns %08x", va_status);
+        return false;
+    }
+
+    // referenced by the parameter buffer, must outlive the frame
+    memset(&mVspBlendStates[slot], 0, sizeof(VABlendState));
+    mVspAdditionalOutputs[slot] = rgbIn;
 
     memset(pipeline_param, 0, sizeof(VAProcPipelineParameterBuffer));
     pipeline_param->surface = videoIn;
@@ -2053,13 +2858,14 @@ void VirtualDevice::vspCompose(VASurfaceID videoIn, VASurfaceID rgbIn, VASurface
 
     pipeline_param->pipeline_flags = 0;
     pipeline_param->num_filters = 0;
-    pipeline_param->blend_state = &blend_state;
+    pipeline_param->blend_state = &mVspBlendStates[slot];
     pipeline_param->num_additional_outputs = 1;
-    pipeline_param->additional_outputs = &rgbIn;
+    pipeline_param->additional_outputs = &mVspAdditionalOutputs[slot];
 
     va_status = vaUnmapBuffer(va_dpy, pipeline_param_id);
     if (va_status != VA_STATUS_SUCCESS) ETRACE("vaUnmapBuffer returns %08x", va_status);
 
+    Mutex::Autolock _l(mVspContextLock);
     va_status = vaBeginPicture(va_dpy, va_context, videoOut);
     if (va_status != VA_STATUS_SUCCESS) ETRACE("vaBeginPicture returns %08x", va_status);
 
@@ -2067,12 +2873,83 @@ void VirtualDevice::vspCompose(VASurfaceID videoIn, VASurfaceID rgbIn, VASurface
     if (va_status != VA_STATUS_SUCCESS) ETRACE("vaRenderPicture returns %08x", va_status);
 
     va_status = vaEndPicture(va_dpy, va_context);
-    if (va_status != VA_STATUS_SUCCESS) ETRACE("vaEndPicture returns %08x", va_status);
+    if (va_status != VA_STATUS_SUCCESS) {
+        ETRACE("vaEndPicture returns %08x", va_status);
+        return false;
+    }
+    return true;
+}
 
-    va_status = vaSyncSurface(va_dpy, videoOut);
+void VirtualDevice::vspSyncSurface(VASurfaceID surface)
+{
+    // only waits for the surface to be rendered and doesn't touch the
+    // context, so WidiBlit keeps submitting while this thread blocks
+    VAStatus va_status = vaSyncSurface(va_dpy, surface);
     if (va_status != VA_STATUS_SUCCESS) ETRACE("vaSyncSurface returns %08x", va_status);
 }
 
+void VirtualDevice::vspCompose(VASurfaceID videoIn, VASurfaceID rgbIn, VASurfaceID videoOut,
+                               const VARectangle* surface_region, const VARectangle* output_region)
+{
+    if (!vspSubmit(videoIn, rgbIn, videoOut, surface_region, output_region))
+        return;
+
+    vspSyncSurface(videoOut);
+}
+
+void VirtualDevice::vspQueueCompletion(const sp<RenderTask>& task)
+{
+    Mutex::Autolock _l(mVspLock);
+    mVspInFlight.push_back(task);
+    mVspFramesInFlight++;
+    mVspSubmitted.signal();
+}
+
+void VirtualDevice::vspWaitInFlight(uint32_t count)
+{
+    Mutex::Autolock _l(mVspLock);
+    while (mVspFramesInFlight > count) {
+        mVspCompleted.wait(mVspLock);
+    }
+}
+
+uint32_t VirtualDevice::vspFramesInFlight()
+{
+    Mutex::Autolock _l(mVspLock);
+    return mVspFramesInFlight;
+}
+
+bool VirtualDevice::vspCompletionLoop()
+{
+    sp<RenderTask> task;
+    {
+        Mutex::Autolock _l(mVspLock);
+        while (mVspInFlight.empty()) {
+            if (mVspCompletionExit)
+                return false;
+            mVspSubmitted.wait(mVspLock);
+        }
+        task = *mVspInFlight.begin();
+        mVspInFlight.erase(mVspInFlight.begin());
+    }
+
+    task->finish(*this);
+    // release the output mapping and held buffers before the frame
+    // counts as done, VSP may be torn down right after
+    task = NULL;
+
+    // prepare waits for free buffers with mTaskLock held, checking
+    // vspFramesInFlight() first, so the count drops under both locks
+    Mutex::Autolock _t(mTaskLock);
+    {
+        Mutex::Autolock _l(mVspLock);
+        mVspFramesInFlight--;
+        mVspCompleted.broadcast();
+    }
+    mRequestDequeued.signal();
+    return true;
+}
+
 static uint32_t min(uint32_t a, uint32_t b)
 {
     return (a < b) ? a : b;
@@ -2110,7 +2987,7 @@ void VirtualDevice::setMaxDecodeResolution(uint32_t width, uint32_t height)
     if (mDecWidth == width && mDecHeight == height)
         return;
 
-    int sessionID = mHwc.getDisplayAnalyzer()->getFirstVideoInstanceSessionID();
+    int sessionID = mHwc.getAnalyzerState().firstVideoSessionID;
     if (sessionID < 0) {
         ETRACE("Session id is less than 0");
         return;
@@ -2249,6 +3126,36 @@ bool VirtualDevice::initialize()
     mNextSyncPoint = 1;
     mExpectAcquireFences = false;
 
+    for (int i = 0; i < VSP_PIPELINE_DEPTH; i++)
+        mVspParamBuffers[i] = VA_INVALID_ID;
+    mVspNextParamBuffer = 0;
+    mVspFramesInFlight = 0;
+    mVspCompletionExit = false;
+    mFramesPending = 0;
+    mFrameServiceTime = 0;
+    mLastFrameRetired = 0;
+    mFramesQueued = 0;
+    mFramesDropped = 0;
+    mFramesDroppedBurst = 0;
+    mRedrawPending = false;
+    mFramePeriod = seconds_to_nanoseconds(1) / 60;
+    mAdaptEnabled = true;
+    mAdaptLevel = 0;
+    mAdaptQuietWindows = 0;
+    mAdaptSteps = 0;
+    mAdaptFrameCount = 0;
+    mFramesPaced = 0;
+    mAdaptWindowStart = 0;
+    mAdaptWindowFrames = 0;
+    mAdaptWindowLatency = 0;
+    mAdaptWindowMaxPending = 0;
+    mAdaptWindowDropped = 0;
+    mAdaptLatency = 0;
+    mVspCompletionThread = new VspCompletionThread(this);
+    mVspCompletionThread->run("WidiVspComplete", PRIORITY_URGENT_DISPLAY);
+
+    mThreadExit = false;
+    mVspBlankIdle = false;
     mThread = new WidiBlitThread(this);
     mThread->run("WidiBlit", PRIORITY_URGENT_DISPLAY);
 
@@ -2274,6 +3181,15 @@ bool VirtualDevice::initialize()
     va_context = 0;
     va_blank_yuv_in = 0;
     va_blank_rgb_in = 0;
+    mVspMaxWidth = 0;
+    mVspMaxHeight = 0;
+    mVspBlankWidth = 0;
+    mVspBlankHeight = 0;
+    mVspBlankFilledWidth = 0;
+    mVspBlankFilledHeight = 0;
+    mSoftCompose = false;
+    mSoftBlackVideo = 0;
+    mForceSoftCompose = false;
     mVspUpscale = false;
     mDebugVspClear = false;
     mDebugVspDump = false;
@@ -2306,17 +3222,73 @@ void VirtualDevice::onVsync(int64_t timestamp)
 
 void VirtualDevice::dump(Dump& d)
 {
+    // outside mTaskLock, a frame being composed holds the compositor
+    mSoftCompositor.dump(d);
+    d.append("  frames with black video: %d\n", android_atomic_acquire_load(&mSoftBlackVideo));
+
+    Mutex::Autolock _l(mTaskLock);
+    nsecs_t avg = mPrepareLockHolds ? mPrepareLockHeldTotal / mPrepareLockHolds : 0;
+    d.append("Virtual display task lock (prepare path):\n");
+    d.append("  holds %u, avg %lldus, max %lldus, blit waits %lldus\n",
+             mPrepareLockHolds, (long long)(avg / 1000),
+             (long long)(mPrepareLockHeldMax / 1000),
+             (long long)(mPrepareLockWaited / 1000));
+
+    Mutex::Autolock _a(mAdmissionLock);
+    d.append("Virtual display frames:\n");
+    d.append("  queued %u, dropped %u, pending %u, service time %lldus\n",
+             mFramesQueued, mFramesDropped, mFramesPending,
+             (long long)(mFrameServiceTime / 1000));
+    d.append("  cost level %u (1/%u rate)%s, steps %u, paced %u, latency %lldus\n",
+             mAdaptLevel, sAdaptRateDividers[mAdaptLevel],
+             mAdaptEnabled ? "" : " disabled", mAdaptSteps, mFramesPaced,
+             (long long)(mAdaptLatency / 1000));
 }
 
 void VirtualDevice::deinitialize()
 {
     VAStatus va_status;
 
+    DEINIT_AND_DELETE_OBJ(mVsyncObserver);
+
+    // WidiBlit runs what is queued and may wait for the completion
+    // thread, so it stops first
+    if (mThread.get()) {
+        {
+            Mutex::Autolock _l(mTaskLock);
+            mThreadExit = true;
+            mRequestQueued.signal();
+        }
+        mThread->requestExitAndWait();
+        mThread = NULL;
+    }
+
+    if (mVspCompletionThread.get()) {
+        // the completion thread only exits once its queue is empty, so
+        // wait for the frames in flight to be completed first
+        vspWaitInFlight(0);
+        {
+            Mutex::Autolock _l(mVspLock);
+            mVspCompletionExit = true;
+            mVspSubmitted.signal();
+        }
+        mVspCompletionThread->requestExitAndWait();
+        mVspCompletionThread = NULL;
+    }
+
+    // no thread uses VA any more, release mappings before the display
+    // they were made on
+    mVaMapCache.clear();
+    mMappedBufferCache.clear();
+    mRgbUpscaleBuffers.clear();
+    vspTerminate();
+    mSoftCompositor.deinitialize();
+
+    // cached video buffers tell it when their mappers go
     if (mPayloadManager) {
         delete mPayloadManager;
         mPayloadManager = NULL;
     }
-    DEINIT_AND_DELETE_OBJ(mVsyncObserver);
     mInitialized = false;
 }
 
@@ -95,7 +95,13 @@ MultiDisplayObserver::MultiDisplayObserver()
       mLock(),
       mCondition(),
       mThreadLoopCount(0),
+      mThreadLoopDelay(THREAD_LOOP_DELAY),
+      mThreadLoopElapsed(0),
+      mThreadExit(false),
       mDeviceConnected(false),
+      mPendingHotplug(false),
+      mPendingWidi(false),
+      mPendingWidiConnected(false),
       mExternalHdmiTiming(false),
       mInitialized(false)
 {
@@ -127,6 +133,8 @@ bool MultiDisplayObserver::isMDSRunning()
 
 bool MultiDisplayObserver::initMDSClient()
 {
+    // binder transactions are issued without mLock held, the client
+    // proxies are only published under the lock once all are created
     sp<IServiceManager> sm = defaultServiceManager();
     if (sm == NULL) {
         ETRACE("Fail to get service manager");
@@ -138,48 +146,92 @@ bool MultiDisplayObserver::initMDSClient()
         ETRACE("Fail to get MDS service");
         return false;
     }
-    mMDSCbRegistrar = mds->getCallbackRegistrar();
-    if (mMDSCbRegistrar.get() == NULL) {
+    sp<IMultiDisplayCallbackRegistrar> cbRegistrar = mds->getCallbackRegistrar();
+    if (cbRegistrar.get() == NULL) {
         ETRACE("failed to create mds base Client");
         return false;
     }
 
-    mMDSCallback = new MultiDisplayCallback(this);
-    if (mMDSCallback.get() == NULL) {
+    sp<MultiDisplayCallback> callback = new MultiDisplayCallback(this);
+    if (callback.get() == NULL) {
         ETRACE("failed to create MultiDisplayCallback");
-        deinitMDSClient();
         return false;
     }
-    mMDSInfoProvider = mds->getInfoProvider();
-    if (mMDSInfoProvider.get() == NULL) {
+    sp<IMultiDisplayInfoProvider> infoProvider = mds->getInfoProvider();
+    if (infoProvider.get() == NULL) {
         ETRACE("failed to create mds video Client");
         return false;
     }
 
-    mMDSConnObserver = mds->getConnectionObserver();
-    if (mMDSConnObserver.get() == NULL) {
+    sp<IMultiDisplayConnectionObserver> connObserver = mds->getConnectionObserver();
+    if (connObserver.get() == NULL) {
         ETRACE("failed to create mds video Client");
         return false;
     }
-    mMDSDecoderConfig = mds->getDecoderConfig();
-    if (mMDSDecoderConfig.get() == NULL) {
+    sp<IMultiDisplayDecoderConfig> decoderConfig = mds->getDecoderConfig();
+    if (decoderConfig.get() == NULL) {
         ETRACE("failed to create mds decoder Client");
         return false;
     }
 
-    status_t ret = mMDSCbRegistrar->registerCallback(mMDSCallback);
+    status_t ret = cbRegistrar->registerCallback(callback);
     if (ret != NO_ERROR) {
         ETRACE("failed to register callback");
-        deinitMDSClient();
         return false;
     }
 
     Drm *drm = Hwcomposer::getInstance().getDrm();
-    mDeviceConnected = drm->isConnected(IDisplayDevice::DEVICE_EXTERNAL);
+    bool connected = drm->isConnected(IDisplayDevice::DEVICE_EXTERNAL);
+    {
+        // lock scope
+        Mutex::Autolock _l(mLock);
+        if (mThreadExit) {
+            // observer is being torn down while the client was created
+            cbRegistrar->unregisterCallback(callback);
+            return false;
+        }
+        mMDSCbRegistrar = cbRegistrar;
+        mMDSInfoProvider = infoProvider;
+        mMDSConnObserver = connObserver;
+        mMDSDecoderConfig = decoderConfig;
+        mMDSCallback = callback;
+        mDeviceConnected = connected;
+    }
     ITRACE("MDS client is initialized");
+
+    replayPendingNotifications();
     return true;
 }
 
+void MultiDisplayObserver::replayPendingNotifications()
+{
+    sp<IMultiDisplayConnectionObserver> connObserver;
+    bool hotplug, widi, widiConnected, connected;
+    {
+        // lock scope
+        Mutex::Autolock _l(mLock);
+        connObserver = mMDSConnObserver;
+        if (connObserver.get() == NULL) {
+            return;
+        }
+        hotplug = mPendingHotplug;
+        widi = mPendingWidi;
+        widiConnected = mPendingWidiConnected;
+        connected = mDeviceConnected;
+        mPendingHotplug = false;
+        mPendingWidi = false;
+    }
+
+    if (hotplug) {
+        ITRACE("replaying hdmi connection status %d", connected);
+        connObserver->updateHdmiConnectionStatus(connected);
+    }
+    if (widi) {
+        ITRACE("replaying widi connection status %d", widiConnected);
+        connObserver->updateWidiConnectionStatus(widiConnected);
+    }
+}
+
 void MultiDisplayObserver::deinitMDSClient()
 {
     if (mMDSCallback.get() && mMDSCbRegistrar.get()) {
@@ -187,6 +239,8 @@ void MultiDisplayObserver::deinitMDSClient()
     }
 
     mDeviceConnected = false;
+    mPendingHotplug = false;
+    mPendingWidi = false;
     mMDSCbRegistrar = NULL;
     mMDSInfoProvider = NULL;
     mMDSCallback = NULL;
@@ -207,6 +261,9 @@ bool MultiDisplayObserver::initMDSClientAsync()
         return false;
     }
     mThreadLoopCount = 0;
+    mThreadLoopDelay = THREAD_LOOP_DELAY;
+    mThreadLoopElapsed = 0;
+    mThreadExit = false;
     // TODO: check return value
     mThread->run("MDSClientInitThread", PRIORITY_URGENT_DISPLAY);
     return true;
@@ -215,29 +272,29 @@ bool MultiDisplayObserver::initMDSClientAsync()
 bool MultiDisplayObserver::initialize()
 {
     bool ret = true;
-    Mutex::Autolock _l(mLock);
-
-    if (mInitialized) {
-        WTRACE("display observer has been initialized");
-        return true;
+    {
+        // lock scope
+        Mutex::Autolock _l(mLock);
+        if (mInitialized) {
+            WTRACE("display observer has been initialized");
+            return true;
+        }
+        mThreadExit = false;
+        mInitialized = true;
     }
 
     // initialize MDS client once. This should succeed if MDS service starts
     // before surfaceflinger service is started.
     // if surface flinger runs first, MDS client will be initialized asynchronously in
     // a working thread
-    if (isMDSRunning()) {
-        if (!initMDSClient()) {
-            ETRACE("failed to initialize MDS client");
-            // FIXME: NOT a common case for system server crash.
-            // Start a working thread to initialize MDS client if exception happens
-            ret = initMDSClientAsync();
-        }
-    } else {
-        ret = initMDSClientAsync();
+    if (isMDSRunning() && initMDSClient()) {
+        return true;
     }
 
-    mInitialized = true;
+    // FIXME: NOT a common case for system server crash.
+    // Start a working thread to initialize MDS client if exception happens
+    Mutex::Autolock _l(mLock);
+    ret = initMDSClientAsync();
     return ret;
 }
 
@@ -247,6 +304,7 @@ void MultiDisplayObserver::deinitialize()
     do {
         Mutex::Autolock _l(mLock);
 
+        mThreadExit = true;
         if (mThread.get()) {
             mCondition.signal();
             detachedThread = mThread;
@@ -265,12 +323,12 @@ void MultiDisplayObserver::deinitialize()
 
 bool MultiDisplayObserver::threadLoop()
 {
-    Mutex::Autolock _l(mLock);
-
     // try to create MDS client in the working thread
-    // multiple delayed attempts are made until MDS service starts.
+    // delayed attempts are made with an exponential backoff until MDS
+    // service starts. mLock is not held while probing the service manager
+    // or while waiting, so binder entry points are not stalled meanwhile.
 
-    // Return false if MDS service is running or loop limit is reached
+    // Return false if MDS service is running or time limit is reached
     // such that thread becomes inactive.
     if (isMDSRunning()) {
         if (!initMDSClient()) {
@@ -279,17 +337,29 @@ bool MultiDisplayObserver::threadLoop()
         return false;
     }
 
-    if (mThreadLoopCount++ > THREAD_LOOP_BOUND) {
-        ETRACE("failed to initialize MDS client, loop limit reached");
+    Mutex::Autolock _l(mLock);
+    if (mThreadExit) {
         return false;
     }
 
-    status_t err = mCondition.waitRelative(mLock, milliseconds(THREAD_LOOP_DELAY));
-    if (err != -ETIMEDOUT) {
+    if (mThreadLoopElapsed >= THREAD_LOOP_TIMEOUT) {
+        ETRACE("failed to initialize MDS client after %d attempts", mThreadLoopCount);
+        return false;
+    }
+    mThreadLoopCount++;
+
+    // mLock is released for the duration of the wait
+    status_t err = mCondition.waitRelative(mLock, milliseconds(mThreadLoopDelay));
+    if (err != -ETIMEDOUT || mThreadExit) {
         ITRACE("thread is interrupted");
         return false;
     }
 
+    mThreadLoopElapsed += mThreadLoopDelay;
+    mThreadLoopDelay *= 2;
+    if (mThreadLoopDelay > THREAD_LOOP_MAX_DELAY) {
+        mThreadLoopDelay = THREAD_LOOP_MAX_DELAY;
+    }
     return true; // keep trying
 }
 
@@ -341,6 +411,9 @@ status_t MultiDisplayObserver::notifyHotPlug( bool connected)
         // lock scope
         Mutex::Autolock _l(mLock);
         if (mMDSConnObserver.get() == NULL) {
+            // replayed with the connection state read at client init
+            if (!connected) mExternalHdmiTiming = false;
+            mPendingHotplug = true;
             return NO_INIT;
         }
 
@@ -401,11 +474,19 @@ bool MultiDisplayObserver::isExternalDeviceTimingFixed() const
 
 status_t MultiDisplayObserver::notifyWidiConnectionStatus( bool connected)
 {
-    Mutex::Autolock _l(mLock);
-    if (mMDSConnObserver.get() == NULL) {
-        return NO_INIT;
+    sp<IMultiDisplayConnectionObserver> connObserver;
+    {
+        // lock scope
+        Mutex::Autolock _l(mLock);
+        if (mMDSConnObserver.get() == NULL) {
+            // only the latest status matters, replayed on client init
+            mPendingWidi = true;
+            mPendingWidiConnected = connected;
+            return NO_INIT;
+        }
+        connObserver = mMDSConnObserver;
     }
-    return mMDSConnObserver->updateWidiConnectionStatus(connected);
+    return connObserver->updateWidiConnectionStatus(connected);
 }
 
 status_t MultiDisplayObserver::setDecoderOutputResolution(
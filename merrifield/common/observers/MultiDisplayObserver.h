@@ -82,6 +82,7 @@ private:
     bool initMDSClient();
     bool initMDSClientAsync();
     void deinitMDSClient();
+    void replayPendingNotifications();
     status_t blankSecondaryDisplay(bool blank);
     status_t updateVideoState(int sessionId, MDS_VIDEO_STATE state);
     status_t setHdmiTiming(const MDSHdmiTiming& timing);
@@ -90,8 +91,9 @@ private:
 
 private:
     enum {
-        THREAD_LOOP_DELAY = 10, // 10 ms
-        THREAD_LOOP_BOUND = 2000, // 20s
+        THREAD_LOOP_DELAY = 10, // 10 ms, first retry
+        THREAD_LOOP_MAX_DELAY = 1000, // 1s, backoff ceiling
+        THREAD_LOOP_TIMEOUT = 20000, // 20s
     };
 
 private:
@@ -103,7 +105,14 @@ private:
     mutable Mutex mLock;
     Condition mCondition;
     int mThreadLoopCount;
+    int mThreadLoopDelay;
+    int mThreadLoopElapsed;
+    bool mThreadExit;
     bool mDeviceConnected;
+    // notifications issued before MDS client is ready, replayed on init
+    bool mPendingHotplug;
+    bool mPendingWidi;
+    bool mPendingWidiConnected;
     // indicate external devices's timing is set
     bool mExternalHdmiTiming;
     bool mInitialized;
@@ -356,6 +356,14 @@ void DisplayPlane::postFlip()
     mUpdateMasks = 0;
 }
 
+void DisplayPlane::dump(Dump& d)
+{
+    d.append("Plane %d (type %d) data buffers: cached %zu, capacity %d, "
+             "active %zu\n",
+             mIndex, mType, mDataBuffers.size(), mCacheCapacity,
+             mActiveBuffers.size());
+}
+
 bool DisplayPlane::reset()
 {
     // reclaim all allocated resources
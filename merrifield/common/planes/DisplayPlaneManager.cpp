@@ -111,15 +111,10 @@ int DisplayPlaneManager::getPlane(uint32_t& mask)
     if (!mask)
         return -1;
 
-    for (int i = 0; i < 32; i++) {
-        int bit = (1 << i);
-        if (bit & mask) {
-            mask &= ~bit;
-            return i;
-        }
-    }
-
-    return -1;
+    // lowest free plane
+    int i = __builtin_ctz(mask);
+    mask &= mask - 1;
+    return i;
 }
 
 void DisplayPlaneManager::putPlane(int index, uint32_t& mask)
@@ -243,13 +238,7 @@ int DisplayPlaneManager::getFreePlanes(int dsp, int type)
         type == DisplayPlane::PLANE_CURSOR) {
         return ((freePlanes & (1 << dsp)) == 0) ? 0 : 1;
     } else {
-        int count = 0;
-        for (int i = 0; i < 32; i++) {
-            if ((1 << i) & freePlanes) {
-                count++;
-            }
-        }
-        return count;
+        return __builtin_popcount(freePlanes);
     }
     return 0;
 }
@@ -342,6 +331,12 @@ void DisplayPlaneManager::dump(Dump& d)
              mPlaneCount[DisplayPlane::PLANE_CURSOR],
              mFreePlanes[DisplayPlane::PLANE_CURSOR],
              mReclaimedPlanes[DisplayPlane::PLANE_CURSOR]);
+
+    for (int i = 0; i < DisplayPlane::PLANE_MAX; i++) {
+        for (size_t j = 0; j < mPlanes[i].size(); j++) {
+            mPlanes[i].itemAt(j)->dump(d);
+        }
+    }
 }
 
 } // namespace intel
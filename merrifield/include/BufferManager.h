@@ -61,6 +61,11 @@ public:
     void freeGrallocBuffer(buffer_handle_t handle);
     virtual bool blit(buffer_handle_t srcHandle, buffer_handle_t destHandle,
                       const crop_t& destRect, bool async) = 0;
+    // queue a blit without waiting for it. the blit starts once srcFenceFd,
+    // if not -1, has signaled; the caller keeps it. fenceFd returns a fence
+    // owned by the caller that signals on completion, or -1 if already done
+    virtual bool blitAsync(buffer_handle_t srcHandle, buffer_handle_t destHandle,
+                           const crop_t& destRect, int srcFenceFd, int *fenceFd) = 0;
 protected:
     virtual DataBuffer* createDataBuffer(gralloc_module_t *module,
                                              buffer_handle_t handle) = 0;
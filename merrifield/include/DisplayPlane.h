@@ -17,6 +17,7 @@
 #define DISPLAYPLANE_H_
 
 #include <utils/KeyedVector.h>
+#include <Dump.h>
 #include <BufferMapper.h>
 #include <Drm.h>
 
@@ -96,6 +97,12 @@ public:
     // hardware operations
     virtual bool flip(void *ctx);
     virtual void postFlip();
+    // fence to be waited on by the display before the flipped buffer is
+    // scanned out, -1 if none. the caller owns it
+    virtual int takeFlipFence() { return -1; }
+    // called once the display has accepted (or rejected) the context
+    // handed over by the last flip
+    virtual void flipCommitted(bool committed) {}
 
     virtual bool reset();
     virtual bool enable() = 0;
@@ -114,6 +121,9 @@ public:
     virtual bool initialize(uint32_t bufferCount);
     virtual void deinitialize();
 
+    // dump interface
+    virtual void dump(Dump& d);
+
 protected:
     virtual void checkPosition(int& x, int& y, int& w, int& h);
     virtual bool setDataBuffer(BufferMapper& mapper) = 0;
@@ -38,11 +38,14 @@ struct ZOrderLayer
     int zorder;
     DisplayPlane *plane;
     HwcLayer *hwcLayer;
+    // plane the layer was bound to in the previous plan, if any.
+    // plane manager should try to keep the layer on it.
+    DisplayPlane *preferredPlane;
 };
 
 class ZOrderConfig : public SortedVector<ZOrderLayer*> {
 public:
-    ZOrderConfig() {}
+    ZOrderConfig() : workaroundRejected(false) {}
 
     int do_compare(const void* lhs, const void* rhs) const {
         const ZOrderLayer *l = *(ZOrderLayer**)lhs;
@@ -51,6 +54,9 @@ public:
         // sorted from z order 0 to n
         return l->zorder - r->zorder;
     }
+
+    // set by isValidZOrder() when only a HW workaround rejects the config
+    bool workaroundRejected;
 };
 
 
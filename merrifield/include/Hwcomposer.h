@@ -19,6 +19,8 @@
 #include <EGL/egl.h>
 #include <hardware/hwcomposer.h>
 #include <utils/Vector.h>
+#include <utils/threads.h>
+#include <SimpleThread.h>
 
 #include <IDisplayDevice.h>
 #include <BufferManager.h>
@@ -26,6 +28,8 @@
 #include <Drm.h>
 #include <DisplayPlaneManager.h>
 #include <DisplayAnalyzer.h>
+#include <CompositionStats.h>
+#include <CursorCoalescer.h>
 #include <VsyncManager.h>
 #include <MultiDisplayObserver.h>
 #include <UeventObserver.h>
@@ -80,6 +84,9 @@ public:
     BufferManager* getBufferManager();
     IDisplayContext* getDisplayContext();
     DisplayAnalyzer* getDisplayAnalyzer();
+    // analyzer state of the prepare in progress
+    const DisplayAnalyzer::State& getAnalyzerState() const { return mAnalyzerState; }
+    CompositionStats* getCompositionStats();
     VsyncManager* getVsyncManager();
     MultiDisplayObserver* getMultiDisplayObserver();
     IDisplayDevice* getDisplayDevice(int disp);
@@ -104,6 +111,10 @@ public:
     // Need to be implemented
     static Hwcomposer* createHwcomposer();
 
+private:
+    // prepare a display on the worker thread, concurrently with the caller
+    void queuePrepare(IDisplayDevice *device, hwc_display_contents_1_t *display);
+    bool waitPrepare();
 
 private:
     hwc_procs_t const *mProcs;
@@ -113,6 +124,7 @@ private:
     IPlatFactory *mPlatFactory;
     VsyncManager *mVsyncManager;
     DisplayAnalyzer *mDisplayAnalyzer;
+    CompositionStats *mCompositionStats;
     MultiDisplayObserver *mMultiDisplayObserver;
     UeventObserver *mUeventObserver;
 
@@ -120,11 +132,23 @@ private:
     DisplayPlaneManager *mPlaneManager;
     BufferManager *mBufferManager;
     IDisplayContext *mDisplayContext;
+    CursorCoalescer *mCursorCoalescer;
 
     Vector<IDisplayDevice*> mDisplayDevices;
 
     bool mInitialized;
 
+    // display prepared on the worker thread, which reads analyzer state
+    // from the copy made before it is queued
+    DisplayAnalyzer::State mAnalyzerState;
+    Mutex mPrepareLock;
+    Condition mPrepareCond;
+    IDisplayDevice *mPrepareDevice;
+    hwc_display_contents_1_t *mPrepareDisplay;
+    bool mPreparePending;
+    bool mPrepareResult;
+    bool mPrepareExit;
+    DECLARE_THREAD(PrepareThread, Hwcomposer);
 
 
     static Hwcomposer *sInstance;
@@ -54,6 +54,8 @@ public:
 public:
     virtual bool getMetaData(BufferMapper *mapper, MetaData *metadata) = 0;
     virtual bool setRenderStatus(BufferMapper *mapper, bool renderStatus) = 0;
+    // forget anything kept for mapper, called before it is unmapped
+    virtual void removeMapper(BufferMapper *mapper) = 0;
 };
 
 } // namespace intel
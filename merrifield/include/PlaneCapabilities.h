@@ -24,11 +24,25 @@ namespace intel {
 class HwcLayer;
 class PlaneCapabilities
 {
+public:
+    // reason a layer is rejected by a plane type
+    enum {
+        REJECT_NONE = 0,
+        REJECT_TRANSFORM,
+        REJECT_FORMAT,
+        REJECT_SIZE,
+        REJECT_BLENDING,
+        REJECT_SCALING,
+        REJECT_ALIGNMENT,
+        REJECT_REASON_COUNT,
+    };
+
 public:
     static bool isFormatSupported(int planeType, HwcLayer *hwcLayer);
     static bool isSizeSupported(int planeType,  HwcLayer *hwcLayer);
     static bool isBlendingSupported(int planeType, HwcLayer *hwcLayer);
     static bool isScalingSupported(int planeType, HwcLayer *hwcLayer);
+    static bool isOffsetSupported(int planeType, HwcLayer *hwcLayer);
     static bool isTransformSupported(int planeType,  HwcLayer *hwcLayer);
 };
 
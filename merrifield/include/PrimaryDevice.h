@@ -16,6 +16,8 @@
 #ifndef PRIMARY_DEVICE_H
 #define PRIMARY_DEVICE_H
 
+#include <utils/Timers.h>
+#include <SimpleThread.h>
 #include <DisplayPlane.h>
 #include <IVsyncControl.h>
 #include <IBlankControl.h>
@@ -34,11 +36,65 @@ public:
 public:
     virtual bool initialize();
     virtual void deinitialize();
+    virtual bool prepare(hwc_display_contents_1_t *display);
+    virtual void dump(Dump& d);
 
     bool blank(bool blank);
+
+    // called by display analyzer when idle state is actually switched
+    void onIdleEntry();
+    void onIdleExit();
 private:
     static void repeatedFrameEventListener(void *data);
     void repeatedFrameListener();
+    bool shouldEnterIdle(nsecs_t now);
+    void enterIdle();
+    void learnIdleDuration(nsecs_t duration);
+    uint32_t getWorkload(hwc_display_contents_1_t *display);
+
+private:
+    enum {
+        IDLE_HISTORY_SLOTS = 4,
+        // samples needed before idle entry can be skipped
+        IDLE_LEARNING_SAMPLES = 3,
+    };
+
+    // idle duration learned for a workload. A workload is told apart by
+    // its layer count, the geometry and blending of each layer and whether
+    // video is playing, which stay the same while an app shows one screen
+    struct IdleHistory {
+        uint32_t workload;
+        int layerCount;
+        int samples;
+        nsecs_t avgDuration;
+        nsecs_t lastUsed;
+    };
+
+    Mutex mIdleLock;
+    IdleHistory mIdleHistory[IDLE_HISTORY_SLOTS];
+    // idle shorter than this is not worth dropping planes for
+    nsecs_t mIdleMinDuration;
+    uint32_t mWorkload;
+    int mLayerCount;
+    bool mIdle;
+    nsecs_t mIdleEntryTime;
+    // time of a skipped idle entry, to keep learning while not idle
+    nsecs_t mIdleSkipTime;
+    // a skipped entry is taken after all once the screen stays static for
+    // mIdleMinDuration, the next frame cancels it
+    nsecs_t mIdleDeferredTime;
+    // start of the static screen when idle was entered late
+    nsecs_t mIdleStartTime;
+    bool mIdleThreadExit;
+    Condition mIdleCondition;
+    // idle exit waiting for the first overlay composed frame
+    nsecs_t mIdleExitTime;
+    int mIdleEntries;
+    int mIdleSkips;
+    nsecs_t mLastExitLatency;
+    nsecs_t mMaxExitLatency;
+
+    DECLARE_THREAD(IdleTimerThread, PrimaryDevice);
 };
 
 }
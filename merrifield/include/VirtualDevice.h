@@ -19,8 +19,10 @@
 #include <IDisplayDevice.h>
 #include <SimpleThread.h>
 #include <IVideoPayloadManager.h>
+#include <SoftCompositor.h>
 #include <utils/Condition.h>
 #include <utils/Mutex.h>
+#include <utils/Timers.h>
 #include <utils/Vector.h>
 #include <utils/List.h>
 #ifdef INTEL_WIDI
@@ -52,6 +54,8 @@ protected:
         BufferMapper *mapper;
         VAMappedHandle *vaMappedHandle;
         buffer_handle_t cachedKhandle;
+        // told when the mapper goes, if its metadata may have been read
+        IVideoPayloadManager *payloadManager;
     };
     struct HeldDecoderBuffer : public android::RefBase {
         HeldDecoderBuffer(const sp<VirtualDevice>& vd, const android::sp<CachedBuffer>& cachedBuffer);
@@ -70,20 +74,47 @@ protected:
         bool forceNotifyBufferInfo;
     };
 #endif
+    // gralloc buffers kept in size classes, one class is active at a time
+    // so that consecutive frames use buffers of the same size
     class BufferList {
     public:
-        BufferList(VirtualDevice& vd, const char* name, uint32_t limit, uint32_t format, uint32_t usage);
-        buffer_handle_t get(uint32_t width, uint32_t height, sp<RefBase>* heldBuffer);
+        BufferList(VirtualDevice& vd, const char* name, uint32_t limit, uint32_t format, uint32_t usage,
+                   uint32_t budget, bool crop);
+        // bufWidth and bufHeight return the size of the buffer, which may
+        // be larger than requested if a bigger class is reused
+        buffer_handle_t get(uint32_t width, uint32_t height, sp<RefBase>* heldBuffer,
+                            uint32_t *bufWidth = NULL, uint32_t *bufHeight = NULL);
         void clear();
     private:
         struct HeldBuffer;
+        struct PooledBuffer {
+            buffer_handle_t handle;
+            uint32_t width;
+            uint32_t height;
+            bool idle;
+            // free instead of keeping when it comes back
+            bool discard;
+            uint32_t lastUsed;
+        };
+        void selectClass(uint32_t width, uint32_t height);
+        void putBuffer(buffer_handle_t handle);
+        void trim();
+        uint32_t getBufferBytes(uint32_t width, uint32_t height) const;
+        void freeBuffer(size_t index);
         VirtualDevice& mVd;
         const char* mName;
-        android::List<buffer_handle_t> mAvailableBuffers;
+        android::Vector<PooledBuffer> mBuffers;
         const uint32_t mLimit;
         const uint32_t mFormat;
         const uint32_t mUsage;
-        uint32_t mBuffersToCreate;
+        // bytes of idle buffers kept outside the active class
+        const uint32_t mBudget;
+        // whether a larger class may serve a smaller request
+        const bool mCrop;
+        uint32_t mClock;
+        // last requested size and the active class serving it
+        uint32_t mRequestWidth;
+        uint32_t mRequestHeight;
         uint32_t mWidth;
         uint32_t mHeight;
     };
@@ -112,12 +143,21 @@ protected:
     int64_t mRenderTimestamp;
 
     Mutex mTaskLock; // for task queue and buffer lists
+    // mTaskLock taken on the prepare path with its hold time accounted,
+    // waits for the blit thread are not counted as hold time
+    class PrepareLock;
+    uint32_t mPrepareLockHolds;
+    nsecs_t mPrepareLockHeldTotal;
+    nsecs_t mPrepareLockHeldMax;
+    nsecs_t mPrepareLockWaited;
     BufferList mCscBuffers;
     BufferList mRgbUpscaleBuffers;
     DECLARE_THREAD(WidiBlitThread, VirtualDevice);
     Condition mRequestQueued;
     Condition mRequestDequeued;
     Vector< sp<Task> > mTasks;
+    // WidiBlit exits once the queued tasks are done
+    bool mThreadExit;
 
     // fence info
     int mSyncTimelineFd;
@@ -143,8 +183,103 @@ protected:
     VAContextID va_context;
     VASurfaceID va_blank_yuv_in;
     VASurfaceID va_blank_rgb_in;
+    // largest output requested, blank video input size and the part of
+    // it filled with black
+    uint32_t mVspMaxWidth;
+    uint32_t mVspMaxHeight;
+    uint32_t mVspBlankWidth;
+    uint32_t mVspBlankHeight;
+    uint32_t mVspBlankFilledWidth;
+    uint32_t mVspBlankFilledHeight;
+    // blank video input kept after vspDisable(), WidiBlit releases it once
+    // VSP has stayed disabled for VSP_BLANK_RELEASE_DELAY
+    bool mVspBlankIdle;
     android::KeyedVector<buffer_handle_t, android::sp<VAMappedHandleObject> > mVaMapCache;
 
+    // VSP pipeline, frames submitted by WidiBlit to VSP or the GPU are
+    // completed in order by the completion thread, which signals their
+    // release fences
+    enum {
+        VSP_PIPELINE_DEPTH = 3,
+        VSP_BLANK_RELEASE_DELAY = 5000, // ms
+    };
+    class VspCompletionThread : public Thread {
+    public:
+        VspCompletionThread(VirtualDevice *owner) : mOwner(owner) {}
+    private:
+        virtual bool threadLoop() { return mOwner->vspCompletionLoop(); }
+    private:
+        VirtualDevice *mOwner;
+    };
+    friend class VspCompletionThread;
+    Mutex mVspLock;
+    Condition mVspSubmitted;
+    Condition mVspCompleted;
+    android::List< sp<RenderTask> > mVspInFlight;
+    uint32_t mVspFramesInFlight;
+    bool mVspCompletionExit;
+    sp<VspCompletionThread> mVspCompletionThread;
+    // VA context calls from WidiBlit (submission) and the completion
+    // thread (output dumps); syncs only wait on a surface and go without
+    Mutex mVspContextLock;
+    // pipeline parameter buffers and the state they point to, per slot
+    VABufferID mVspParamBuffers[VSP_PIPELINE_DEPTH];
+    VABlendState mVspBlendStates[VSP_PIPELINE_DEPTH];
+    VASurfaceID mVspAdditionalOutputs[VSP_PIPELINE_DEPTH];
+    int mVspNextParamBuffer;
+
+    // CPU composition, used by WidiBlit when vspEnable() cannot bring VSP
+    // up or widi.compose.soft asks for it
+    enum {
+        SOFT_COMPOSE_THREADS = 4,
+    };
+    SoftCompositor mSoftCompositor;
+    bool mSoftCompose;
+    // frames composed without their video, which the CPU can't read
+    volatile int32_t mSoftBlackVideo;
+    bool mForceSoftCompose;
+
+    // WiDi frame admission. Frames that would complete more than
+    // FRAME_DEADLINE_PERIODS sink frames from now are dropped before they
+    // are queued, and the newest content is redrawn once caught up.
+    enum {
+        FRAME_DEADLINE_PERIODS = 2,
+        MAX_FRAMES_PENDING = VSP_PIPELINE_DEPTH + 1,
+    };
+    Mutex mAdmissionLock;
+    uint32_t mFramesPending;
+    // EWMA of the time a frame keeps the pipeline busy
+    nsecs_t mFrameServiceTime;
+    nsecs_t mLastFrameRetired;
+    uint32_t mFramesQueued;
+    uint32_t mFramesDropped;
+    uint32_t mFramesDroppedBurst;
+    bool mRedrawPending;
+    nsecs_t mFramePeriod;
+
+    // Cost adaptation. Compose latency and queue depth are sampled as
+    // frames retire, and each ADAPT_WINDOW the level steps down at once
+    // when overloaded, or back up after ADAPT_UP_WINDOWS quiet windows.
+    // Levels pace the composed frame rate down to a fraction of the
+    // refresh; paced frames are counted apart from drops so they don't
+    // feed back into the evaluation. Frame info keeps the content rate.
+    enum {
+        ADAPT_LEVELS = 3,
+        ADAPT_UP_WINDOWS = 5,
+    };
+    bool mAdaptEnabled;
+    uint32_t mAdaptLevel;
+    uint32_t mAdaptQuietWindows;
+    uint32_t mAdaptSteps;
+    uint32_t mAdaptFrameCount;
+    uint32_t mFramesPaced;
+    nsecs_t mAdaptWindowStart;
+    uint32_t mAdaptWindowFrames;
+    nsecs_t mAdaptWindowLatency;
+    uint32_t mAdaptWindowMaxPending;
+    uint32_t mAdaptWindowDropped;
+    nsecs_t mAdaptLatency;
+
     bool mVspUpscale;
     bool mDebugVspClear;
     bool mDebugVspDump;
@@ -155,6 +290,7 @@ private:
 
     bool sendToWidi(hwc_display_contents_1_t *display);
     bool queueCompose(hwc_display_contents_1_t *display);
+    void queueAborted(const android::sp<RenderTask>& task);
     bool queueColorConvert(hwc_display_contents_1_t *display);
 #ifdef INTEL_WIDI
     bool handleExtendedMode(hwc_display_contents_1_t *display);
@@ -163,11 +299,31 @@ private:
     void queueBufferInfo(const FrameInfo& outputFrameInfo);
 #endif
     void colorSwap(buffer_handle_t src, buffer_handle_t dest, uint32_t pixelCount);
+    void waitRequestDequeued();
+    bool admitFrame();
+    bool admitPaced();
+    bool admitLoaded();
+    void frameQueued(RenderTask *task);
+    void frameRetired(nsecs_t queuedTime);
+    void frameDropped();
+    void adaptEvaluate(nsecs_t now);
     void vspPrepare(uint32_t width, uint32_t height);
-    void vspEnable(uint32_t width, uint32_t height);
+    bool vspInitDisplay();
+    void vspEnable(uint32_t width, uint32_t height,
+                   uint32_t capacityWidth, uint32_t capacityHeight);
     void vspDisable();
+    void vspReleaseBlank();
+    void vspTerminate();
+    void softComposeEnable();
+    bool vspSubmit(VASurfaceID videoIn, VASurfaceID rgbIn, VASurfaceID videoOut,
+                   const VARectangle* surface_region, const VARectangle* output_region);
     void vspCompose(VASurfaceID videoIn, VASurfaceID rgbIn, VASurfaceID videoOut,
                     const VARectangle* surface_region, const VARectangle* output_region);
+    void vspSyncSurface(VASurfaceID surface);
+    void vspQueueCompletion(const sp<RenderTask>& task);
+    void vspWaitInFlight(uint32_t count);
+    uint32_t vspFramesInFlight();
+    bool vspCompletionLoop();
 
     bool getFrameOfSize(uint32_t width, uint32_t height, const IVideoPayloadManager::MetaData& metadata, IVideoPayloadManager::Buffer& info);
     void setMaxDecodeResolution(uint32_t width, uint32_t height);
@@ -91,6 +91,7 @@ bool AnnOverlayPlane::enable()
         return true;
 
     mContext.ctx.ov_ctx.ovadd |= (0x1 << 15);
+    invalidateCoeffs();
 
     // flush
     flush(PLANE_ENABLE);
@@ -110,10 +111,14 @@ bool AnnOverlayPlane::disable()
     mContext.ctx.ov_ctx.ovadd &= ~(0x300);
 
     mContext.ctx.ov_ctx.ovadd |= mPipeConfig;
+    invalidateCoeffs();
 
     // flush
     flush(PLANE_DISABLE);
 
+    // idle pooled buffers are not needed until the plane is used again
+    mWsbm->trimPool();
+
     return true;
 }
 
@@ -584,8 +589,9 @@ bool AnnOverlayPlane::flip(void *ctx)
     // setup z-order config
     ovadd |= mZOrderConfig;
 
-    // load coefficients
-    ovadd |= 0x1;
+    // load coefficients only if they differ from the loaded ones
+    if (commitFlipBackBuffer())
+        ovadd |= 0x1;
 
     // enable overlay
     ovadd |= (1 << 15);
@@ -111,15 +111,14 @@ static ZOrderDescription PIPE_B_ZORDER_DESC[] =
     {12, "BDGH"}  // overlay A/C at top (1 << 2 + 1 << 3)
 };
 
-static ZOrderDescription *PIPE_A_ZORDER_TBL;
-static int PIPE_A_ZORDER_COMBINATIONS;
-static ZOrderDescription *PIPE_B_ZORDER_TBL;
-static int PIPE_B_ZORDER_COMBINATIONS;
+// first nickname of each plane type, bit position in free plane mask
+static int PLANE_NICKNAME_BASE[DisplayPlane::PLANE_MAX];
 static bool OVERLAY_HW_WORKAROUND;
 
 AnnPlaneManager::AnnPlaneManager()
     : DisplayPlaneManager()
 {
+    memset(mZOrderMaxPlanes, 0, sizeof(mZOrderMaxPlanes));
 }
 
 AnnPlaneManager::~AnnPlaneManager()
@@ -133,25 +132,29 @@ bool AnnPlaneManager::initialize()
     mPrimaryPlaneCount = 3; // Primary A, B, C
     mCursorPlaneCount = 3;
 
+    for (int i = sizeof(PLANE_DESC)/sizeof(PlaneDescription) - 1; i >= 0; i--) {
+        PLANE_NICKNAME_BASE[PLANE_DESC[i].type] = i;
+    }
+
     uint32_t videoMode = 0;
     Drm *drm = Hwcomposer::getInstance().getDrm();
     drm->readIoctl(DRM_PSB_PANEL_QUERY, &videoMode, sizeof(uint32_t));
     if (videoMode == 1) {
         DTRACE("video mode panel, no primay A always on hack");
-        PIPE_A_ZORDER_TBL = PIPE_A_ZORDER_DESC_VID;
-        PIPE_A_ZORDER_COMBINATIONS =
-            sizeof(PIPE_A_ZORDER_DESC_VID)/sizeof(ZOrderDescription);
+        compileZOrderTable(IDisplayDevice::DEVICE_PRIMARY,
+            PIPE_A_ZORDER_DESC_VID,
+            sizeof(PIPE_A_ZORDER_DESC_VID)/sizeof(ZOrderDescription));
     } else {
         DTRACE("command mode panel, need primay A always on hack");
-        PIPE_A_ZORDER_TBL = PIPE_A_ZORDER_DESC_CMD;
-        PIPE_A_ZORDER_COMBINATIONS =
-            sizeof(PIPE_A_ZORDER_DESC_CMD)/sizeof(ZOrderDescription);
+        compileZOrderTable(IDisplayDevice::DEVICE_PRIMARY,
+            PIPE_A_ZORDER_DESC_CMD,
+            sizeof(PIPE_A_ZORDER_DESC_CMD)/sizeof(ZOrderDescription));
 	OVERLAY_HW_WORKAROUND = true;
     }
 
-    PIPE_B_ZORDER_TBL = PIPE_B_ZORDER_DESC;
-    PIPE_B_ZORDER_COMBINATIONS =
-        sizeof(PIPE_B_ZORDER_DESC)/sizeof(ZOrderDescription);
+    compileZOrderTable(IDisplayDevice::DEVICE_EXTERNAL,
+        PIPE_B_ZORDER_DESC,
+        sizeof(PIPE_B_ZORDER_DESC)/sizeof(ZOrderDescription));
 
     return DisplayPlaneManager::initialize();
 }
@@ -193,65 +196,37 @@ DisplayPlane* AnnPlaneManager::allocPlane(int index, int type)
 
 bool AnnPlaneManager::isValidZOrder(int dsp, ZOrderConfig& config)
 {
-    int size = (int)config.size();
-    bool hasCursor = false;
+    if (dsp < 0 || dsp > IDisplayDevice::DEVICE_EXTERNAL) {
+        ETRACE("invalid display device %d", dsp);
+        return false;
+    }
 
+    // the cursor sits on top of the planes in the table, see assignPlanes
+    int size = (int)config.size();
+    int planes = size;
+    int index = 0;
     for (int i = 0; i < size; i++) {
         if (config[i]->planeType == DisplayPlane::PLANE_CURSOR) {
-            hasCursor = true;
-            break;
+            if (i != size - 1) {
+                VTRACE("cursor layer is not on top");
+                return false;
+            }
+            planes--;
+        } else if (config[i]->planeType == DisplayPlane::PLANE_OVERLAY) {
+            index += (1 << i);
         }
     }
 
-    if (size <= 0 ||
-        (hasCursor && size > 5) ||
-        (!hasCursor && size > 4)) {
-        VTRACE("invalid z order config size %d", size);
+    if (planes <= 0 || planes > MAX_ZORDER_PLANES ||
+        planes > mZOrderMaxPlanes[dsp][index]) {
+        VTRACE("no z order combination for %d planes at index %d", planes, index);
         return false;
     }
 
-    if (dsp == IDisplayDevice::DEVICE_PRIMARY) {
-        int firstOverlay = -1;
-        for (int i = 0; i < size; i++) {
-            if (config[i]->planeType == DisplayPlane::PLANE_OVERLAY) {
-                firstOverlay = i;
-                break;
-            }
-        }
-
-        int sprites = 0;
-        for (int i = 0; i < size; i++) {
-            if (config[i]->planeType != DisplayPlane::PLANE_OVERLAY &&
-                config[i]->planeType != DisplayPlane::PLANE_CURSOR) {
-                sprites++;
-            }
-        }
-
-        if (firstOverlay < 0 && sprites > 4) {
-            VTRACE("not capable to support more than 4 sprite layers");
-            return false;
-        }
-
-        if (OVERLAY_HW_WORKAROUND) {
-            if (firstOverlay == 0 && size > 2) {
-                VTRACE("can not support 3 sprite layers on top of overlay");
-                return false;
-            }
-        }
-    } else if (dsp == IDisplayDevice::DEVICE_EXTERNAL) {
-        int sprites = 0;
-        for (int i = 0; i < size; i++) {
-            if (config[i]->planeType != DisplayPlane::PLANE_OVERLAY &&
-                config[i]->planeType != DisplayPlane::PLANE_CURSOR) {
-                sprites++;
-            }
-        }
-        if (sprites > 2) {
-            ETRACE("number of sprite: %d, maximum 1 sprite and 1 primary supported on pipe 1", sprites);
-            return false;
-        }
-    } else {
-        ETRACE("invalid display device %d", dsp);
+    if (OVERLAY_HW_WORKAROUND && dsp == IDisplayDevice::DEVICE_PRIMARY &&
+        (index & 1) && size > 2) {
+        VTRACE("can not support 3 sprite layers on top of overlay");
+        config.workaroundRejected = true;
         return false;
     }
     return true;
@@ -274,44 +249,74 @@ bool AnnPlaneManager::assignPlanes(int dsp, ZOrderConfig& config)
         }
     }
 
-    int combinations;
-    ZOrderDescription *table;
-    if (dsp == IDisplayDevice::DEVICE_PRIMARY) {
-        combinations = PIPE_A_ZORDER_COMBINATIONS;
-        table = PIPE_A_ZORDER_TBL;
-    } else {
-        combinations = PIPE_B_ZORDER_COMBINATIONS;
-        table = PIPE_B_ZORDER_TBL;
+    if (index >= ZORDER_INDEX_COUNT) {
+        VTRACE("no z order combination for index %d", index);
+        return false;
     }
 
-    for (int i = 0; i < combinations; i++) {
-        ZOrderDescription *zorderDesc = table + i;
+    const Vector<ZOrderCombination>& candidates = mZOrderTable[dsp][index];
 
-        if (zorderDesc->index != index)
-            continue;
+    bool hasPreferredPlane = false;
+    for (int i = 0; i < size; i++) {
+        if (config[i]->preferredPlane) {
+            hasPreferredPlane = true;
+            break;
+        }
+    }
 
-        if (assignPlanes(dsp, config, zorderDesc->zorder)) {
-            VTRACE("zorder assigned %s", zorderDesc->zorder);
-            return true;
+    // first pass only accepts combinations that keep layers on the planes
+    // they were bound to in previous plan
+    for (int pass = hasPreferredPlane ? 0 : 1; pass < 2; pass++) {
+        for (size_t i = 0; i < candidates.size(); i++) {
+            const ZOrderCombination& combination = candidates.itemAt(i);
+
+            if (pass == 0 && !isPreferredZOrder(config, combination))
+                continue;
+
+            if (assignPlanes(dsp, config, combination)) {
+                VTRACE("zorder assigned %s", combination.zorder);
+                return true;
+            }
         }
     }
     return false;
 }
 
-bool AnnPlaneManager::assignPlanes(int dsp, ZOrderConfig& config, const char *zorder)
+bool AnnPlaneManager::isPreferredZOrder(ZOrderConfig& config,
+                                        const ZOrderCombination& combination)
+{
+    int size = (int)config.size();
+
+    for (int i = 0; i < size; i++) {
+        DisplayPlane *preferred = config[i]->preferredPlane;
+        if (!preferred || config[i]->planeType == DisplayPlane::PLANE_CURSOR) {
+            continue;
+        }
+        if (i >= combination.size) {
+            return false;
+        }
+        if (combination.type[i] != preferred->getType() ||
+            combination.index[i] != preferred->getIndex()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool AnnPlaneManager::assignPlanes(int dsp, ZOrderConfig& config,
+                                   const ZOrderCombination& combination)
 {
     // zorder string does not include cursor plane, therefore cursor layer needs to be handled
     // in a special way. Cursor layer must be on top of zorder and no more than one cursor layer.
 
     int size = (int)config.size();
-    if (zorder == NULL || size == 0) {
+    if (size == 0) {
         //DTRACE("invalid zorder or ZOrder config.");
         return false;
     }
 
-    int zorderLen = (int)strlen(zorder);
-
-    // test if plane is avalable
+    // count layers placed on the planes described by zorder
+    int planes = size;
     for (int i = 0; i < size; i++) {
         if (config[i]->planeType == DisplayPlane::PLANE_CURSOR) {
             if (i != size - 1) {
@@ -323,19 +328,24 @@ bool AnnPlaneManager::assignPlanes(int dsp, ZOrderConfig& config, const char *zo
                 ETRACE("cursor plane is not available");
                 return false;
             }
-            continue;
-        }
-        if (i >= zorderLen) {
-            DTRACE("index of ZOrderConfig is out of bound");
-            return false;
+            planes--;
         }
+    }
 
-        char id = *(zorder + i);
-        PlaneDescription& desc = PLANE_DESC[id - 'A'];
-        if (!isFreePlane(desc.type, desc.index)) {
-            DTRACE("plane type %d index %d is not available", desc.type, desc.index);
-            return false;
-        }
+    if (planes > combination.size) {
+        DTRACE("index of ZOrderConfig is out of bound");
+        return false;
+    }
+
+    // test if planes are available
+    uint32_t busyPlanes = combination.planeMask[planes] & ~getFreePlaneMask();
+    if (busyPlanes) {
+        DTRACE("planes %#x of %s are not available", busyPlanes, combination.zorder);
+        return false;
+    }
+
+    for (int i = 0; i < planes; i++) {
+        PlaneDescription desc = {0, combination.type[i], combination.index[i]};
 
 #if 0
         // plane type check
@@ -379,8 +389,7 @@ bool AnnPlaneManager::assignPlanes(int dsp, ZOrderConfig& config, const char *zo
             continue;
         }
 
-        char id = *(zorder + i);
-        PlaneDescription& desc = PLANE_DESC[id - 'A'];
+        PlaneDescription desc = {0, combination.type[i], combination.index[i]};
         ZOrderLayer *zLayer = config.itemAt(i);
         zLayer->plane = getPlane(desc.type, desc.index);
         if (zLayer->plane == NULL) {
@@ -410,7 +419,7 @@ bool AnnPlaneManager::assignPlanes(int dsp, ZOrderConfig& config, const char *zo
     }
 
 #if 0
-    DTRACE("config size %d, zorder %s", size, zorder);
+    DTRACE("config size %d, zorder %s", size, combination.zorder);
     for (int i = 0; i < size; i++) {
         const ZOrderLayer *l = config.itemAt(i);
         ITRACE("%d: plane type %d, index %d, zorder %d",
@@ -447,13 +456,104 @@ int AnnPlaneManager::getFreePlanes(int dsp, int type)
         // Sprites E/F (index 1, 2) are fixed on pipe 0
         stop = 1;
     }
-    int count = 0;
-    for (int i = start; i < stop; i++) {
-        if ((1 << i) & freePlanes) {
-            count++;
+    return __builtin_popcount(freePlanes & ((1 << stop) - (1 << start)));
+}
+
+uint32_t AnnPlaneManager::getFreePlaneMask()
+{
+    uint32_t mask = 0;
+    for (int type = 0; type < DisplayPlane::PLANE_MAX; type++) {
+        uint32_t freePlanes = mFreePlanes[type] | mReclaimedPlanes[type];
+        freePlanes &= (1 << mPlaneCount[type]) - 1;
+        mask |= freePlanes << PLANE_NICKNAME_BASE[type];
+    }
+    return mask;
+}
+
+void AnnPlaneManager::compileZOrderTable(int dsp, const ZOrderDescription *table,
+                                         int combinations)
+{
+    for (int i = 0; i < ZORDER_INDEX_COUNT; i++) {
+        mZOrderTable[dsp][i].clear();
+        mZOrderMaxPlanes[dsp][i] = 0;
+    }
+
+    for (int i = 0; i < combinations; i++) {
+        ZOrderCombination combination;
+        memset(&combination, 0, sizeof(combination));
+        combination.zorder = table[i].zorder;
+        combination.size = (int)strlen(table[i].zorder);
+        if (table[i].index < 0 || table[i].index >= ZORDER_INDEX_COUNT ||
+            combination.size > MAX_ZORDER_PLANES) {
+            ETRACE("invalid zorder description %s", table[i].zorder);
+            continue;
+        }
+
+        for (int j = 0; j < combination.size; j++) {
+            int nickname = table[i].zorder[j] - 'A';
+            combination.type[j] = PLANE_DESC[nickname].type;
+            combination.index[j] = PLANE_DESC[nickname].index;
+            combination.planeMask[j + 1] = combination.planeMask[j] | (1 << nickname);
+        }
+        mZOrderTable[dsp][table[i].index].push_back(combination);
+        if (mZOrderMaxPlanes[dsp][table[i].index] < combination.size)
+            mZOrderMaxPlanes[dsp][table[i].index] = combination.size;
+    }
+
+    // cheap enough to run on every initialization
+    if (!verifyZOrderTable(dsp, table, combinations)) {
+        ETRACE("compiled zorder table of pipe %d mismatches description", dsp);
+    }
+}
+
+bool AnnPlaneManager::verifyZOrderTable(int dsp, const ZOrderDescription *table,
+                                        int combinations)
+{
+    // nicknames of non-cursor planes, e.g. 'A' to 'H'
+    const int nicknames = PLANE_NICKNAME_BASE[DisplayPlane::PLANE_CURSOR];
+
+    for (int index = 0; index < ZORDER_INDEX_COUNT; index++) {
+        const Vector<ZOrderCombination>& candidates = mZOrderTable[dsp][index];
+
+        // candidates must keep the order of description table
+        size_t k = 0;
+        int maxPlanes = 0;
+        for (int i = 0; i < combinations; i++) {
+            if (table[i].index != index)
+                continue;
+            if (k >= candidates.size() ||
+                candidates.itemAt(k).zorder != table[i].zorder) {
+                return false;
+            }
+            if (maxPlanes < (int)strlen(table[i].zorder))
+                maxPlanes = (int)strlen(table[i].zorder);
+            k++;
+        }
+        if (k != candidates.size() || maxPlanes != mZOrderMaxPlanes[dsp][index]) {
+            return false;
+        }
+
+        // check plane availability against the description strings for
+        // every free plane state and every layer count
+        for (uint32_t state = 0; state < (1U << nicknames); state++) {
+            for (size_t i = 0; i < candidates.size(); i++) {
+                const ZOrderCombination& combination = candidates.itemAt(i);
+                for (int n = 0; n <= combination.size; n++) {
+                    bool expected = true;
+                    for (int j = 0; j < n; j++) {
+                        int nickname = combination.zorder[j] - 'A';
+                        if (!(state & (1 << nickname)))
+                            expected = false;
+                    }
+                    bool actual = !(combination.planeMask[n] & ~state);
+                    if (actual != expected) {
+                        return false;
+                    }
+                }
+            }
         }
     }
-    return count;
+    return true;
 }
 
 } // namespace intel
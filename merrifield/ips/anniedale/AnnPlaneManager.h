@@ -17,11 +17,14 @@
 #define ANN_PLANE_MANAGER_H
 
 #include <DisplayPlaneManager.h>
+#include <utils/Vector.h>
 #include <linux/psb_drm.h>
 
 namespace android {
 namespace intel {
 
+struct ZOrderDescription;
+
 class AnnPlaneManager : public DisplayPlaneManager {
 public:
     AnnPlaneManager();
@@ -36,9 +39,41 @@ public:
     // TODO: remove this API
     virtual void* getZOrderConfig() const;
 
+private:
+    enum {
+        MAX_ZORDER_PLANES = 4,
+        // overlay position mask of up to MAX_ZORDER_PLANES layers
+        ZORDER_INDEX_COUNT = 1 << MAX_ZORDER_PLANES,
+        ZORDER_PIPE_COUNT = 2,
+    };
+
+    // z order description compiled at initialization
+    struct ZOrderCombination {
+        const char *zorder;
+        int size;
+        int type[MAX_ZORDER_PLANES];
+        int index[MAX_ZORDER_PLANES];
+        // planes used by the first n layers, one bit per plane nickname
+        uint32_t planeMask[MAX_ZORDER_PLANES + 1];
+    };
+
 protected:
     DisplayPlane* allocPlane(int index, int type);
-    bool assignPlanes(int dsp, ZOrderConfig& config, const char *zorder);
+    bool assignPlanes(int dsp, ZOrderConfig& config,
+                      const ZOrderCombination& combination);
+    bool isPreferredZOrder(ZOrderConfig& config,
+                           const ZOrderCombination& combination);
+
+private:
+    void compileZOrderTable(int dsp, const ZOrderDescription *table, int combinations);
+    bool verifyZOrderTable(int dsp, const ZOrderDescription *table, int combinations);
+    uint32_t getFreePlaneMask();
+
+private:
+    // candidate combinations indexed by pipe and overlay position mask
+    Vector<ZOrderCombination> mZOrderTable[ZORDER_PIPE_COUNT][ZORDER_INDEX_COUNT];
+    // planes of the largest candidate, 0 if there is none
+    int mZOrderMaxPlanes[ZORDER_PIPE_COUNT][ZORDER_INDEX_COUNT];
 };
 
 } // namespace intel
@@ -24,10 +24,12 @@ namespace android {
 namespace intel {
 
 AnnRGBPlane::AnnRGBPlane(int index, int type, int disp)
-    : DisplayPlane(index, type, disp)
+    : DisplayPlane(index, type, disp),
+      mLastContextValid(false)
 {
     CTRACE();
     memset(&mContext, 0, sizeof(mContext));
+    memset(&mLastContext, 0, sizeof(mLastContext));
 }
 
 AnnRGBPlane::~AnnRGBPlane()
@@ -45,6 +47,12 @@ bool AnnRGBPlane::disable()
     return enablePlane(false);
 }
 
+bool AnnRGBPlane::reset()
+{
+    mLastContextValid = false;
+    return DisplayPlane::reset();
+}
+
 void* AnnRGBPlane::getContext() const
 {
     CTRACE();
@@ -180,10 +188,11 @@ bool AnnRGBPlane::setDataBuffer(BufferMapper& mapper)
     mContext.ctx.sp_ctx.size =
         ((dstH - 1) & 0xfff) << 16 | ((dstW - 1) & 0xfff);
     mContext.ctx.sp_ctx.contalpa = planeAlpha;
-    mContext.ctx.sp_ctx.update_mask = SPRITE_UPDATE_ALL;
+    mContext.ctx.sp_ctx.update_mask = calculateUpdateMask();
 
-    VTRACE("type = %d, index = %d, cntr = %#x, linoff = %#x, stride = %#x,"
+    VTRACE("type = %d, index = %d, mask = %#x, cntr = %#x, linoff = %#x, stride = %#x,"
           "surf = %#x, pos = %#x, size = %#x, contalpa = %#x", mType, mIndex,
+          mContext.ctx.sp_ctx.update_mask,
           mContext.ctx.sp_ctx.cntr,
           mContext.ctx.sp_ctx.linoff,
           mContext.ctx.sp_ctx.stride,
@@ -198,6 +207,9 @@ bool AnnRGBPlane::enablePlane(bool enabled)
 {
     RETURN_FALSE_IF_NOT_INIT();
 
+    // registers need to be fully programmed after enabling/disabling
+    mLastContextValid = false;
+
     struct drm_psb_register_rw_arg arg;
     memset(&arg, 0, sizeof(struct drm_psb_register_rw_arg));
     if (enabled) {
@@ -258,6 +270,44 @@ void AnnRGBPlane::postFlip()
     // skipping flip may cause flicking
 }
 
+void AnnRGBPlane::flipCommitted(bool committed)
+{
+    // masks are only relative to what the display actually latched,
+    // a rejected flip leaves the hardware state unknown
+    if (committed) {
+        mLastContext = mContext;
+        mLastContextValid = true;
+    } else {
+        mLastContextValid = false;
+    }
+}
+
+uint32_t AnnRGBPlane::calculateUpdateMask()
+{
+    const struct intel_dc_plane_ctx& last = mLastContext;
+    uint32_t mask = SPRITE_UPDATE_ALL;
+
+    if (mLastContextValid &&
+        last.type == mContext.type &&
+        last.ctx.sp_ctx.index == mContext.ctx.sp_ctx.index &&
+        last.ctx.sp_ctx.pipe == mContext.ctx.sp_ctx.pipe) {
+        // surface register latches the others, always write it
+        mask = SPRITE_UPDATE_SURFACE | SPRITE_UPDATE_WAIT_VBLANK;
+        if (last.ctx.sp_ctx.cntr != mContext.ctx.sp_ctx.cntr)
+            mask |= SPRITE_UPDATE_CONTROL;
+        if (last.ctx.sp_ctx.pos != mContext.ctx.sp_ctx.pos)
+            mask |= SPRITE_UPDATE_POSITION;
+        // stride is written along with size
+        if (last.ctx.sp_ctx.size != mContext.ctx.sp_ctx.size ||
+            last.ctx.sp_ctx.stride != mContext.ctx.sp_ctx.stride)
+            mask |= SPRITE_UPDATE_SIZE;
+        if (last.ctx.sp_ctx.contalpa != mContext.ctx.sp_ctx.contalpa)
+            mask |= SPRITE_UPDATE_CONSTALPHA;
+    }
+
+    return mask;
+}
+
 void AnnRGBPlane::setFramebufferTarget(buffer_handle_t handle)
 {
     uint32_t stride;
@@ -292,6 +342,7 @@ void AnnRGBPlane::setFramebufferTarget(buffer_handle_t handle)
 
     // FIXME: use sprite context for sprite plane
     mContext.ctx.prim_ctx.update_mask = SPRITE_UPDATE_ALL;
+    mLastContextValid = false;
     mContext.ctx.prim_ctx.index = mIndex;
     mContext.ctx.prim_ctx.pipe = mDevice;
 
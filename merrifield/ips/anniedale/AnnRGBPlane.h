@@ -36,7 +36,9 @@ public:
     bool enable();
     bool disable();
     bool isDisabled();
+    bool reset();
     void postFlip();
+    void flipCommitted(bool committed);
 
     void* getContext() const;
     void setZOrderConfig(ZOrderConfig& config, void *nativeConfig);
@@ -47,8 +49,12 @@ protected:
     bool enablePlane(bool enabled);
 private:
     void setFramebufferTarget(buffer_handle_t handle);
+    uint32_t calculateUpdateMask();
 protected:
     struct intel_dc_plane_ctx mContext;
+    // sprite context last handed to the kernel
+    struct intel_dc_plane_ctx mLastContext;
+    bool mLastContextValid;
 };
 
 } // namespace intel
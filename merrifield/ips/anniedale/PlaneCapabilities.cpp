@@ -20,6 +20,7 @@
 #include <OMX_IVCommon.h>
 #include <OMX_IntelVideoExt.h>
 #include <PlaneCapabilities.h>
+#include <common/PixelFormat.h>
 #include <common/OverlayHardware.h>
 #include <HwcLayer.h>
 #include <BufferManager.h>
@@ -39,38 +40,28 @@ bool PlaneCapabilities::isFormatSupported(int planeType, HwcLayer *hwcLayer)
 {
     uint32_t format = hwcLayer->getFormat();
     uint32_t trans = hwcLayer->getLayer()->transform;
+    const PixelFormat::FormatDescriptor *desc = PixelFormat::getDescriptor(format);
 
     if (planeType == DisplayPlane::PLANE_SPRITE || planeType == DisplayPlane::PLANE_PRIMARY) {
-        switch (format) {
-        case HAL_PIXEL_FORMAT_BGRA_8888:
-        case HAL_PIXEL_FORMAT_BGRX_8888:
-        case HAL_PIXEL_FORMAT_RGBA_8888:
-        case HAL_PIXEL_FORMAT_RGBX_8888:
-        case HAL_PIXEL_FORMAT_RGB_565:
-            return trans ? false : true;
-        default:
+        if (!desc || !(desc->flags & PixelFormat::FORMAT_SPRITE)) {
             VTRACE("unsupported format %#x", format);
             return false;
         }
+        return trans ? false : true;
     } else if (planeType == DisplayPlane::PLANE_OVERLAY) {
-        switch (format) {
-        case HAL_PIXEL_FORMAT_I420:
-        case HAL_PIXEL_FORMAT_YUY2:
-        case HAL_PIXEL_FORMAT_UYVY:
-            // TODO: overlay supports 180 degree rotation
-            if (trans == HAL_TRANSFORM_ROT_180) {
-                WTRACE("180 degree rotation is not supported yet");
-            }
-            return trans ? false : true;
-        case HAL_PIXEL_FORMAT_YV12:
-        case HAL_PIXEL_FORMAT_NV12:
-        case OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar:
-        case OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar_Tiled:
-            return true;
-        default:
+        if (!desc || !(desc->flags & PixelFormat::FORMAT_OVERLAY)) {
             VTRACE("unsupported format %#x", format);
             return false;
         }
+        if ((desc->flags & PixelFormat::FORMAT_OVERLAY_ROTATION) ||
+            format == HAL_PIXEL_FORMAT_YV12) {
+            return true;
+        }
+        // TODO: overlay supports 180 degree rotation
+        if (trans == HAL_TRANSFORM_ROT_180) {
+            WTRACE("180 degree rotation is not supported yet");
+        }
+        return trans ? false : true;
     } else {
         ETRACE("invalid plane type %d", planeType);
         return false;
@@ -84,46 +75,28 @@ bool PlaneCapabilities::isSizeSupported(int planeType, HwcLayer *hwcLayer)
     uint32_t h = hwcLayer->getBufferHeight();
     const stride_t& stride = hwcLayer->getBufferStride();
 
-    bool isYUVPacked;
+    const PixelFormat::FormatDescriptor *desc = PixelFormat::getDescriptor(format);
     uint32_t maxStride;
 
     if (planeType == DisplayPlane::PLANE_SPRITE || planeType == DisplayPlane::PLANE_PRIMARY) {
-        switch (format) {
-        case HAL_PIXEL_FORMAT_BGRA_8888:
-        case HAL_PIXEL_FORMAT_BGRX_8888:
-        case HAL_PIXEL_FORMAT_RGBA_8888:
-        case HAL_PIXEL_FORMAT_RGBX_8888:
-        case HAL_PIXEL_FORMAT_RGB_565:
-            VTRACE("stride %d", stride.rgb.stride);
-            if (stride.rgb.stride > SPRITE_PLANE_MAX_STRIDE_LINEAR) {
-                VTRACE("too large stride %d", stride.rgb.stride);
-                return false;
-            }
-            return true;
-        default:
+        if (!desc || !(desc->flags & PixelFormat::FORMAT_SPRITE)) {
             VTRACE("unsupported format %#x", format);
             return false;
         }
+        VTRACE("stride %d", stride.rgb.stride);
+        if (stride.rgb.stride > SPRITE_PLANE_MAX_STRIDE_LINEAR) {
+            VTRACE("too large stride %d", stride.rgb.stride);
+            return false;
+        }
+        return true;
     } else if (planeType == DisplayPlane::PLANE_OVERLAY) {
-        switch (format) {
-        case HAL_PIXEL_FORMAT_YV12:
-        case HAL_PIXEL_FORMAT_I420:
-        case HAL_PIXEL_FORMAT_NV12:
-        case OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar:
-        case OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar_Tiled:
-            isYUVPacked = false;
-            break;
-        case HAL_PIXEL_FORMAT_YUY2:
-        case HAL_PIXEL_FORMAT_UYVY:
-            isYUVPacked = true;
-            break;
-        default:
+        if (!desc || !(desc->flags & PixelFormat::FORMAT_OVERLAY)) {
             VTRACE("unsupported format %#x", format);
             return false;
         }
         // don't use overlay plane if stride is too big
         maxStride = OVERLAY_PLANE_MAX_STRIDE_LINEAR;
-        if (isYUVPacked) {
+        if (desc->flags & PixelFormat::FORMAT_PACKED) {
             maxStride = OVERLAY_PLANE_MAX_STRIDE_PACKED;
         }
 
@@ -226,11 +199,6 @@ bool PlaneCapabilities::isScalingSupported(int planeType, HwcLayer *hwcLayer)
         }
 
         if (!hwcLayer->isProtected()) {
-            if ((int)src.left & 63) {
-                DTRACE("offset %d is not 64 bytes aligned, fall back to GLES", (int)src.left);
-                return false;
-            }
-
             float scaleX = (float)srcW / dstW;
             float scaleY = (float)srcH / dstH;
             if (scaleX >= 3 || scaleY >= 3) {
@@ -254,6 +222,19 @@ bool PlaneCapabilities::isScalingSupported(int planeType, HwcLayer *hwcLayer)
     }
 }
 
+bool PlaneCapabilities::isOffsetSupported(int planeType, HwcLayer *hwcLayer)
+{
+    hwc_frect_t& src = hwcLayer->getLayer()->sourceCropf;
+
+    if (planeType == DisplayPlane::PLANE_OVERLAY && !hwcLayer->isProtected()) {
+        if ((int)src.left & 63) {
+            DTRACE("offset %d is not 64 bytes aligned, fall back to GLES", (int)src.left);
+            return false;
+        }
+    }
+    return true;
+}
+
 bool PlaneCapabilities::isTransformSupported(int planeType, HwcLayer *hwcLayer)
 {
     uint32_t trans = hwcLayer->getLayer()->transform;
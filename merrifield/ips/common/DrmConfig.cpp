@@ -17,6 +17,7 @@
 #include <IDisplayDevice.h>
 #include <Drm.h>
 #include <DrmConfig.h>
+#include <common/PixelFormat.h>
 
 
 namespace android {
@@ -77,13 +78,12 @@ const char* DrmConfig::getRepeatedFrameString()
 
 uint32_t DrmConfig::convertHalFormatToDrmFormat(uint32_t halFormat)
 {
-    switch (halFormat) {
-        case HAL_PIXEL_FORMAT_RGBX_8888:
-            return DRM_FORMAT_XRGB8888;
-        default:
-            ETRACE("format %#x isn't supported by drm", halFormat);
-            return 0;
+    const PixelFormat::FormatDescriptor *desc = PixelFormat::getDescriptor(halFormat);
+    if (!desc || !desc->drmFormat) {
+        ETRACE("format %#x isn't supported by drm", halFormat);
+        return 0;
     }
+    return desc->drmFormat;
 }
 
 } // namespace intel
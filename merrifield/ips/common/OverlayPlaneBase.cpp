@@ -15,6 +15,8 @@
 */
 
 #include <math.h>
+#include <stddef.h>
+#include <unistd.h>
 #include <HwcTrace.h>
 #include <Drm.h>
 #include <Hwcomposer.h>
@@ -35,8 +37,16 @@ namespace intel {
 OverlayPlaneBase::OverlayPlaneBase(int index, int disp)
     : DisplayPlane(index, PLANE_OVERLAY, disp),
       mTTMBuffers(),
+      mTTMBufferLru(),
+      mTTMBufferLruIndex(),
+      mEvictedTTMBuffers(),
+      mTTMBufferCapacity(OVERLAY_DATA_BUFFER_COUNT),
+      mTTMBufferEvictions(0),
+      mTTMBufferRemaps(0),
       mActiveTTMBuffers(),
+      mIdleFenceFd(-1),
       mCurrent(0),
+      mCoeffBuffer(-1),
       mWsbm(0),
       mPipeConfig(0),
       mBobDeinterlace(0),
@@ -86,6 +96,7 @@ bool OverlayPlaneBase::initialize(uint32_t bufferCount)
         // reset back buffer
         resetBackBuffer(i);
     }
+    commitBackBuffers();
 
     // disable overlay when created
     flush(PLANE_DISABLE);
@@ -229,6 +240,8 @@ bool OverlayPlaneBase::reset()
     for (int i = 0; i < OVERLAY_BACK_BUFFER_COUNT; i++) {
         resetBackBuffer(i);
     }
+    commitBackBuffers();
+    invalidateCoeffs();
     return true;
 }
 
@@ -245,6 +258,8 @@ bool OverlayPlaneBase::enable()
 
         backBuffer->OCMD |= 0x1;
     }
+    commitBackBuffers();
+    invalidateCoeffs();
 
     // flush
     flush(PLANE_ENABLE);
@@ -264,9 +279,14 @@ bool OverlayPlaneBase::disable()
 
         backBuffer->OCMD &= ~0x1;
     }
+    commitBackBuffers();
+    invalidateCoeffs();
 
     // flush
     flush(PLANE_DISABLE);
+
+    // idle pooled buffers are not needed until the plane is used again
+    mWsbm->trimPool();
     return true;
 }
 
@@ -283,18 +303,37 @@ OverlayBackBuffer* OverlayPlaneBase::createBackBuffer()
 
 
     int size = sizeof(OverlayBackBufferBlk);
+
+    // registers are programmed in cached memory and only the changed
+    // dwords are copied to the TTM buffer on commit
+    backBuffer->buf = (OverlayBackBufferBlk *)calloc(1, size);
+    backBuffer->shadow = (OverlayBackBufferBlk *)calloc(1, size);
+    if (!backBuffer->buf || !backBuffer->shadow) {
+        ETRACE("failed to allocate back buffer copies");
+        free(backBuffer->buf);
+        free(backBuffer->shadow);
+        free(backBuffer);
+        return 0;
+    }
+
     int alignment = 64 * 1024;
     void *wsbmBufferObject = 0;
     bool ret = mWsbm->allocateTTMBuffer(size, alignment, &wsbmBufferObject);
     if (ret == false) {
         ETRACE("failed to allocate TTM buffer");
+        free(backBuffer->buf);
+        free(backBuffer->shadow);
+        free(backBuffer);
         return 0;
     }
 
     void *virtAddr = mWsbm->getCPUAddress(wsbmBufferObject);
     uint32_t gttOffsetInPage = mWsbm->getGttOffset(wsbmBufferObject);
 
-    backBuffer->buf = (OverlayBackBufferBlk *)virtAddr;
+    // keep hardware copy in sync with the zeroed shadow
+    memset(virtAddr, 0, size);
+
+    backBuffer->hwBuf = (OverlayBackBufferBlk *)virtAddr;
     backBuffer->gttOffsetInPage = gttOffsetInPage;
     backBuffer->bufObject = wsbmBufferObject;
 
@@ -314,6 +353,8 @@ void OverlayPlaneBase::deleteBackBuffer(int buf)
         WTRACE("failed to destroy TTM buffer");
     }
     // free back buffer
+    free(mBackBuffer[buf]->buf);
+    free(mBackBuffer[buf]->shadow);
     free(mBackBuffer[buf]);
     mBackBuffer[buf] = 0;
 }
@@ -342,6 +383,67 @@ void OverlayPlaneBase::resetBackBuffer(int buf)
     backBuffer->SCHRKEN |= 0xff;
 }
 
+uint32_t OverlayPlaneBase::commitBackBuffer(int buf)
+{
+    if (!mBackBuffer[buf] || !mBackBuffer[buf]->buf)
+        return 0;
+
+    const uint32_t *src = (const uint32_t *)mBackBuffer[buf]->buf;
+    uint32_t *shadow = (uint32_t *)mBackBuffer[buf]->shadow;
+    volatile uint32_t *dst = (volatile uint32_t *)mBackBuffer[buf]->hwBuf;
+    const int regCount = offsetof(OverlayBackBufferBlk, RESERVEDC) / 4;
+    const int coeffStart = offsetof(OverlayBackBufferBlk, Y_VCOEFS) / 4;
+    const int count = sizeof(OverlayBackBufferBlk) / 4;
+    uint32_t dirty = 0;
+    int written = 0;
+
+    // only touch the uncached TTM buffer where contents changed
+    for (int i = 0; i < count; i++) {
+        if (src[i] == shadow[i])
+            continue;
+        shadow[i] = src[i];
+        dst[i] = src[i];
+        written++;
+        if (i < regCount)
+            dirty |= BACK_BUFFER_DIRTY_REGS;
+        else if (i >= coeffStart)
+            dirty |= BACK_BUFFER_DIRTY_COEFS;
+    }
+
+    VTRACE("back buffer %d, %d dwords written, dirty %#x", buf, written, dirty);
+    return dirty;
+}
+
+void OverlayPlaneBase::commitBackBuffers()
+{
+    for (int i = 0; i < OVERLAY_BACK_BUFFER_COUNT; i++) {
+        commitBackBuffer(i);
+    }
+}
+
+bool OverlayPlaneBase::commitFlipBackBuffer()
+{
+    uint32_t dirty = commitBackBuffer(mCurrent);
+    bool load;
+
+    if (mCoeffBuffer < 0) {
+        load = true;
+    } else if (mCoeffBuffer == mCurrent) {
+        load = (dirty & BACK_BUFFER_DIRTY_COEFS) != 0;
+    } else {
+        // loaded coefficients came from another back buffer
+        const size_t offset = offsetof(OverlayBackBufferBlk, Y_VCOEFS);
+        load = memcmp((uint8_t *)mBackBuffer[mCurrent]->shadow + offset,
+                      (uint8_t *)mBackBuffer[mCoeffBuffer]->shadow + offset,
+                      sizeof(OverlayBackBufferBlk) - offset) != 0;
+    }
+
+    if (load) {
+        mCoeffBuffer = mCurrent;
+    }
+    return load;
+}
+
 BufferMapper* OverlayPlaneBase::getTTMMapper(BufferMapper& grallocMapper, struct VideoPayloadBuffer *payload)
 {
     buffer_handle_t khandle;
@@ -375,6 +477,7 @@ BufferMapper* OverlayPlaneBase::getTTMMapper(BufferMapper& grallocMapper, struct
     index = mTTMBuffers.indexOfKey(khandle);
     if (index < 0) {
         VTRACE("unmapped TTM buffer, will map it");
+        checkTTMBufferRemap(khandle);
 
         if (mUseScaledBuffer) {
             w = payload->scaling_width;
@@ -464,8 +567,8 @@ BufferMapper* OverlayPlaneBase::getTTMMapper(BufferMapper& grallocMapper, struct
                 }
             }
 
-            if (mTTMBuffers.size() >= OVERLAY_DATA_BUFFER_COUNT) {
-                invalidateTTMBuffers();
+            while (mTTMBuffers.size() >= mTTMBufferCapacity) {
+                evictTTMBuffer();
             }
 
             // add mapper
@@ -474,6 +577,7 @@ BufferMapper* OverlayPlaneBase::getTTMMapper(BufferMapper& grallocMapper, struct
                 ETRACE("failed to add TTMMapper");
                 break;
             }
+            touchTTMBuffer(khandle);
 
             // increase mapper refCount since it is added to mTTMBuffers
             mapper->incRef();
@@ -492,6 +596,7 @@ BufferMapper* OverlayPlaneBase::getTTMMapper(BufferMapper& grallocMapper, struct
     } else {
         VTRACE("got mapper in saved ttm buffers");
         mapper = reinterpret_cast<TTMBufferMapper *>(mTTMBuffers.valueAt(index));
+        touchTTMBuffer(khandle);
         if (mapper->getCrop().x != srcX || mapper->getCrop().y != srcY ||
             mapper->getCrop().w != srcW || mapper->getCrop().h != srcH) {
             if(!mUseScaledBuffer)
@@ -561,6 +666,17 @@ void OverlayPlaneBase::invalidateActiveTTMBuffers()
 
     // clear recorded data buffers
     mActiveTTMBuffers.clear();
+    if (mIdleFenceFd >= 0) {
+        close(mIdleFenceFd);
+        mIdleFenceFd = -1;
+    }
+}
+
+int OverlayPlaneBase::takeFlipFence()
+{
+    int fenceFd = mIdleFenceFd;
+    mIdleFenceFd = -1;
+    return fenceFd;
 }
 
 void OverlayPlaneBase::invalidateTTMBuffers()
@@ -572,6 +688,82 @@ void OverlayPlaneBase::invalidateTTMBuffers()
         putTTMMapper(mapper);
     }
     mTTMBuffers.clear();
+    mTTMBufferLru.clear();
+    mTTMBufferLruIndex.clear();
+    mEvictedTTMBuffers.clear();
+}
+
+void OverlayPlaneBase::touchTTMBuffer(buffer_handle_t khandle)
+{
+    // move to the most recently used end
+    List<buffer_handle_t>::iterator it =
+        mTTMBufferLru.insert(mTTMBufferLru.end(), khandle);
+    ssize_t index = mTTMBufferLruIndex.indexOfKey(khandle);
+    if (index >= 0) {
+        mTTMBufferLru.erase(mTTMBufferLruIndex.valueAt(index));
+        mTTMBufferLruIndex.editValueAt(index) = it;
+    } else {
+        mTTMBufferLruIndex.add(khandle, it);
+    }
+}
+
+void OverlayPlaneBase::evictTTMBuffer()
+{
+    if (mTTMBufferLru.empty()) {
+        // should not happen, fall back to dropping all buffers
+        WTRACE("TTM buffer LRU is out of sync");
+        invalidateTTMBuffers();
+        return;
+    }
+
+    buffer_handle_t khandle = *mTTMBufferLru.begin();
+    mTTMBufferLru.erase(mTTMBufferLru.begin());
+    mTTMBufferLruIndex.removeItem(khandle);
+
+    ssize_t index = mTTMBuffers.indexOfKey(khandle);
+    if (index >= 0) {
+        // active buffers hold their own reference
+        putTTMMapper(mTTMBuffers.valueAt(index));
+        mTTMBuffers.removeItemsAt(index);
+    }
+
+    // remember evicted key to detect a pool larger than the cache
+    if (mEvictedTTMBuffers.size() >= OVERLAY_DATA_BUFFER_MAX) {
+        mEvictedTTMBuffers.removeAt(0);
+    }
+    mEvictedTTMBuffers.push_back(khandle);
+    mTTMBufferEvictions++;
+    VTRACE("evicted TTM buffer %p", khandle);
+}
+
+void OverlayPlaneBase::checkTTMBufferRemap(buffer_handle_t khandle)
+{
+    for (size_t i = 0; i < mEvictedTTMBuffers.size(); i++) {
+        if (mEvictedTTMBuffers.itemAt(i) != khandle)
+            continue;
+
+        // an evicted buffer came back, grow cache to the decoder pool
+        mEvictedTTMBuffers.removeAt(i);
+        mTTMBufferRemaps++;
+        if (mTTMBufferCapacity < OVERLAY_DATA_BUFFER_MAX) {
+            mTTMBufferCapacity++;
+            DTRACE("overlay %d TTM buffer cache grows to %u",
+                   mIndex, mTTMBufferCapacity);
+        }
+        return;
+    }
+}
+
+void OverlayPlaneBase::dump(Dump& d)
+{
+    DisplayPlane::dump(d);
+    d.append("Overlay %d TTM buffers: cached %zu, capacity %u, "
+             "evictions %u, remaps %u\n",
+             mIndex, mTTMBuffers.size(), mTTMBufferCapacity,
+             mTTMBufferEvictions, mTTMBufferRemaps);
+    if (mWsbm) {
+        mWsbm->dump(d);
+    }
 }
 
 
@@ -1303,6 +1495,10 @@ bool OverlayPlaneBase::setDataBuffer(BufferMapper& grallocMapper)
     // add to active ttm buffers if it's a rotated buffer
     if (videoBufferMapper) {
         updateActiveTTMBuffers(mapper);
+        // rotated or scaled buffer may still be written by VSP
+        if (mIdleFenceFd >= 0)
+            close(mIdleFenceFd);
+        mIdleFenceFd = static_cast<TTMBufferMapper *>(mapper)->dupIdleFence();
     }
 
     mUseScaledBuffer = 0;
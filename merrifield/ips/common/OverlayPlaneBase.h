@@ -17,6 +17,7 @@
 #define OVERLAY_PLANE_BASE_H
 
 #include <utils/KeyedVector.h>
+#include <utils/List.h>
 #include <hal_public.h>
 #include <DisplayPlane.h>
 #include <BufferMapper.h>
@@ -28,7 +29,12 @@ namespace android {
 namespace intel {
 
 typedef struct {
+    // cached working copy, all register setup goes here
     OverlayBackBufferBlk *buf;
+    // TTM buffer fetched by overlay hardware
+    OverlayBackBufferBlk *hwBuf;
+    // last contents written to hwBuf
+    OverlayBackBufferBlk *shadow;
     uint32_t gttOffsetInPage;
     void* bufObject;
 } OverlayBackBuffer;
@@ -46,6 +52,7 @@ public:
 
     // plane operations
     virtual bool flip(void *ctx) = 0;
+    virtual int takeFlipFence();
     virtual bool reset();
     virtual bool enable();
     virtual bool disable();
@@ -55,6 +62,8 @@ public:
     virtual bool initialize(uint32_t bufferCount);
     virtual void deinitialize();
 
+    virtual void dump(Dump& d);
+
 protected:
     // generic overlay register flush
     virtual bool flush(uint32_t flags) = 0;
@@ -78,6 +87,13 @@ protected:
     virtual OverlayBackBuffer* createBackBuffer();
     virtual void deleteBackBuffer(int buf);
     virtual void resetBackBuffer(int buf);
+    // write changed dwords of back buffer to hardware, returns dirty mask
+    uint32_t commitBackBuffer(int buf);
+    void commitBackBuffers();
+    // commit current back buffer for flip, returns true if overlay
+    // needs to load filter coefficients from it
+    bool commitFlipBackBuffer();
+    void invalidateCoeffs() { mCoeffBuffer = -1; }
 
     virtual BufferMapper* getTTMMapper(BufferMapper& grallocMapper, struct VideoPayloadBuffer *payload);
     virtual void  putTTMMapper(BufferMapper* mapper);
@@ -90,6 +106,9 @@ private:
     void updateActiveTTMBuffers(BufferMapper *mapper);
     void invalidateActiveTTMBuffers();
     void invalidateTTMBuffers();
+    void touchTTMBuffer(buffer_handle_t khandle);
+    void evictTTMBuffer();
+    void checkTTMBufferRemap(buffer_handle_t khandle);
 
 protected:
     // flush flags
@@ -99,20 +118,42 @@ protected:
         UPDATE_COEF      = 0x00000004UL,
     };
 
+    // back buffer dirty regions
+    enum {
+        BACK_BUFFER_DIRTY_REGS   = 0x00000001UL,
+        BACK_BUFFER_DIRTY_COEFS  = 0x00000002UL,
+    };
+
     enum {
         OVERLAY_BACK_BUFFER_COUNT = 3,
         MAX_ACTIVE_TTM_BUFFERS = 3,
         OVERLAY_DATA_BUFFER_COUNT = 20,
+        OVERLAY_DATA_BUFFER_MAX = 64,
     };
 
     // TTM data buffers
     KeyedVector<buffer_handle_t, BufferMapper*> mTTMBuffers;
+    // TTM data buffer keys, least recently used first, and the position
+    // of each cached key in it
+    List<buffer_handle_t> mTTMBufferLru;
+    KeyedVector<buffer_handle_t, List<buffer_handle_t>::iterator> mTTMBufferLruIndex;
+    // keys of TTM data buffers evicted from cache
+    Vector<buffer_handle_t> mEvictedTTMBuffers;
+    // cache capacity, grows with the decoder surface pool
+    uint32_t mTTMBufferCapacity;
+    uint32_t mTTMBufferEvictions;
+    uint32_t mTTMBufferRemaps;
     // latest TTM buffers
     Vector<BufferMapper*> mActiveTTMBuffers;
+    // idle fence of the TTM buffer set by setDataBuffer, the display waits
+    // for it instead of the caller of flip
+    int mIdleFenceFd;
 
     // overlay back buffer
     OverlayBackBuffer *mBackBuffer[OVERLAY_BACK_BUFFER_COUNT];
     int mCurrent;
+    // back buffer whose coefficients were last loaded, -1 if unknown
+    int mCoeffBuffer;
     // wsbm
     Wsbm *mWsbm;
     // pipe config
@@ -14,39 +14,83 @@
 // limitations under the License.
 */
 #include <hal_public.h>
-#include <HwcTrace.h>
-#include <common/PixelFormat.h>
+#include <OMX_IVCommon.h>
+#include <OMX_IntelVideoExt.h>
+#include <drm_fourcc.h>
+#include "PixelFormat.h"
 
 namespace android {
 namespace intel {
 
-bool PixelFormat::convertFormat(uint32_t grallocFormat, uint32_t& spriteFormat, int& bpp)
+// Shared by merrifield and moorefield_hdmi. One entry per gralloc format:
+// sprite format, drm format, bytes per pixel and flags. The list expands
+// to both the descriptor table and the case labels of getDescriptor, so
+// a format listed twice fails to compile.
+#define PIXEL_FORMATS(F) \
+    /* RGB */ \
+    F(HAL_PIXEL_FORMAT_RGBA_8888, PLANE_PIXEL_FORMAT_RGBA8888, 0, \
+        4, FORMAT_RGB | FORMAT_SPRITE) \
+    F(HAL_PIXEL_FORMAT_RGBX_8888, PLANE_PIXEL_FORMAT_RGBX8888, DRM_FORMAT_XRGB8888, \
+        4, FORMAT_RGB | FORMAT_SPRITE) \
+    F(HAL_PIXEL_FORMAT_BGRA_8888, PLANE_PIXEL_FORMAT_BGRA8888, 0, \
+        4, FORMAT_RGB | FORMAT_SPRITE) \
+    F(HAL_PIXEL_FORMAT_BGRX_8888, PLANE_PIXEL_FORMAT_BGRX8888, 0, \
+        4, FORMAT_RGB | FORMAT_SPRITE) \
+    F(HAL_PIXEL_FORMAT_RGB_565, PLANE_PIXEL_FORMAT_BGRX565, 0, \
+        2, FORMAT_RGB | FORMAT_SPRITE) \
+    F(HAL_PIXEL_FORMAT_RGB_888, 0, 0, \
+        3, FORMAT_RGB) \
+    /* packed YUV */ \
+    F(HAL_PIXEL_FORMAT_YUY2, 0, 0, \
+        2, FORMAT_YUV | FORMAT_PACKED | FORMAT_OVERLAY) \
+    F(HAL_PIXEL_FORMAT_UYVY, 0, 0, \
+        2, FORMAT_YUV | FORMAT_PACKED | FORMAT_OVERLAY) \
+    /* planar YUV */ \
+    F(HAL_PIXEL_FORMAT_I420, 0, 0, \
+        1, FORMAT_YUV | FORMAT_PLANAR | FORMAT_OVERLAY) \
+    F(HAL_PIXEL_FORMAT_YV12, 0, 0, \
+        1, FORMAT_YUV | FORMAT_PLANAR | FORMAT_OVERLAY) \
+    F(HAL_PIXEL_FORMAT_NV21, 0, 0, \
+        1, FORMAT_YUV | FORMAT_PLANAR) \
+    F(HAL_PIXEL_FORMAT_NV12, 0, 0, \
+        1, FORMAT_YUV | FORMAT_PLANAR | FORMAT_OVERLAY | FORMAT_OVERLAY_ROTATION) \
+    F(OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar, 0, 0, \
+        1, FORMAT_YUV | FORMAT_PLANAR | FORMAT_OVERLAY | FORMAT_OVERLAY_ROTATION) \
+    F(OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar_Tiled, 0, 0, \
+        1, FORMAT_YUV | FORMAT_PLANAR | FORMAT_OVERLAY | FORMAT_OVERLAY_ROTATION)
+
+#define FORMAT_INDEX(hal, sprite, drm, bpp, flags) FORMAT_INDEX_##hal,
+#define FORMAT_ENTRY(hal, sprite, drm, bpp, flags) { hal, sprite, drm, bpp, flags },
+#define FORMAT_CASE(hal, sprite, drm, bpp, flags) \
+    case hal: return &sFormatTable[FORMAT_INDEX_##hal];
+
+enum {
+    PIXEL_FORMATS(FORMAT_INDEX)
+};
+
+// constant initialized, there is nothing to build at load time
+const PixelFormat::FormatDescriptor PixelFormat::sFormatTable[] = {
+    PIXEL_FORMATS(FORMAT_ENTRY)
+};
+
+const PixelFormat::FormatDescriptor* PixelFormat::getDescriptor(uint32_t grallocFormat)
 {
     switch (grallocFormat) {
-    case HAL_PIXEL_FORMAT_RGBA_8888:
-        spriteFormat = PLANE_PIXEL_FORMAT_RGBA8888;
-        bpp = 4;
-        break;
-    case HAL_PIXEL_FORMAT_RGBX_8888:
-        spriteFormat = PLANE_PIXEL_FORMAT_RGBX8888;
-        bpp = 4;
-        break;
-    case HAL_PIXEL_FORMAT_BGRX_8888:
-        spriteFormat = PLANE_PIXEL_FORMAT_BGRX8888;
-        bpp = 4;
-        break;
-    case HAL_PIXEL_FORMAT_BGRA_8888:
-        spriteFormat = PLANE_PIXEL_FORMAT_BGRA8888;
-        bpp = 4;
-        break;
-    case HAL_PIXEL_FORMAT_RGB_565:
-        spriteFormat = PLANE_PIXEL_FORMAT_BGRX565;
-        bpp = 2;
-        break;
+    PIXEL_FORMATS(FORMAT_CASE)
     default:
+        return 0;
+    }
+}
+
+bool PixelFormat::convertFormat(uint32_t grallocFormat, uint32_t& spriteFormat, int& bpp)
+{
+    const FormatDescriptor *desc = getDescriptor(grallocFormat);
+    if (!desc || !desc->spriteFormat) {
         return false;
     }
 
+    spriteFormat = desc->spriteFormat;
+    bpp = desc->bpp;
     return true;
 }
 
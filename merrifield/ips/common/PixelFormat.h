@@ -16,6 +16,8 @@
 #ifndef PIXEL_FORMAT_H
 #define PIXEL_FORMAT_H
 
+#include <stdint.h>
+
 namespace android {
 namespace intel {
 
@@ -30,9 +32,34 @@ public:
         PLANE_PIXEL_FORMAT_RGBA8888 = 0x3c000000UL,
     };
 
+    // format facts, see FormatDescriptor::flags
+    enum {
+        FORMAT_RGB              = 0x01,
+        FORMAT_YUV              = 0x02,
+        FORMAT_PLANAR           = 0x04, // separate luma and chroma planes
+        FORMAT_PACKED           = 0x08, // packed YUV 4:2:2
+        FORMAT_SPRITE           = 0x10, // scanned out by sprite/primary planes
+        FORMAT_OVERLAY          = 0x20, // scanned out by overlay planes
+        FORMAT_OVERLAY_ROTATION = 0x40, // overlay rotates it through a rotated buffer
+    };
+
+    struct FormatDescriptor {
+        uint32_t halFormat;
+        uint32_t spriteFormat;  // 0 if not a sprite format
+        uint32_t drmFormat;     // 0 if not a drm framebuffer format
+        uint8_t bpp;            // bytes per pixel, of the luma plane for planar YUV
+        uint8_t flags;
+    };
+
+    // descriptor of a gralloc color format, NULL if the format is unknown
+    static const FormatDescriptor* getDescriptor(uint32_t grallocFormat);
+
     // convert gralloc color format to IP specific sprite pixel format.
     // See DSPACNTR (Display A Primary Sprite Control Register for more information)
     static bool convertFormat(uint32_t grallocFormat, uint32_t& spriteFormat, int& bpp);
+
+private:
+    static const FormatDescriptor sFormatTable[];
 };
 
 } // namespace intel
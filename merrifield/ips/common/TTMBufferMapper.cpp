@@ -13,7 +13,9 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 */
+#include <unistd.h>
 #include <HwcTrace.h>
+#include <sync/sync.h>
 #include <common/TTMBufferMapper.h>
 
 namespace android {
@@ -26,7 +28,8 @@ TTMBufferMapper::TTMBufferMapper(Wsbm& wsbm, DataBuffer& buffer)
       mBufferObject(0),
       mGttOffsetInPage(0),
       mCpuAddress(0),
-      mSize(0)
+      mSize(0),
+      mIdleFenceFd(-1)
 {
     CTRACE();
 }
@@ -34,6 +37,7 @@ TTMBufferMapper::TTMBufferMapper(Wsbm& wsbm, DataBuffer& buffer)
 TTMBufferMapper::~TTMBufferMapper()
 {
     CTRACE();
+    waitIdleFence();
 }
 
 bool TTMBufferMapper::map()
@@ -53,11 +57,15 @@ bool TTMBufferMapper::map()
         return false;
     }
 
-    // TODO: review this later
-    ret = mWsbm.waitIdleTTMBuffer(wsbmBufferObject);
-    if (ret == false) {
-        ETRACE("failed to wait ttm buffer idle");
-        return false;
+    // wait idle on the wsbm worker, the fence is consumed before the
+    // buffer is flipped. Fall back to a blocking wait if it can't be queued
+    mIdleFenceFd = mWsbm.waitIdleTTMBufferAsync(wsbmBufferObject);
+    if (mIdleFenceFd < 0) {
+        ret = mWsbm.waitIdleTTMBuffer(wsbmBufferObject);
+        if (ret == false) {
+            ETRACE("failed to wait ttm buffer idle");
+            return false;
+        }
     }
 
     virtAddr = mWsbm.getCPUAddress(wsbmBufferObject);
@@ -65,6 +73,7 @@ bool TTMBufferMapper::map()
 
     if (!gttOffsetInPage || !virtAddr) {
         WTRACE("offset = %#x, addr = %p.", gttOffsetInPage, virtAddr);
+        waitIdleFence();
         return false;
     }
 
@@ -83,6 +92,8 @@ bool TTMBufferMapper::unmap()
     if (!mBufferObject)
         return false;
 
+    // worker may still reference the buffer object
+    waitIdleFence();
     mWsbm.unreferenceTTMBuffer(mBufferObject);
 
     mGttOffsetInPage = 0;
@@ -94,9 +105,37 @@ bool TTMBufferMapper::unmap()
 
 bool TTMBufferMapper::waitIdle()
 {
+    if (mIdleFenceFd >= 0) {
+        return waitIdleFence();
+    }
     return mWsbm.waitIdleTTMBuffer(mBufferObject);
 }
 
+int TTMBufferMapper::dupIdleFence()
+{
+    // the mapper keeps its own fence, unmap() must not run ahead of the
+    // idle thread
+    if (mIdleFenceFd < 0)
+        return -1;
+    return dup(mIdleFenceFd);
+}
+
+bool TTMBufferMapper::waitIdleFence()
+{
+    if (mIdleFenceFd < 0)
+        return true;
+
+    int err = sync_wait(mIdleFenceFd, IDLE_FENCE_TIMEOUT);
+    if (err < 0) {
+        // wait again without timeout, buffer object lifetime depends on it
+        WTRACE("idle fence timeout, waiting for ttm buffer");
+        err = sync_wait(mIdleFenceFd, -1);
+    }
+    close(mIdleFenceFd);
+    mIdleFenceFd = -1;
+    return err == 0;
+}
+
 } // namespace intel
 } // namespace android
 
@@ -52,7 +52,14 @@ public:
 
     // wait idle
     bool waitIdle();
+    // wait for the idle fence queued by map(), no-op if none is pending
+    bool waitIdleFence();
+    // duplicate of the pending idle fence for the caller, -1 if none
+    int dupIdleFence();
 private:
+    enum {
+        IDLE_FENCE_TIMEOUT = 100, // ms
+    };
     int mRefCount;
     Wsbm& mWsbm;
     void* mBufferObject;
@@ -61,6 +68,7 @@ private:
     uint32_t mGttOffsetInPage;
     void* mCpuAddress;
     uint32_t mSize;
+    int mIdleFenceFd;
 };
 
 } //namespace intel
@@ -24,7 +24,8 @@ namespace android {
 namespace intel {
 
 VideoPayloadManager::VideoPayloadManager()
-    : IVideoPayloadManager()
+    : IVideoPayloadManager(),
+      mClock(0)
 {
 }
 
@@ -45,6 +46,64 @@ bool VideoPayloadManager::getMetaData(BufferMapper *mapper, MetaData *metadata)
         return false;
     }
 
+    // the payload is uncached memory, only the key is read when the
+    // frame in this buffer hasn't changed since the last call
+    SnapshotKey key;
+    readKey(p, key);
+
+    Mutex::Autolock _l(mLock);
+    ssize_t index = mSnapshots.indexOfKey(mapper);
+    if (index >= 0) {
+        Snapshot& snapshot = mSnapshots.editValueAt(index);
+        if (snapshot.payload != p || !keyEquals(snapshot.key, key)) {
+            snapshot.payload = p;
+            snapshot.key = key;
+            readMetaData(p, &snapshot.metadata);
+        }
+        snapshot.lastUsed = ++mClock;
+        *metadata = snapshot.metadata;
+        return true;
+    }
+
+    if (mSnapshots.size() >= SNAPSHOT_CACHE_SIZE) {
+        size_t oldest = 0;
+        for (size_t i = 1; i < mSnapshots.size(); i++) {
+            if (mSnapshots.valueAt(i).lastUsed < mSnapshots.valueAt(oldest).lastUsed)
+                oldest = i;
+        }
+        mSnapshots.removeItemsAt(oldest);
+    }
+
+    Snapshot snapshot;
+    snapshot.payload = p;
+    snapshot.key = key;
+    readMetaData(p, &snapshot.metadata);
+    snapshot.lastUsed = ++mClock;
+    mSnapshots.add(mapper, snapshot);
+    *metadata = snapshot.metadata;
+    return true;
+}
+
+void VideoPayloadManager::readKey(const VideoPayloadBuffer *p, SnapshotKey& key)
+{
+    key.khandle = p->khandle;
+    key.rotatedHandle = p->rotated_buffer_handle;
+    key.scalingHandle = p->scaling_khandle;
+    key.timestamp = p->timestamp;
+    key.transform = p->metadata_transform;
+}
+
+bool VideoPayloadManager::keyEquals(const SnapshotKey& a, const SnapshotKey& b)
+{
+    return a.khandle == b.khandle &&
+           a.rotatedHandle == b.rotatedHandle &&
+           a.scalingHandle == b.scalingHandle &&
+           a.timestamp == b.timestamp &&
+           a.transform == b.transform;
+}
+
+void VideoPayloadManager::readMetaData(const VideoPayloadBuffer *p, MetaData *metadata)
+{
     metadata->format = p->format;
     metadata->transform = p->metadata_transform;
     metadata->timestamp = p->timestamp;
@@ -98,8 +157,13 @@ bool VideoPayloadManager::getMetaData(BufferMapper *mapper, MetaData *metadata)
     metadata->rotationBuffer.offsetX = (-metadata->rotationBuffer.width) & 0xf;
     metadata->rotationBuffer.offsetY = (-metadata->rotationBuffer.height) & 0xf;
     metadata->rotationBuffer.tiled = metadata->normalBuffer.tiled;
+}
 
-    return true;
+void VideoPayloadManager::removeMapper(BufferMapper *mapper)
+{
+    // the address may be reused by the next mapper
+    Mutex::Autolock _l(mLock);
+    mSnapshots.removeItem(mapper);
 }
 
 bool VideoPayloadManager::setRenderStatus(BufferMapper *mapper, bool renderStatus)
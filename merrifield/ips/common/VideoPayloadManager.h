@@ -17,11 +17,14 @@
 #define VIDEO_PAYLOAD_MANAGER_H
 
 #include <IVideoPayloadManager.h>
+#include <utils/Mutex.h>
+#include <utils/KeyedVector.h>
 
 namespace android {
 namespace intel {
 
 class BufferMapper;
+struct VideoPayloadBuffer;
 
 class VideoPayloadManager : public IVideoPayloadManager {
 
@@ -33,7 +36,37 @@ public:
 public:
     virtual bool getMetaData(BufferMapper *mapper, MetaData *metadata);
     virtual bool setRenderStatus(BufferMapper *mapper, bool renderStatus);
+    virtual void removeMapper(BufferMapper *mapper);
 
+private:
+    // cheap change indicator of a payload. The decoder publishes each
+    // frame, and its rotated or scaled copy, under a new handle or
+    // timestamp, the other fields are only rewritten along with them
+    struct SnapshotKey {
+        buffer_handle_t khandle;
+        buffer_handle_t rotatedHandle;
+        buffer_handle_t scalingHandle;
+        int64_t timestamp;
+        int transform;
+    };
+    // metadata as last read from the payload of one buffer
+    struct Snapshot {
+        VideoPayloadBuffer *payload;
+        SnapshotKey key;
+        MetaData metadata;
+        uint32_t lastUsed;
+    };
+    void readKey(const VideoPayloadBuffer *p, SnapshotKey& key);
+    bool keyEquals(const SnapshotKey& a, const SnapshotKey& b);
+    void readMetaData(const VideoPayloadBuffer *p, MetaData *metadata);
+
+private:
+    enum {
+        SNAPSHOT_CACHE_SIZE = 32,
+    };
+    Mutex mLock;
+    KeyedVector<BufferMapper*, Snapshot> mSnapshots;
+    uint32_t mClock;
 }; // class VideoPayloadManager
 
 } // namespace intel
@@ -13,11 +13,34 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 */
+#include <unistd.h>
 #include <HwcTrace.h>
+#include <libsync/sw_sync.h>
 #include <common/Wsbm.h>
 
+namespace android {
+namespace intel {
+
+Mutex Wsbm::sPoolBytesLock;
+uint32_t Wsbm::sPoolBytes = 0;
+
 Wsbm::Wsbm(int drmFD)
-    : mInitialized(false)
+    : mPoolLock(),
+      mLiveBuffers(),
+      mFreeBuffers(),
+      mFreeBytes(0),
+      mPoolHits(0),
+      mPoolMisses(0),
+      mPoolReleases(0),
+      mPoolTrims(0),
+      mIdleLock(),
+      mIdleCond(),
+      mIdleQueue(),
+      mIdleThread(),
+      mIdleTimelineFd(-1),
+      mIdleNextPoint(1),
+      mIdleExit(false),
+      mInitialized(false)
 {
     CTRACE();
     mDrmFD = drmFD;
@@ -41,6 +64,12 @@ bool Wsbm::initialize()
         return false;
     }
 
+    // not fatal, waitIdleTTMBufferAsync fails and callers wait synchronously,
+    // released buffers are destroyed instead of pooled
+    if (!startIdleThread()) {
+        WTRACE("asynchronous idle wait is unavailable");
+    }
+
     mInitialized = true;
     return true;
 }
@@ -50,23 +79,79 @@ void Wsbm::deinitialize()
     if (!mInitialized) {
         return;
     }
+    // queued recycles are drained before the pool is released
+    stopIdleThread();
+    releasePool();
     psbWsbmTakedown();
     mInitialized = false;
 }
 
+uint32_t Wsbm::getPageAligned(uint32_t size)
+{
+    return (size + POOL_PAGE_SIZE - 1) & ~(POOL_PAGE_SIZE - 1);
+}
+
 bool Wsbm::allocateTTMBuffer(uint32_t size, uint32_t align, void ** buf)
 {
-    int ret = psbWsbmAllocateTTMBuffer(size, align, buf);
-    if (ret) {
-        ETRACE("failed to allocate buffer");
-        return false;
+    PooledBuffer entry;
+    bool hit = false;
+
+    entry.buf = NULL;
+    entry.size = getPageAligned(size);
+    entry.align = align;
+
+    {
+        // lock scope
+        Mutex::Autolock _l(mPoolLock);
+        uint32_t maxSize = entry.size + entry.size / POOL_SLACK_DIVISOR;
+        ssize_t best = -1;
+        for (size_t i = 0; i < mFreeBuffers.size(); i++) {
+            const PooledBuffer& idle = mFreeBuffers.itemAt(i);
+            if (idle.size < entry.size || idle.size > maxSize)
+                continue;
+            // a stricter alignment satisfies a looser one
+            if (align && (idle.align < align || idle.align % align))
+                continue;
+            if (best < 0 || idle.size < mFreeBuffers.itemAt(best).size)
+                best = i;
+            if (idle.size == entry.size)
+                break;
+        }
+        if (best >= 0) {
+            entry = mFreeBuffers.itemAt(best);
+            mFreeBuffers.removeAt(best);
+            mFreeBytes -= entry.size;
+            hit = true;
+        }
+        if (hit) {
+            mPoolHits++;
+        } else {
+            mPoolMisses++;
+        }
     }
 
+    if (hit) {
+        // pooled buffers were waited idle before they were recycled
+        Mutex::Autolock _l(sPoolBytesLock);
+        sPoolBytes -= entry.size;
+    } else {
+        int ret = psbWsbmAllocateTTMBuffer(entry.size, align, &entry.buf);
+        if (ret) {
+            ETRACE("failed to allocate buffer");
+            return false;
+        }
+    }
+
+    Mutex::Autolock _l(mPoolLock);
+    mLiveBuffers.add(entry.buf, entry);
+    *buf = entry.buf;
     return true;
 }
 
 bool Wsbm::allocateTTMBufferUB(uint32_t size, uint32_t align, void ** buf, void *user_pt)
 {
+    // the memory behind user_pt can be freed and the address reused, so
+    // wraps are never pooled and a stale wrap can't be handed out
     int ret = psbWsbmAllocateFromUB(size, align, buf, user_pt);
     if (ret) {
         ETRACE("failed to allocate UB buffer");
@@ -78,6 +163,25 @@ bool Wsbm::allocateTTMBufferUB(uint32_t size, uint32_t align, void ** buf, void
 
 bool Wsbm::destroyTTMBuffer(void * buf)
 {
+    PooledBuffer entry;
+    bool pooled = false;
+
+    {
+        // lock scope
+        Mutex::Autolock _l(mPoolLock);
+        ssize_t index = mLiveBuffers.indexOfKey(buf);
+        if (index >= 0) {
+            entry = mLiveBuffers.valueAt(index);
+            mLiveBuffers.removeItemsAt(index);
+            pooled = entry.size <= POOL_MAX_BYTES;
+        }
+    }
+
+    // pooled buffers are recycled once the engine is done with them
+    if (pooled && queueRecycle(entry)) {
+        return true;
+    }
+
     int ret = psbWsbmDestroyTTMBuffer(buf);
     if (ret) {
         ETRACE("failed to destroy buffer");
@@ -87,6 +191,98 @@ bool Wsbm::destroyTTMBuffer(void * buf)
     return true;
 }
 
+bool Wsbm::queueRecycle(const PooledBuffer& entry)
+{
+    Mutex::Autolock _l(mIdleLock);
+    if (mIdleThread.get() == NULL || mIdleExit) {
+        return false;
+    }
+
+    IdleRequest request;
+    request.entry = entry;
+    request.signal = false;
+    mIdleQueue.push_back(request);
+    mIdleCond.signal();
+    return true;
+}
+
+void Wsbm::recycleBuffer(const PooledBuffer& entry)
+{
+    Vector<void*> victims;
+
+    {
+        // lock scope
+        Mutex::Autolock _l(mPoolLock);
+        Mutex::Autolock _b(sPoolBytesLock);
+
+        // make room in this instance's pool first, the byte budget is
+        // shared with the other instances
+        while (mFreeBuffers.size() &&
+               (mFreeBuffers.size() >= POOL_MAX_BUFFERS ||
+                sPoolBytes + entry.size > POOL_MAX_BYTES)) {
+            victims.push_back(mFreeBuffers.itemAt(0).buf);
+            mFreeBytes -= mFreeBuffers.itemAt(0).size;
+            sPoolBytes -= mFreeBuffers.itemAt(0).size;
+            mFreeBuffers.removeAt(0);
+        }
+
+        if (sPoolBytes + entry.size > POOL_MAX_BYTES) {
+            victims.push_back(entry.buf);
+        } else {
+            mFreeBuffers.push_back(entry);
+            mFreeBytes += entry.size;
+            sPoolBytes += entry.size;
+            mPoolReleases++;
+        }
+    }
+
+    for (size_t i = 0; i < victims.size(); i++) {
+        if (psbWsbmDestroyTTMBuffer(victims.itemAt(i))) {
+            ETRACE("failed to destroy buffer");
+        }
+    }
+}
+
+void Wsbm::trimPool()
+{
+    Mutex::Autolock _l(mPoolLock);
+    if (mFreeBuffers.size() == 0) {
+        return;
+    }
+
+    for (size_t i = 0; i < mFreeBuffers.size(); i++) {
+        psbWsbmDestroyTTMBuffer(mFreeBuffers.itemAt(i).buf);
+    }
+    mFreeBuffers.clear();
+    mPoolTrims++;
+
+    Mutex::Autolock _b(sPoolBytesLock);
+    sPoolBytes -= mFreeBytes;
+    mFreeBytes = 0;
+}
+
+void Wsbm::releasePool()
+{
+    trimPool();
+
+    Mutex::Autolock _l(mPoolLock);
+    if (mLiveBuffers.size()) {
+        WTRACE("%d TTM buffers still in use", mLiveBuffers.size());
+    }
+    mLiveBuffers.clear();
+}
+
+void Wsbm::dump(Dump& d)
+{
+    Mutex::Autolock _l(mPoolLock);
+
+    uint32_t poolRequests = mPoolHits + mPoolMisses;
+    d.append("  TTM pool: live %d, idle %d (%d KB), hits %d/%d, releases %d, "
+             "trims %d\n",
+             mLiveBuffers.size(), mFreeBuffers.size(), mFreeBytes / 1024,
+             mPoolHits, poolRequests, mPoolReleases, mPoolTrims);
+}
+
 void * Wsbm::getCPUAddress(void * buf)
 {
     return psbWsbmGetCPUAddress(buf);
@@ -134,3 +330,105 @@ bool Wsbm::waitIdleTTMBuffer(void *buf)
 
     return true;
 }
+
+int Wsbm::waitIdleTTMBufferAsync(void *buf)
+{
+    Mutex::Autolock _l(mIdleLock);
+    if (mIdleThread.get() == NULL || mIdleExit) {
+        return -1;
+    }
+
+    int fenceFd = sw_sync_fence_create(mIdleTimelineFd, "ttm_idle", mIdleNextPoint);
+    if (fenceFd < 0) {
+        WTRACE("failed to create idle fence");
+        return -1;
+    }
+    mIdleNextPoint++;
+
+    IdleRequest request;
+    request.entry.buf = buf;
+    request.entry.size = 0;
+    request.entry.align = 0;
+    request.signal = true;
+    mIdleQueue.push_back(request);
+    mIdleCond.signal();
+    return fenceFd;
+}
+
+bool Wsbm::startIdleThread()
+{
+    mIdleTimelineFd = sw_sync_timeline_create();
+    if (mIdleTimelineFd < 0) {
+        ETRACE("failed to create sync timeline");
+        return false;
+    }
+    mIdleNextPoint = 1;
+    mIdleExit = false;
+
+    mIdleThread = new IdleWaitThread(this);
+    if (mIdleThread.get() == NULL ||
+        mIdleThread->run("TTMIdleWait", PRIORITY_URGENT_DISPLAY) != NO_ERROR) {
+        ETRACE("failed to start idle wait thread");
+        mIdleThread = NULL;
+        close(mIdleTimelineFd);
+        mIdleTimelineFd = -1;
+        return false;
+    }
+    return true;
+}
+
+void Wsbm::stopIdleThread()
+{
+    sp<IdleWaitThread> thread;
+    {
+        // lock scope
+        Mutex::Autolock _l(mIdleLock);
+        mIdleExit = true;
+        mIdleCond.signal();
+        thread = mIdleThread;
+        mIdleThread = NULL;
+    }
+
+    // queued waits are drained before the thread exits
+    if (thread.get()) {
+        thread->requestExitAndWait();
+    }
+
+    if (mIdleTimelineFd >= 0) {
+        // closing the timeline signals any outstanding fence
+        close(mIdleTimelineFd);
+        mIdleTimelineFd = -1;
+    }
+}
+
+bool Wsbm::idleThreadLoop()
+{
+    IdleRequest request;
+    {
+        // lock scope
+        Mutex::Autolock _l(mIdleLock);
+        while (mIdleQueue.size() == 0) {
+            if (mIdleExit) {
+                return false;
+            }
+            mIdleCond.wait(mIdleLock);
+        }
+        request = mIdleQueue.itemAt(0);
+        mIdleQueue.removeAt(0);
+    }
+
+    if (psbWsbmWaitIdle(request.entry.buf)) {
+        WTRACE("failed to wait ttm buffer for idle");
+    }
+
+    if (request.signal) {
+        // signal even on failure so that waiters are never stuck
+        sw_sync_timeline_inc(mIdleTimelineFd, 1);
+    } else {
+        recycleBuffer(request.entry);
+    }
+    return true;
+}
+
+} // namespace intel
+} // namespace android
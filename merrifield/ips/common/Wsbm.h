@@ -16,11 +16,30 @@
 #ifndef WSBM_H__
 #define WSBM_H__
 
+#include <utils/Vector.h>
+#include <utils/KeyedVector.h>
+#include <utils/threads.h>
+#include <Dump.h>
 #include <common/WsbmWrapper.h>
 
+namespace android {
+namespace intel {
+
 /**
  * Class: WSBM
  * A wrapper class to use libwsbm functionalities
+ *
+ * TTM buffers released by destroyTTMBuffer are waited idle on the idle
+ * thread and then recycled through a free list, so a pool hit never
+ * blocks. A miss allocates the page-aligned size asked for, and a hit
+ * takes the smallest idle buffer no more than 1/POOL_SLACK_DIVISOR
+ * larger. Idle buffers of all instances share one byte budget and are
+ * released by trimPool and on deinitialize.
+ *
+ * User pointer wraps are not pooled, the memory behind a user pointer
+ * may be freed and the address reused. Their only user, the rotation
+ * buffer provider, keeps its wraps by user pointer already and drops
+ * them when it invalidates its caches, which is when they go stale.
  */
 class Wsbm
 {
@@ -39,9 +58,75 @@ public:
     bool wrapTTMBuffer(int64_t handle, void **buf);
     bool unreferenceTTMBuffer(void *buf);
     bool waitIdleTTMBuffer(void *buf);
+    // returns a sync fence signaled once the buffer is idle, or -1 if
+    // the wait cannot be queued. buffer must stay alive until signaled
+    int waitIdleTTMBufferAsync(void *buf);
     uint64_t getKBufHandle(void *buf);
+    // releases idle pooled buffers, buffers in use are not affected
+    void trimPool();
+    void dump(Dump& d);
+private:
+    struct PooledBuffer {
+        void *buf;
+        uint32_t size;   // page-aligned size, 0 for idle waits
+        uint32_t align;
+    };
+    struct IdleRequest {
+        PooledBuffer entry;
+        bool signal;     // advance the idle timeline, else recycle entry
+    };
+    static uint32_t getPageAligned(uint32_t size);
+    bool queueRecycle(const PooledBuffer& entry);
+    void recycleBuffer(const PooledBuffer& entry);
+    void releasePool();
+    bool startIdleThread();
+    void stopIdleThread();
+    bool idleThreadLoop();
+private:
+    class IdleWaitThread : public Thread {
+    public:
+        IdleWaitThread(Wsbm *owner) : mOwner(owner) {}
+    private:
+        virtual bool threadLoop() { return mOwner->idleThreadLoop(); }
+    private:
+        Wsbm *mOwner;
+    };
+    friend class IdleWaitThread;
 private:
+    enum {
+        POOL_PAGE_SIZE = 4096,
+        POOL_SLACK_DIVISOR = 8,                // idle buffers reused up to 1/8 larger
+        POOL_MAX_BYTES = 48 * 1024 * 1024,     // idle TTM buffers kept, all instances
+        POOL_MAX_BUFFERS = 16,                 // idle TTM buffers kept, per instance
+    };
+    // idle bytes pooled by all instances, guarded by sPoolBytesLock
+    static Mutex sPoolBytesLock;
+    static uint32_t sPoolBytes;
+
+    Mutex mPoolLock;
+    // buffers handed out, keyed by buffer object
+    KeyedVector<void*, PooledBuffer> mLiveBuffers;
+    // idle buffers, least recently released first
+    Vector<PooledBuffer> mFreeBuffers;
+    uint32_t mFreeBytes;
+    uint32_t mPoolHits;
+    uint32_t mPoolMisses;
+    uint32_t mPoolReleases;
+    uint32_t mPoolTrims;
+
+    // asynchronous idle waits and recycles, served in order. waits are
+    // signaled on a sw_sync timeline
+    Mutex mIdleLock;
+    Condition mIdleCond;
+    Vector<IdleRequest> mIdleQueue;
+    sp<IdleWaitThread> mIdleThread;
+    int mIdleTimelineFd;
+    uint32_t mIdleNextPoint;
+    bool mIdleExit;
     bool mInitialized;
 };
 
+} // namespace intel
+} // namespace android
+
 #endif /*__INTEL_WSBM_H__*/
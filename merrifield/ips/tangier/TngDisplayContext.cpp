@@ -20,6 +20,7 @@
 #include <IDisplayDevice.h>
 #include <HwcLayerList.h>
 #include <tangier/TngDisplayContext.h>
+#include <sync/sync.h>
 
 namespace android {
 namespace intel {
@@ -30,6 +31,7 @@ TngDisplayContext::TngDisplayContext()
       mCount(0)
 {
     CTRACE();
+    memset(mPlanes, 0, sizeof(mPlanes));
 }
 
 TngDisplayContext::~TngDisplayContext()
@@ -100,9 +102,34 @@ bool TngDisplayContext::commitContents(hwc_display_contents_1_t *display, HwcLay
         ret = plane->flip(NULL);
         if (ret == false) {
             VTRACE("failed to flip plane %d", i);
+            plane->flipCommitted(false);
             continue;
         }
 
+        // the display waits for the plane's buffer along with the layer
+        int flipFenceFd = plane->takeFlipFence();
+        if (flipFenceFd >= 0) {
+            hwc_layer_1_t& layer = display->hwLayers[i];
+            if (layer.acquireFenceFd < 0) {
+                layer.acquireFenceFd = flipFenceFd;
+            } else {
+                int merged = sync_merge("hwc_overlay", layer.acquireFenceFd, flipFenceFd);
+                if (merged < 0) {
+                    // never stall the commit on it, a late buffer only tears
+                    WTRACE("failed to merge flip fence, waiting for it");
+                    if (sync_wait(flipFenceFd, FLIP_FENCE_TIMEOUT) < 0) {
+                        ETRACE("flip fence not signaled in %dms, plane %d",
+                               FLIP_FENCE_TIMEOUT, i);
+                    }
+                } else {
+                    close(layer.acquireFenceFd);
+                    layer.acquireFenceFd = merged;
+                }
+                close(flipFenceFd);
+            }
+        }
+
+        mPlanes[mCount] = plane;
         IMG_hwc_layer_t *imgLayer = &imgLayerList[mCount++];
         // update IMG layer
         imgLayer->psLayer = &display->hwLayers[i];
@@ -153,8 +180,10 @@ bool TngDisplayContext::commitEnd(size_t numDisplays, hwc_display_contents_1_t *
                                           &releaseFenceFd);
         if (err) {
             ETRACE("post failed, err = %d", err);
+            notifyFlipCommitted(false);
             return false;
         }
+        notifyFlipCommitted(true);
     }
 
     // close acquire fence
@@ -236,6 +265,15 @@ bool TngDisplayContext::commitEnd(size_t numDisplays, hwc_display_contents_1_t *
     return true;
 }
 
+void TngDisplayContext::notifyFlipCommitted(bool committed)
+{
+    for (size_t i = 0; i < mCount; i++) {
+        if (mPlanes[i]) {
+            mPlanes[i]->flipCommitted(committed);
+        }
+    }
+}
+
 bool TngDisplayContext::compositionComplete()
 {
     return true;
@@ -36,6 +36,8 @@ IMG_display_device_public_t;
 namespace android {
 namespace intel {
 
+class DisplayPlane;
+
 class TngDisplayContext : public IDisplayContext {
 public:
     TngDisplayContext();
@@ -52,11 +54,15 @@ public:
 private:
     enum {
         MAXIMUM_LAYER_NUMBER = 20,
+        FLIP_FENCE_TIMEOUT = 50, // ms
     };
     IMG_display_device_public_t *mIMGDisplayDevice;
     IMG_hwc_layer_t mImgLayers[MAXIMUM_LAYER_NUMBER];
+    DisplayPlane *mPlanes[MAXIMUM_LAYER_NUMBER];
     bool mInitialized;
     size_t mCount;
+private:
+    void notifyFlipCommitted(bool committed);
 };
 
 } // namespace intel
@@ -50,7 +50,9 @@ bool TngOverlayPlane::flip(void *ctx)
     mContext.ctx.ov_ctx.index = mIndex;
     mContext.ctx.ov_ctx.pipe = mDevice;
     mContext.ctx.ov_ctx.ovadd |= mPipeConfig;
-    mContext.ctx.ov_ctx.ovadd |= 0x1;
+    // load coefficients only if they differ from the loaded ones
+    if (commitFlipBackBuffer())
+        mContext.ctx.ov_ctx.ovadd |= 0x1;
 
     // move to next back buffer
     //mCurrent = (mCurrent + 1) % OVERLAY_BACK_BUFFER_COUNT;
@@ -27,6 +27,7 @@ TngPlaneManager::TngPlaneManager()
     : DisplayPlaneManager()
 {
     memset(&mZorder, 0, sizeof(mZorder));
+    memset(mZOrderValid, 0, sizeof(mZOrderValid));
 }
 
 TngPlaneManager::~TngPlaneManager()
@@ -40,6 +41,7 @@ bool TngPlaneManager::initialize()
     mPrimaryPlaneCount = 3;  // Primary A, B, C
     mCursorPlaneCount = 3;
 
+    compileZOrderTable();
     return DisplayPlaneManager::initialize();
 }
 
@@ -77,45 +79,43 @@ DisplayPlane* TngPlaneManager::allocPlane(int index, int type)
     return plane;
 }
 
-bool TngPlaneManager::isValidZOrder(int dsp, ZOrderConfig& config)
+void TngPlaneManager::compileZOrderTable()
 {
-    // check whether it's a supported z order config
-    int firstRGB = -1;
-    int lastRGB = -1;
-    int firstOverlay = -1;
-    int lastOverlay = -1;
-
-    for (int i = 0; i < (int)config.size(); i++) {
-        const ZOrderLayer *layer = config[i];
-        switch (layer->planeType) {
-        case DisplayPlane::PLANE_PRIMARY:
-        case DisplayPlane::PLANE_SPRITE:
-            if (firstRGB == -1) {
-                firstRGB = i;
-                lastRGB = i;
-            } else {
-                lastRGB = i;
-            }
-            break;
-        case DisplayPlane::PLANE_OVERLAY:
-        case DisplayPlane::PLANE_CURSOR:
-            if (firstOverlay == -1) {
-                firstOverlay = i;
-                lastOverlay = i;
-            } else {
-                lastOverlay = i;
-            }
-            break;
+    // every layer count and overlay mask, where bit i is set when layer i
+    // goes to an overlay or cursor plane. Those have to be all below or
+    // all above the RGB layers
+    for (int size = 1; size <= MAX_ZORDER_LAYERS; size++) {
+        uint32_t all = (1U << size) - 1;
+        for (uint32_t mask = 0; mask <= all; mask++) {
+            uint32_t rgb = all & ~mask;
+            bool valid = !mask || !rgb ||
+                         (31 - __builtin_clz(rgb)) < __builtin_ctz(mask) ||
+                         (31 - __builtin_clz(mask)) < __builtin_ctz(rgb);
+            mZOrderValid[(1U << size) | mask] = valid;
         }
     }
+}
 
-    if ((lastRGB < firstOverlay) || (firstRGB > lastOverlay)) {
-        return true;
-    } else {
-        VTRACE("invalid z order config. rgb (%d, %d) yuv (%d, %d)",
-               firstRGB, lastRGB, firstOverlay, lastOverlay);
+bool TngPlaneManager::isValidZOrder(int dsp, ZOrderConfig& config)
+{
+    int size = (int)config.size();
+    if (size <= 0 || size > MAX_ZORDER_LAYERS) {
+        VTRACE("invalid z order config size %d", size);
         return false;
     }
+
+    uint32_t mask = 0;
+    for (int i = 0; i < size; i++) {
+        int type = config[i]->planeType;
+        if (type == DisplayPlane::PLANE_OVERLAY || type == DisplayPlane::PLANE_CURSOR)
+            mask |= 1U << i;
+    }
+
+    if (!mZOrderValid[(1U << size) | mask]) {
+        VTRACE("invalid z order config, overlay mask %#x of %d layers", mask, size);
+        return false;
+    }
+    return true;
 }
 
 bool TngPlaneManager::assignPlanes(int dsp, ZOrderConfig& config)
@@ -137,7 +137,7 @@ bool TngPlaneManager::assignPlanes(int dsp, ZOrderConfig& config)
     // allocate planes
     for (int i = 0; i < size; i++) {
         ZOrderLayer *layer = config.itemAt(i);
-        layer->plane = getPlaneHelper(dsp, layer->planeType);
+        layer->plane = getPlaneHelper(dsp, layer->planeType, layer->preferredPlane);
         if (layer->plane == NULL) {
             // should never happen!!
             ETRACE("failed to assign plane for type %d", layer->planeType);
@@ -162,7 +162,7 @@ void* TngPlaneManager::getZOrderConfig() const
     return (void*)&mZorder;
 }
 
-DisplayPlane* TngPlaneManager::getPlaneHelper(int dsp, int type)
+DisplayPlane* TngPlaneManager::getPlaneHelper(int dsp, int type, DisplayPlane *preferred)
 {
     RETURN_NULL_IF_NOT_INIT();
 
@@ -171,6 +171,13 @@ DisplayPlane* TngPlaneManager::getPlaneHelper(int dsp, int type)
         return 0;
     }
 
+    // keep layer on the plane it was bound to if it's still free
+    if (preferred && preferred->getType() == type &&
+        (type == DisplayPlane::PLANE_SPRITE || type == DisplayPlane::PLANE_OVERLAY) &&
+        isFreePlane(type, preferred->getIndex())) {
+        return getPlane(type, preferred->getIndex());
+    }
+
     int index = dsp == IDisplayDevice::DEVICE_PRIMARY ? 0 : 1;
 
     if (type == DisplayPlane::PLANE_PRIMARY ||
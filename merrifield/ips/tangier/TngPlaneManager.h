@@ -37,10 +37,18 @@ public:
 
 protected:
     DisplayPlane* allocPlane(int index, int type);
-    DisplayPlane* getPlaneHelper(int dsp, int type);
+    DisplayPlane* getPlaneHelper(int dsp, int type, DisplayPlane *preferred = NULL);
 
 private:
+    void compileZOrderTable();
+
+private:
+    enum {
+        MAX_ZORDER_LAYERS = 8,
+    };
     struct intel_dc_plane_zorder mZorder;
+    // validity of each overlay mask, indexed by (1 << layers) | mask
+    bool mZOrderValid[1 << (MAX_ZORDER_LAYERS + 1)];
 };
 
 } // namespace intel
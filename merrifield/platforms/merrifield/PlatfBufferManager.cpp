@@ -63,22 +63,35 @@ bool PlatfBufferManager::blit(buffer_handle_t srcHandle, buffer_handle_t destHan
                               const crop_t& destRect, bool async)
 
 {
-    IMG_gralloc_module_public_t *imgGrallocModule = (IMG_gralloc_module_public_t *) mGrallocModule;
     int fenceFd;
 
+    if (!blitAsync(srcHandle, destHandle, destRect, -1, &fenceFd))
+        return false;
+
+    if (fenceFd != -1) {
+        if (!async) {
+            sync_wait(fenceFd, -1);
+        }
+        close(fenceFd);
+    }
+
+    return true;
+}
+
+bool PlatfBufferManager::blitAsync(buffer_handle_t srcHandle, buffer_handle_t destHandle,
+                                   const crop_t& destRect, int srcFenceFd, int *fenceFd)
+{
+    IMG_gralloc_module_public_t *imgGrallocModule = (IMG_gralloc_module_public_t *) mGrallocModule;
+
+    *fenceFd = -1;
     if (imgGrallocModule->Blit(imgGrallocModule, srcHandle,
                                 destHandle,
                                 destRect.w, destRect.h, destRect.x,
-                                destRect.y, 0, -1, &fenceFd)) {
+                                destRect.y, 0, srcFenceFd, fenceFd)) {
         ETRACE("Blit failed");
         return false;
     }
 
-    if (!async) {
-        sync_wait(fenceFd, -1);
-    }
-    close(fenceFd);
-
     return true;
 }
 
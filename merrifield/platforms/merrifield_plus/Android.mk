@@ -30,6 +30,10 @@ LOCAL_SRC_FILES := \
     ../../common/base/Hwcomposer.cpp \
     ../../common/base/HwcModule.cpp \
     ../../common/base/DisplayAnalyzer.cpp \
+    ../../common/base/CompositionStats.cpp \
+    ../../common/base/CursorCoalescer.cpp \
+    ../../common/base/SoftCompositor.cpp \
+    ../../common/base/SoftComposeKernels.cpp \
     ../../common/base/VsyncManager.cpp \
     ../../common/buffers/BufferCache.cpp \
     ../../common/buffers/GraphicBuffer.cpp \
@@ -63,10 +63,9 @@ bool PlatfBufferManager::blit(buffer_handle_t srcHandle, buffer_handle_t destHan
                               const crop_t& destRect, bool async)
 
 {
+#ifdef ASUS_ZENFONE2_LP_BLOBS
     IMG_gralloc_module_public_t *imgGrallocModule = (IMG_gralloc_module_public_t *) mGrallocModule;
-    int fenceFd;
 
-#ifdef ASUS_ZENFONE2_LP_BLOBS
     if (imgGrallocModule->Blit(imgGrallocModule, srcHandle,
                                 destHandle,
                                 destRect.w, destRect.h, destRect.x,
@@ -75,18 +74,48 @@ bool PlatfBufferManager::blit(buffer_handle_t srcHandle, buffer_handle_t destHan
         return false;
     }
 #else
+    int fenceFd;
+
+    if (!blitAsync(srcHandle, destHandle, destRect, -1, &fenceFd))
+        return false;
+
+    if (fenceFd != -1) {
+        if (!async) {
+            sync_wait(fenceFd, -1);
+        }
+        close(fenceFd);
+    }
+#endif
+
+    return true;
+}
+
+bool PlatfBufferManager::blitAsync(buffer_handle_t srcHandle, buffer_handle_t destHandle,
+                                   const crop_t& destRect, int srcFenceFd, int *fenceFd)
+{
+    IMG_gralloc_module_public_t *imgGrallocModule = (IMG_gralloc_module_public_t *) mGrallocModule;
+
+    *fenceFd = -1;
+#ifdef ASUS_ZENFONE2_LP_BLOBS
+    // this gralloc takes and hands out no fences, so the blit completes here
+    if (srcFenceFd != -1) {
+        sync_wait(srcFenceFd, -1);
+    }
     if (imgGrallocModule->Blit(imgGrallocModule, srcHandle,
                                 destHandle,
                                 destRect.w, destRect.h, destRect.x,
-                                destRect.y, 0, -1, &fenceFd)) {
+                                destRect.y, 0, 0)) {
         ETRACE("Blit failed");
         return false;
     }
-
-    if (!async) {
-        sync_wait(fenceFd, -1);
+#else
+    if (imgGrallocModule->Blit(imgGrallocModule, srcHandle,
+                                destHandle,
+                                destRect.w, destRect.h, destRect.x,
+                                destRect.y, 0, srcFenceFd, fenceFd)) {
+        ETRACE("Blit failed");
+        return false;
     }
-    close(fenceFd);
 #endif
 
     return true;
@@ -36,6 +36,8 @@ protected:
                                         DataBuffer& buffer);
     bool blit(buffer_handle_t srcHandle, buffer_handle_t destHandle,
               const crop_t& destRect, bool async);
+    bool blitAsync(buffer_handle_t srcHandle, buffer_handle_t destHandle,
+                   const crop_t& destRect, int srcFenceFd, int *fenceFd);
 };
 
 }
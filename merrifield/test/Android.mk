@@ -24,3 +24,19 @@ LOCAL_C_INCLUDES := \
 # Build the binary to $(TARGET_OUT_DATA_NATIVE_TESTS)/$(LOCAL_MODULE)
 # to integrate with auto-test framework.
 include $(BUILD_EXECUTABLE)
+
+# Host test of the soft compositor row kernels, SIMD against scalar
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := soft_compose_kernels_test
+
+LOCAL_MODULE_TAGS := tests
+
+LOCAL_SRC_FILES := \
+    soft_compose_kernels_test.cpp \
+    ../common/base/SoftComposeKernels.cpp \
+
+LOCAL_C_INCLUDES := \
+    $(LOCAL_PATH)/../common/base \
+
+include $(BUILD_HOST_NATIVE_TEST)
@@ -0,0 +1,108 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <gtest/gtest.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <SoftComposeKernels.h>
+
+using android::intel::SoftComposeKernels;
+
+// widths cover the SIMD body, its scalar tail and rows shorter than a step
+static const uint32_t kMaxWidth = 203;
+static const int kRows = 2000;
+
+static void fillRandom(uint8_t *buf, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+        buf[i] = rand() & 0xff;
+}
+
+// alpha first, then color channels no larger than it, as premultiplied
+static void fillPremultiplied(uint8_t *rgb, uint32_t width)
+{
+    for (uint32_t x = 0; x < width; x++) {
+        uint8_t *p = rgb + x * 4;
+        p[3] = rand() % 4 ? rand() & 0xff : (rand() & 1) * 255;
+        for (int i = 0; i < 3; i++)
+            p[i] = p[3] ? rand() % (p[3] + 1) : 0;
+    }
+}
+
+static void checkLumaRows(bool premultiplied, bool bgra)
+{
+    uint8_t rgb[kMaxWidth * 4];
+    uint8_t expected[kMaxWidth];
+    uint8_t actual[kMaxWidth];
+
+    for (int row = 0; row < kRows; row++) {
+        uint32_t width = rand() % (kMaxWidth + 1);
+        if (premultiplied)
+            fillPremultiplied(rgb, width);
+        else
+            fillRandom(rgb, width * 4);
+        fillRandom(expected, width);
+        memcpy(actual, expected, width);
+
+        SoftComposeKernels::blendLumaRowScalar(expected, rgb, width, bgra);
+        SoftComposeKernels::blendLumaRow(actual, rgb, width, bgra);
+        for (uint32_t x = 0; x < width; x++) {
+            ASSERT_EQ(expected[x], actual[x])
+                << "row " << row << ", width " << width << ", pixel " << x;
+        }
+    }
+}
+
+TEST(SoftComposeKernels, LumaMatchesScalarRGBA)
+{
+    srand(1);
+    checkLumaRows(true, false);
+}
+
+TEST(SoftComposeKernels, LumaMatchesScalarBGRA)
+{
+    srand(2);
+    checkLumaRows(true, true);
+}
+
+TEST(SoftComposeKernels, LumaMatchesScalarUnpremultiplied)
+{
+    srand(3);
+    checkLumaRows(false, false);
+}
+
+TEST(SoftComposeKernels, OpaqueBlackAndTransparent)
+{
+    uint8_t rgb[16 * 4];
+    uint8_t luma[16];
+
+    // opaque black gives black, whatever was below
+    memset(rgb, 0, sizeof(rgb));
+    for (int x = 0; x < 16; x++)
+        rgb[x * 4 + 3] = 255;
+    memset(luma, 200, sizeof(luma));
+    SoftComposeKernels::blendLumaRow(luma, rgb, 16, false);
+    for (int x = 0; x < 16; x++)
+        EXPECT_EQ(SoftComposeKernels::LUMA_BLACK, luma[x]);
+
+    // fully transparent leaves the video alone
+    memset(rgb, 0, sizeof(rgb));
+    memset(luma, 123, sizeof(luma));
+    SoftComposeKernels::blendLumaRow(luma, rgb, 16, true);
+    for (int x = 0; x < 16; x++)
+        EXPECT_EQ(123, luma[x]);
+}
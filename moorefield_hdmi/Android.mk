@@ -60,7 +60,7 @@ LOCAL_SRC_FILES += \
     ips/common/VsyncControl.cpp \
     ips/common/OverlayPlaneBase.cpp \
     ips/common/SpritePlaneBase.cpp \
-    ips/common/PixelFormat.cpp \
+    ../merrifield/ips/common/PixelFormat.cpp \
     ips/common/GrallocBufferBase.cpp \
     ips/common/GrallocBufferMapperBase.cpp \
     ips/common/TTMBufferMapper.cpp \
@@ -94,7 +94,9 @@ LOCAL_C_INCLUDES := \
     $(TARGET_OUT_HEADERS)/libdrm \
     $(TARGET_OUT_HEADERS)/libwsbm/wsbm \
     $(TARGET_OUT_HEADERS)/libttm \
-    frameworks/native/include/media/openmax
+    $(TARGET_OUT_HEADERS)/khronos/openmax \
+    frameworks/native/include/media/openmax \
+    $(LOCAL_PATH)/../merrifield/ips/common
 
 ifeq ($(TARGET_SUPPORT_HDMI_PRIMARY),true)
    LOCAL_CFLAGS += -DINTEL_SUPPORT_HDMI_PRIMARY
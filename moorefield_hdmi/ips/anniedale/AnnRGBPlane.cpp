@@ -18,7 +18,7 @@
 #include <BufferManager.h>
 #include <ips/anniedale/AnnRGBPlane.h>
 #include <ips/tangier/TngGrallocBuffer.h>
-#include <ips/common/PixelFormat.h>
+#include <PixelFormat.h>
 
 namespace android {
 namespace intel {
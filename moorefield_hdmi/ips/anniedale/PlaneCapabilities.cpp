@@ -18,6 +18,7 @@
 #include <DisplayPlane.h>
 #include <PlaneCapabilities.h>
 #include <ips/common/OverlayHardware.h>
+#include <PixelFormat.h>
 #include <common/base/HwcLayer.h>
 #include <khronos/openmax/OMX_IntelVideoExt.h>
 #include <hal_public.h>
@@ -35,39 +36,27 @@ bool PlaneCapabilities::isFormatSupported(int planeType, HwcLayer *hwcLayer)
 {
     uint32_t format = hwcLayer->getFormat();
     uint32_t trans = hwcLayer->getLayer()->transform;
+    const PixelFormat::FormatDescriptor *desc = PixelFormat::getDescriptor(format);
 
     if (planeType == DisplayPlane::PLANE_SPRITE || planeType == DisplayPlane::PLANE_PRIMARY) {
-        switch (format) {
-        case HAL_PIXEL_FORMAT_BGRA_8888:
-        case HAL_PIXEL_FORMAT_BGRX_8888:
-        case HAL_PIXEL_FORMAT_RGBA_8888:
-        case HAL_PIXEL_FORMAT_RGBX_8888:
-        case HAL_PIXEL_FORMAT_RGB_565:
-            return trans ? false : true;
-        default:
+        if (!desc || !(desc->flags & PixelFormat::FORMAT_SPRITE)) {
             VLOGTRACE("unsupported format %#x", format);
             return false;
         }
+        return trans ? false : true;
     } else if (planeType == DisplayPlane::PLANE_OVERLAY) {
-        switch (format) {
-        case HAL_PIXEL_FORMAT_I420:
-        case HAL_PIXEL_FORMAT_YUY2:
-        case HAL_PIXEL_FORMAT_UYVY:
-            // TODO: overlay supports 180 degree rotation
-            if (trans == HAL_TRANSFORM_ROT_180) {
-                WLOGTRACE("180 degree rotation is not supported yet");
-            }
-            return trans ? false : true;
-        case HAL_PIXEL_FORMAT_YV12:
-            return trans ? false: true;
-        case HAL_PIXEL_FORMAT_NV12:
-        case OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar:
-        case OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar_Tiled:
-            return true;
-        default:
+        if (!desc || !(desc->flags & PixelFormat::FORMAT_OVERLAY)) {
             VLOGTRACE("unsupported format %#x", format);
             return false;
         }
+        if (desc->flags & PixelFormat::FORMAT_OVERLAY_ROTATION) {
+            return true;
+        }
+        // TODO: overlay supports 180 degree rotation
+        if (trans == HAL_TRANSFORM_ROT_180 && format != HAL_PIXEL_FORMAT_YV12) {
+            WLOGTRACE("180 degree rotation is not supported yet");
+        }
+        return trans ? false : true;
     } else {
         ELOGTRACE("invalid plane type %d", planeType);
         return false;
@@ -79,46 +68,28 @@ bool PlaneCapabilities::isSizeSupported(int planeType, HwcLayer *hwcLayer)
     uint32_t format = hwcLayer->getFormat();
     const stride_t& stride = hwcLayer->getBufferStride();
 
-    bool isYUVPacked;
+    const PixelFormat::FormatDescriptor *desc = PixelFormat::getDescriptor(format);
     uint32_t maxStride;
 
     if (planeType == DisplayPlane::PLANE_SPRITE || planeType == DisplayPlane::PLANE_PRIMARY) {
-        switch (format) {
-        case HAL_PIXEL_FORMAT_BGRA_8888:
-        case HAL_PIXEL_FORMAT_BGRX_8888:
-        case HAL_PIXEL_FORMAT_RGBA_8888:
-        case HAL_PIXEL_FORMAT_RGBX_8888:
-        case HAL_PIXEL_FORMAT_RGB_565:
-            VLOGTRACE("stride %d", stride.rgb.stride);
-            if (stride.rgb.stride > SPRITE_PLANE_MAX_STRIDE_LINEAR) {
-                VLOGTRACE("too large stride %d", stride.rgb.stride);
-                return false;
-            }
-            return true;
-        default:
+        if (!desc || !(desc->flags & PixelFormat::FORMAT_SPRITE)) {
             VLOGTRACE("unsupported format %#x", format);
             return false;
         }
+        VLOGTRACE("stride %d", stride.rgb.stride);
+        if (stride.rgb.stride > SPRITE_PLANE_MAX_STRIDE_LINEAR) {
+            VLOGTRACE("too large stride %d", stride.rgb.stride);
+            return false;
+        }
+        return true;
     } else if (planeType == DisplayPlane::PLANE_OVERLAY) {
-        switch (format) {
-        case HAL_PIXEL_FORMAT_YV12:
-        case HAL_PIXEL_FORMAT_I420:
-        case HAL_PIXEL_FORMAT_NV12:
-        case OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar:
-        case OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar_Tiled:
-            isYUVPacked = false;
-            break;
-        case HAL_PIXEL_FORMAT_YUY2:
-        case HAL_PIXEL_FORMAT_UYVY:
-            isYUVPacked = true;
-            break;
-        default:
+        if (!desc || !(desc->flags & PixelFormat::FORMAT_OVERLAY)) {
             VLOGTRACE("unsupported format %#x", format);
             return false;
         }
         // don't use overlay plane if stride is too big
         maxStride = OVERLAY_PLANE_MAX_STRIDE_LINEAR;
-        if (isYUVPacked) {
+        if (desc->flags & PixelFormat::FORMAT_PACKED) {
             maxStride = OVERLAY_PLANE_MAX_STRIDE_PACKED;
         }
 
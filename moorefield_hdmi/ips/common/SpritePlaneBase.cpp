@@ -15,7 +15,7 @@
 */
 #include <common/utils/HwcTrace.h>
 #include <ips/common/SpritePlaneBase.h>
-#include <ips/common/PixelFormat.h>
+#include <PixelFormat.h>
 
 namespace android {
 namespace intel {